@@ -3,11 +3,8 @@
 #include "../shader_includes/spring_types.in"
 
 
-layout(std430, binding = BINDING_PARTICLES_OUT) buffer ParticleDataOut
-{
-    Particle particles[];
-};
+#include "../shader_includes/particle_storage.in"
 
 void main() {
-    gl_Position = vec4(particles[gl_VertexID].pos, 1.0);
+    gl_Position = vec4(load_pos_out(gl_VertexID), 1.0);
 }
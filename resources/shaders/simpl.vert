@@ -16,10 +16,7 @@ layout(location = 0) in vec3 iPos;
 //layout(location = 0) uniform mat4 M;
 layout(location = 1) uniform mat4 PV;
 
-layout(std430, binding = BINDING_PARTICLES_OUT) buffer ParticleDataOut
-{
-    Particle particles[];
-};
+#include "../shader_includes/particle_storage.in"
 
 layout(std430, binding = BINDING_ALIVE_LIST_OUT) buffer ParticleIndicesAlive
 {
@@ -56,6 +53,6 @@ void main() {
     //vec4 posWorld = M * vec4(iPos, 1.0) + vec4(iOffsetXZ.x, 0, iOffsetXZ.y, 0);
     uint idx = alive_particles_idx[gl_InstanceID];
     normWorld = iPos;
-    gl_Position = PV * vec4(iPos * config.particle_size + particles[idx].pos, 1.0);
+    gl_Position = PV * vec4(iPos * config.particle_size + load_pos_out(idx), 1.0);
 
 }
@@ -5,11 +5,8 @@
 
 layout(location = 1) uniform mat4 PV;
 
-layout(std430, binding = BINDING_PARTICLES_OUT) buffer ParticleDataOut
-{
-    Particle particles[];
-};
+#include "../shader_includes/particle_storage.in"
 
 void main() {
-    gl_Position = PV * vec4(particles[gl_VertexID].pos, 1.0);
+    gl_Position = PV * vec4(load_pos_out(gl_VertexID), 1.0);
 }
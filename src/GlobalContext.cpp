@@ -8,19 +8,13 @@
 #include <GLFW/glfw3.h>
 
 #include <particle_types.in>
+#include "utils/Tracer.hpp"
 
 GlobalContext::GlobalContext() {
 
     const std::filesystem::path proj_dir(PROJECT_DIR);
     const std::filesystem::path shad_dir = proj_dir / "resources/shaders";
 
-    std::array<Shader, 2> particle_shaders = { 
-        Shader((shad_dir / "simpl.vert"), Shader::Type::Vertex ),
-        Shader((shad_dir / "simpl.frag"), Shader::Type::Fragment)
-    };
-
-    m_particle_draw_program = ShaderProgram(particle_shaders.data(), (uint32_t)particle_shaders.size());
-
     m_sphere_mesh = TriangleMesh(proj_dir / "resources/ply/sphere.ply");
     m_sphere_mesh.upload_to_gpu();
     std::array<Shader, 2> sphere_shaders = {
@@ -68,6 +62,13 @@ m_particle_sys.set_sphere(m_sphere_pos, m_sphere_radius);
 m_cloth_sys.set_sphere(m_sphere_pos, m_sphere_radius);
 m_spring_sys.set_sphere(m_sphere_pos, m_sphere_radius);
 
+m_particle_sys.set_gpu_profiler(&m_gpu_profiler);
+m_cloth_sys.set_gpu_profiler(&m_gpu_profiler);
+m_spring_sys.set_gpu_profiler(&m_gpu_profiler);
+m_particle_sys.set_upload_ring(&m_upload_ring);
+m_cloth_sys.set_upload_ring(&m_upload_ring);
+m_spring_sys.set_upload_ring(&m_upload_ring);
+
 // Set default bindings 
 switch (m_simulation_mode)
 {
@@ -90,36 +91,53 @@ case SimulationMode::eCloth:
 
 void GlobalContext::update()
 {
+    Tracer::Scope trace("GlobalContext::update");
     // update particle system from previous frame information
     // to use cpu time drawing the gui
     float time = (float)glfwGetTime();
+    m_num_steps_last_frame = 0;
     if (m_run_simulation) {
 
         float delta_time;
+        uint32_t num_steps = m_num_substeps;
         switch (m_deltatime_mode)
         {
         case GlobalContext::DeltaTimeMode::eDynamic:
-            delta_time = ImGui::GetIO().DeltaTime;
+            delta_time = ImGui::GetIO().DeltaTime / (float)m_num_substeps;
             break;
         case GlobalContext::DeltaTimeMode::eStaticMax:
-            delta_time = 1.0f / (float)m_max_fps;
+            delta_time = 1.0f / (float)(m_max_fps * m_num_substeps);
             break;
+        case GlobalContext::DeltaTimeMode::eFixed:
+        {
+            const double fixed_dt = 1.0 / (m_max_fps * m_num_substeps);
+            m_time_accumulator += ImGui::GetIO().DeltaTime;
+            num_steps = (uint32_t)(m_time_accumulator / fixed_dt);
+            // Do not try to catch up after a long frame, or the next one will be even longer
+            if (num_steps > 2 * m_num_substeps) {
+                num_steps = 2 * m_num_substeps;
+                m_time_accumulator = 0.0;
+            }
+            else {
+                m_time_accumulator -= num_steps * fixed_dt;
+            }
+            delta_time = (float)fixed_dt;
+            break;
+        }
         default:
             break;
         }
 
-        switch (m_simulation_mode)
-        {
-        case SimulationMode::eParticle:
-            m_particle_sys.update(time, delta_time);
-            break;
-        case SimulationMode::eSprings:
-            m_spring_sys.update(time, delta_time);
-            break;
-        case SimulationMode::eCloth:
-            m_cloth_sys.update(time, delta_time);
-            break;
+        // All the steps are recorded back to back, each system only adds
+        // the barriers that its next step needs
+        Tracer::Scope trace_steps("step_simulation");
+        for (uint32_t i = 0; i < num_steps; ++i) {
+            step_simulation(time + (float)i * delta_time, delta_time);
         }
+        m_num_steps_last_frame = num_steps;
+    }
+    else {
+        m_time_accumulator = 0.0;
     }
 
 
@@ -158,6 +176,7 @@ void GlobalContext::update()
             ImGui::Checkbox("Scene info", &m_scene_window);
             ImGui::Checkbox("ImGui Demo Window", &m_show_imgui_demo_window);
             ImGui::Checkbox("Camera info", &m_show_camera_window);
+            ImGui::Checkbox("GPU profiler", &m_show_gpu_profiler_window);
 
 
             ImGui::EndMenu();
@@ -167,9 +186,40 @@ void GlobalContext::update()
         {
             if (ImGui::InputDouble("Max FPS", &m_max_fps, 1.0)) {
                 m_max_fps = std::clamp(m_max_fps, 1.0, 500.0);
+                m_frame_pacer.set_target_fps(m_max_fps);
+            }
+            bool limit_fps = m_frame_pacer.is_enabled();
+            if (ImGui::Checkbox("Limit frame rate", &limit_fps)) {
+                m_frame_pacer.set_enabled(limit_fps);
+            }
+            int32_t spin_us = (int32_t)m_frame_pacer.get_spin_time().count();
+            if (ImGui::InputInt("Spin time (us)", &spin_us, 50)) {
+                m_frame_pacer.set_spin_time(std::chrono::microseconds(std::clamp(spin_us, 0, 5000)));
+            }
+            const FramePacer::Stats pacing = m_frame_pacer.get_stats();
+            ImGui::Text("Frame %.3f ms", pacing.mean_frame_ms);
+            ImGui::Text("Jitter mean %.1f us, std dev %.1f us, max %.1f us",
+                pacing.mean_jitter_us, pacing.stddev_jitter_us, pacing.max_jitter_us);
+            ImGui::Separator();
+            ImGui::Combo("Time step mode", (int32_t*)&m_deltatime_mode, "Dynamic\0Static Max\0Fixed\0");
+            if (ImGui::InputScalar("Substeps", ImGuiDataType_U32, &m_num_substeps)) {
+                m_num_substeps = std::clamp(m_num_substeps, 1u, MAX_SUBSTEPS);
             }
+            ImGui::Text("Steps last frame: %u", m_num_steps_last_frame);
             ImGui::Separator();
-            ImGui::Combo("Time step mode", (int32_t*)&m_deltatime_mode, "Dynamic\0Static Max\0");
+            bool tracing = Tracer::global().is_enabled();
+            if (ImGui::Checkbox("Record trace", &tracing)) {
+                Tracer::global().set_enabled(tracing);
+            }
+            ImGui::InputText("Trace file", m_trace_path, sizeof(m_trace_path));
+            // Between frames the pool workers are idle, so nobody is recording
+            if (ImGui::Button("Write trace")) {
+                m_trace_error = !Tracer::global().write_json(m_trace_path);
+            }
+            if (m_trace_error) {
+                ImGui::SameLine();
+                ImGui::Text("Can't write the file");
+            }
 
             ImGui::EndMenu();
         }
@@ -190,6 +240,13 @@ void GlobalContext::update()
         ImGui::End();
     }
 
+    if (m_show_gpu_profiler_window) {
+        if (ImGui::Begin("GPU Profiler", &m_show_gpu_profiler_window)) {
+            m_gpu_profiler.imgui_draw();
+        }
+        ImGui::End();
+    }
+
     if (m_scene_window) {
         ImGui::SetNextWindowSize(ImVec2(250, 180), ImGuiCond_FirstUseEver);
 
@@ -271,6 +328,8 @@ void GlobalContext::update()
 
 void GlobalContext::render()
 {
+    Tracer::Scope trace("GlobalContext::render");
+    GpuProfiler::Scope scope(&m_gpu_profiler, GpuProfiler::Pass::eRender);
     const glm::mat4 view_proj_mat = m_camera.getProjView();
     if (m_draw_sphere) {
         m_sphere_draw_program.use_program();
@@ -321,10 +380,7 @@ void GlobalContext::render()
     switch (m_simulation_mode)
     {
     case SimulationMode::eParticle:
-        m_particle_draw_program.use_program();
-        glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view_proj_mat));
-
-        m_particle_sys.gl_render_particles();
+        m_particle_sys.gl_render_particles(view_proj_mat);
         break;
     case SimulationMode::eSprings:
 
@@ -342,6 +398,22 @@ void GlobalContext::render()
     assert(glGetError() == GL_NO_ERROR);
 }
 
+void GlobalContext::step_simulation(float time, float dt)
+{
+    switch (m_simulation_mode)
+    {
+    case SimulationMode::eParticle:
+        m_particle_sys.update(time, dt);
+        break;
+    case SimulationMode::eSprings:
+        m_spring_sys.update(time, dt);
+        break;
+    case SimulationMode::eCloth:
+        m_cloth_sys.update(time, dt);
+        break;
+    }
+}
+
 glm::mat4 GlobalContext::get_mesh_transform() const
 {
     glm::mat4 t(1.0f);
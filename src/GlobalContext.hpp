@@ -4,9 +4,12 @@
 #include "Camera.hpp"
 #include "graphics/TriangleMesh.hpp"
 #include "graphics/ShaderProgram.hpp"
+#include "graphics/GpuProfiler.hpp"
+#include "graphics/UploadRing.hpp"
 #include "particle_system/ParticleSystem.hpp"
 #include "particle_system/SpringSystem.hpp"
 #include "particle_system/ClothSystem.hpp"
+#include "utils/FramePacer.hpp"
 
 class GlobalContext
 {
@@ -27,6 +30,12 @@ public:
 
 	inline double get_max_fps() const { return m_max_fps; }
 
+	FramePacer& get_frame_pacer() { return m_frame_pacer; }
+
+	GpuProfiler& get_gpu_profiler() { return m_gpu_profiler; }
+
+	UploadRing& get_upload_ring() { return m_upload_ring; }
+
 private:
 	glm::vec3 m_clear_color = glm::vec3(0.45f, 0.55f, 0.60f);
 	Camera m_camera;
@@ -34,6 +43,10 @@ private:
 	bool m_show_imgui_demo_window = false;
 	bool m_show_camera_window = false;
 	bool m_scene_window = false;
+	bool m_show_gpu_profiler_window = false;
+
+	char m_trace_path[256] = "trace.json";
+	bool m_trace_error = false;
 
 	bool m_run_simulation = true;
 
@@ -45,17 +58,30 @@ private:
 	enum class DeltaTimeMode {
 		eDynamic = 0,
 		eStaticMax = 1,
+		// Steps of 1 / (max fps * substeps), as many as fit in the elapsed time
+		eFixed = 2,
 	};
 
 	SimulationMode m_simulation_mode = SimulationMode::eCloth;
 	DeltaTimeMode m_deltatime_mode = DeltaTimeMode::eStaticMax;
 
-	ShaderProgram m_particle_draw_program;
+	GpuProfiler m_gpu_profiler;
+	// Shared by the systems, and destroyed after them
+	UploadRing m_upload_ring;
+
 	ParticleSystem m_particle_sys;
 	ClothSystem m_cloth_sys;
 	SpringSystem m_spring_sys;
 
 	double m_max_fps = 120.0;
+	FramePacer m_frame_pacer = FramePacer(m_max_fps);
+
+	// Simulation steps per frame, each of them of a fraction of the frame time
+	static constexpr uint32_t MAX_SUBSTEPS = 64;
+	uint32_t m_num_substeps = 1;
+	// Elapsed time not simulated yet, in DeltaTimeMode::eFixed
+	double m_time_accumulator = 0.0;
+	uint32_t m_num_steps_last_frame = 0;
 
 	float m_line_width = 1.0f;
 
@@ -78,6 +104,7 @@ private:
 	TriangleMesh m_floor_mesh;
 	ShaderProgram m_floor_draw_program;
 
+	void step_simulation(float time, float dt);
 	glm::mat4 get_mesh_transform() const;
 	void update_uniform_mesh() const;
 };
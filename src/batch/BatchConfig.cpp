@@ -0,0 +1,269 @@
+#include "BatchConfig.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <functional>
+#include <stdexcept>
+
+namespace {
+std::string trim(const std::string& s)
+{
+	const size_t first = s.find_first_not_of(" \t\r");
+	if (first == std::string::npos) {
+		return "";
+	}
+	const size_t last = s.find_last_not_of(" \t\r");
+	return s.substr(first, last - first + 1);
+}
+
+// Parse exactly N numbers of type T
+template<typename T, uint32_t N>
+void parse_values(const std::string& key, const std::string& value, T* out)
+{
+	std::istringstream stream(value);
+	for (uint32_t i = 0; i < N; ++i) {
+		if (!(stream >> out[i])) {
+			throw std::runtime_error("Error: Expected " + std::to_string(N) + " numbers in " + key);
+		}
+	}
+	std::string rest;
+	if (stream >> rest) {
+		throw std::runtime_error("Error: Too many values in " + key);
+	}
+}
+} // namespace
+
+BatchConfig default_batch_config(BatchConfig::Scene scene)
+{
+	BatchConfig config;
+	config.scene = scene;
+
+	// Same as the constructors of ParticleSystem, SpringSystem and ClothSystem
+	config.particle_config = {};
+	config.particle_config.max_particles = 500;
+	config.particle_config.gravity = 9.8f;
+	config.particle_config.particle_size = 1.0e-1f;
+	config.particle_config.simulation_space_size = 10.0f;
+	config.particle_config.k_v = 0.9999f;
+	config.particle_config.bounce = 0.5f;
+	config.particle_config.friction = 0.01f;
+
+	config.emitter = {};
+	config.emitter.pos = glm::vec3(5.0f);
+	config.emitter.shape = EMITTER_POINT;
+	config.emitter.size = glm::vec3(1.0f);
+	config.emitter.particles_per_second = 10.0f;
+	config.emitter.mean_lifetime = 2.0f;
+	config.emitter.var_lifetime = 1.0f;
+	config.emitter.particle_speed = 5.f;
+
+	config.spring_config = {};
+	config.spring_config.k_v = 0.9999f;
+	config.spring_config.gravity = 9.8f;
+	config.spring_config.simulation_space_size = 10.0f;
+	config.spring_config.friction = 0.02f;
+	config.spring_config.k_e = 2000.f;
+	config.spring_config.particle_mass = 1.0f;
+	if (config.scene == BatchConfig::Scene::eCloth) {
+		config.spring_config.bounce = 0.1f;
+		config.spring_config.k_d = 10.0f;
+		config.origin = glm::vec3(3.5f, 5.0f, 3.8f);
+		config.num_fixed_particles = 10;
+	}
+	else {
+		config.spring_config.bounce = 0.5f;
+		config.spring_config.k_d = 25.0f;
+		config.origin = glm::vec3(2.0f, 5.0f, 5.0f);
+		config.num_fixed_particles = 1;
+	}
+	return config;
+}
+
+BatchConfig load_batch_config(const std::filesystem::path& path)
+{
+	std::ifstream file(path);
+	if (!file) {
+		throw std::runtime_error("Error: Can't open file " + path.string());
+	}
+
+	std::map<std::string, std::string> values;
+	std::string line;
+	uint32_t line_number = 0;
+	while (std::getline(file, line)) {
+		line_number += 1;
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty()) {
+			continue;
+		}
+		const size_t eq = line.find('=');
+		if (eq == std::string::npos) {
+			throw std::runtime_error("Error: Expected key = value in line " + std::to_string(line_number));
+		}
+		values[trim(line.substr(0, eq))] = trim(line.substr(eq + 1));
+	}
+
+	BatchConfig::Scene scene_type = BatchConfig().scene;
+
+	// The scene selects the defaults of the rest of keys
+	const auto scene = values.find("scene");
+	if (scene != values.end()) {
+		if (scene->second == "particles") {
+			scene_type = BatchConfig::Scene::eParticles;
+		}
+		else if (scene->second == "rope") {
+			scene_type = BatchConfig::Scene::eRope;
+		}
+		else if (scene->second == "cloth") {
+			scene_type = BatchConfig::Scene::eCloth;
+		}
+		else {
+			throw std::runtime_error("Error: Unknown scene " + scene->second);
+		}
+		values.erase(scene);
+	}
+	BatchConfig config = default_batch_config(scene_type);
+
+	const std::filesystem::path base_dir = path.parent_path();
+	particle::ParticleSystemConfig& pc = config.particle_config;
+	spring::SpringSystemConfig& sc = config.spring_config;
+	const bool particles = config.scene == BatchConfig::Scene::eParticles;
+
+	using Setter = std::function<void(const std::string& key, const std::string& value)>;
+	const auto f32 = [](float* v) -> Setter {
+		return [v](const std::string& k, const std::string& s) { parse_values<float, 1>(k, s, v); };
+	};
+	const auto u32 = [](uint32_t* v) -> Setter {
+		return [v](const std::string& k, const std::string& s) { parse_values<uint32_t, 1>(k, s, v); };
+	};
+	const auto vec2 = [](glm::vec2* v) -> Setter {
+		return [v](const std::string& k, const std::string& s) { parse_values<float, 2>(k, s, &v->x); };
+	};
+	const auto uvec2 = [](glm::uvec2* v) -> Setter {
+		return [v](const std::string& k, const std::string& s) { parse_values<uint32_t, 2>(k, s, &v->x); };
+	};
+	const auto vec3 = [](glm::vec3* v) -> Setter {
+		return [v](const std::string& k, const std::string& s) { parse_values<float, 3>(k, s, &v->x); };
+	};
+	const auto flag = [](bool* v) -> Setter {
+		return [v](const std::string& k, const std::string& s) {
+			uint32_t b;
+			parse_values<uint32_t, 1>(k, s, &b);
+			*v = b != 0;
+		};
+	};
+	const auto file_path = [&base_dir](std::filesystem::path* v) -> Setter {
+		return [v, &base_dir](const std::string&, const std::string& s) {
+			*v = s.empty() ? std::filesystem::path() : base_dir / s;
+		};
+	};
+
+	const std::map<std::string, Setter> setters = {
+		{ "steps", u32(&config.num_steps) },
+		{ "dt", f32(&config.dt) },
+		{ "threads", u32(&config.num_threads) },
+		{ "layout", [&](const std::string&, const std::string& s) {
+			if (s == "aos") {
+				config.layout = ParticleLayout::eAoS;
+			}
+			else if (s == "soa") {
+				config.layout = ParticleLayout::eSoA;
+			}
+			else {
+				throw std::runtime_error("Error: Unknown layout " + s);
+			}
+		} },
+		{ "positions", file_path(&config.positions_path) },
+		{ "timing", file_path(&config.timing_path) },
+
+		{ "gravity", f32(particles ? &pc.gravity : &sc.gravity) },
+		{ "simulation_space_size", f32(particles ? &pc.simulation_space_size : &sc.simulation_space_size) },
+		{ "k_v", f32(particles ? &pc.k_v : &sc.k_v) },
+		{ "bounce", f32(particles ? &pc.bounce : &sc.bounce) },
+		{ "friction", f32(particles ? &pc.friction : &sc.friction) },
+		{ "intersect_sphere", flag(&config.intersect_sphere) },
+		{ "sphere_pos", vec3(&config.sphere.pos) },
+		{ "sphere_radius", f32(&config.sphere.radius) },
+
+		{ "max_particles", u32(&pc.max_particles) },
+		{ "particle_size", f32(&pc.particle_size) },
+		{ "emit_rate", f32(&config.emitter.particles_per_second) },
+		{ "emitter_shape", [&](const std::string&, const std::string& s) {
+			const std::map<std::string, uint32_t> shapes = {
+				{ "point", EMITTER_POINT },
+				{ "sphere", EMITTER_SPHERE },
+				{ "box", EMITTER_BOX },
+				{ "mesh", EMITTER_MESH },
+				{ "disc", EMITTER_DISC },
+			};
+			const auto shape = shapes.find(s);
+			if (shape == shapes.end()) {
+				throw std::runtime_error("Error: Unknown emitter shape " + s);
+			}
+			config.emitter.shape = shape->second;
+		} },
+		{ "emitter_size", vec3(&config.emitter.size) },
+		{ "spawner_pos", vec3(&config.emitter.pos) },
+		{ "mean_lifetime", f32(&config.emitter.mean_lifetime) },
+		{ "var_lifetime", f32(&config.emitter.var_lifetime) },
+		{ "particle_speed", f32(&config.emitter.particle_speed) },
+		{ "mesh", file_path(&config.mesh_path) },
+		{ "mesh_translation", vec3(&config.mesh_translation) },
+		{ "mesh_scale", f32(&config.mesh_scale) },
+
+		{ "k_e", f32(&sc.k_e) },
+		{ "k_d", f32(&sc.k_d) },
+		{ "particle_mass", f32(&sc.particle_mass) },
+		{ "origin", vec3(&config.origin) },
+		{ "num_fixed_particles", u32(&config.num_fixed_particles) },
+		{ "rope_dir", vec3(&config.rope_dir) },
+		{ "rope_particles", u32(&config.rope_num_particles) },
+		{ "rope_length", f32(&config.rope_length) },
+		{ "cloth_resolution", uvec2(&config.cloth_resolution) },
+		{ "cloth_size", vec2(&config.cloth_size) },
+		{ "provots", flag(&config.use_provots) },
+		{ "reorder", flag(&config.reorder_particles) },
+		{ "integrator", [&](const std::string&, const std::string& s) {
+			if (s == "verlet") {
+				config.integrator = CpuSpringSolver::Integrator::eVerlet;
+			}
+			else if (s == "implicit") {
+				config.integrator = CpuSpringSolver::Integrator::eImplicit;
+			}
+			else if (s == "xpbd") {
+				config.integrator = CpuSpringSolver::Integrator::eXPBD;
+			}
+			else {
+				throw std::runtime_error("Error: Unknown integrator " + s);
+			}
+		} },
+		{ "forces", [&](const std::string&, const std::string& s) {
+			if (s == "gather") {
+				config.force_accumulation = ForceAccumulation::eGather;
+			}
+			else if (s == "scatter") {
+				config.force_accumulation = ForceAccumulation::eColoredScatter;
+			}
+			else {
+				throw std::runtime_error("Error: Unknown forces " + s);
+			}
+		} },
+		{ "cg_max_iterations", u32(&config.cg_max_iterations) },
+		{ "cg_tolerance", f32(&config.cg_tolerance) },
+		{ "xpbd_iterations", u32(&config.xpbd_iterations) },
+		{ "xpbd_compliance", f32(&config.xpbd_compliance) },
+	};
+
+	for (const auto& [key, value] : values) {
+		const auto setter = setters.find(key);
+		if (setter == setters.end()) {
+			throw std::runtime_error("Error: Unknown key " + key);
+		}
+		setter->second(key, value);
+	}
+
+	if (config.dt <= 0.0f) {
+		throw std::runtime_error("Error: dt must be positive");
+	}
+	return config;
+}
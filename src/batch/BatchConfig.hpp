@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <glm/glm.hpp>
+#include "particle_types.in"
+#include "spring_types.in"
+#include "intersections.comp.in"
+#include "particle_system/ParticleLayout.hpp"
+#include "particle_system/cpu/CpuSpringSolver.hpp"
+
+// Run description of particle_sim_batch.
+// Read from a text file of "key = value" lines, where # starts a comment and vectors
+// are numbers separated by spaces. Keys that are not in the file keep the defaults
+// of the interactive application for the chosen scene.
+struct BatchConfig {
+	enum class Scene {
+		eParticles = 0,
+		eRope = 1,
+		eCloth = 2,
+	};
+
+	Scene scene = Scene::eCloth;
+	uint32_t num_steps = 1000;
+	float dt = 1.0f / 120.0f;
+	// 0 uses all the hardware threads
+	uint32_t num_threads = 0;
+	ParticleLayout layout = ParticleLayout::eAoS;
+
+	// Final positions and time of each step, as csv. Empty to skip them.
+	// Relative paths are relative to the config file.
+	std::filesystem::path positions_path;
+	std::filesystem::path timing_path;
+
+	bool intersect_sphere = true;
+	Sphere sphere = { glm::vec3(5.0f, 0.0f, 5.0f), 2.0f };
+
+	// Particles scene
+	particle::ParticleSystemConfig particle_config;
+	particle::Emitter emitter;
+	// Ply mesh to collide against. Empty for no mesh.
+	std::filesystem::path mesh_path;
+	glm::vec3 mesh_translation = glm::vec3(0.0f, 2.0f, 5.0f);
+	float mesh_scale = 2.0f;
+
+	// Rope and cloth scenes. The fixed particles hang from origin.
+	spring::SpringSystemConfig spring_config;
+	glm::vec3 origin;
+	uint32_t num_fixed_particles;
+	glm::vec3 rope_dir = glm::vec3(1.0f, 0.0f, 0.0f);
+	uint32_t rope_num_particles = 20;
+	float rope_length = 5.0f;
+	glm::uvec2 cloth_resolution = glm::uvec2(10, 10);
+	glm::vec2 cloth_size = glm::vec2(3.0f);
+	bool use_provots = true;
+	// Morton order of the cloth particles. The positions are written in the original order.
+	bool reorder_particles = true;
+	CpuSpringSolver::Integrator integrator = CpuSpringSolver::Integrator::eVerlet;
+	ForceAccumulation force_accumulation = ForceAccumulation::eGather;
+	uint32_t cg_max_iterations = 50;
+	float cg_tolerance = 1e-4f;
+	uint32_t xpbd_iterations = 10;
+	float xpbd_compliance = 0.0f;
+};
+
+// Defaults of the interactive application for the scene
+BatchConfig default_batch_config(BatchConfig::Scene scene);
+
+// Throws std::runtime_error if the file can not be read, or has unknown keys or bad values
+BatchConfig load_batch_config(const std::filesystem::path& path);
@@ -0,0 +1,220 @@
+// Headless runner of the simulations, for parameter sweeps and timing.
+// Runs the CPU solvers, so it needs no window, OpenGL context or ImGui.
+//
+// usage: particle_sim_batch <config file> [num steps]
+
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <limits>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "BatchConfig.hpp"
+#include "graphics/TriangleMesh.hpp"
+#include "particle_system/SpringSystemData.hpp"
+#include "particle_system/cpu/CpuParticleSolver.hpp"
+#include "particle_system/cpu/CpuSpringSolver.hpp"
+#include "utils/ThreadPool.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Runs the steps and fills the time of each of them, and the final positions
+void run_particles(const BatchConfig& config, ThreadPool* pool,
+	std::vector<float>* step_ms_, std::vector<glm::vec3>* positions_)
+{
+	CpuParticleSolver solver;
+	solver.set_thread_pool(pool);
+	solver.set_emitters({ config.emitter });
+	solver.initialize(config.particle_config, config.layout);
+	solver.set_sphere(config.sphere);
+	solver.set_intersect_sphere(config.intersect_sphere);
+	if (!config.mesh_path.empty()) {
+		TriangleMesh mesh(config.mesh_path);
+		glm::mat4 t(1.0f);
+		t = glm::translate(t, config.mesh_translation);
+		t = glm::scale(t, glm::vec3(config.mesh_scale));
+		mesh.apply_transform(t);
+		solver.set_mesh(mesh.get_vertices(), mesh.get_faces());
+	}
+	solver.set_intersect_mesh(!config.mesh_path.empty());
+
+	for (uint32_t step = 0; step < config.num_steps; ++step) {
+		const Clock::time_point start = Clock::now();
+		solver.step(config.dt);
+		(*step_ms_)[step] = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	// Alive particles, in the order of the alive list
+	std::vector<glm::vec3>& positions = *positions_;
+	const std::vector<uint32_t>& alive = solver.get_alive_indices();
+	positions.resize(solver.get_num_alive());
+	const uint32_t stride = config.particle_config.max_particles;
+	for (uint32_t i = 0; i < solver.get_num_alive(); ++i) {
+		const uint32_t idx = alive[i];
+		if (config.layout == ParticleLayout::eAoS) {
+			positions[i] = solver.get_particles()[idx].pos;
+		}
+		else {
+			const std::vector<float>& p = solver.get_positions();
+			positions[i] = glm::vec3(p[idx], p[stride + idx], p[2 * stride + idx]);
+		}
+	}
+}
+
+void run_springs(const BatchConfig& config, ThreadPool* pool,
+	std::vector<float>* step_ms_, std::vector<glm::vec3>* positions_)
+{
+	SpringSystemData data;
+	spring::SpringSystemConfig system_config = config.spring_config;
+	// Index of each particle in the solver, if they are reordered
+	std::vector<uint32_t> new_index;
+	if (config.scene == BatchConfig::Scene::eRope) {
+		build_rope_data(config.origin, config.rope_dir, config.rope_length,
+			config.rope_num_particles, config.num_fixed_particles, &data);
+		system_config.num_particles_per_strand = config.rope_num_particles;
+	}
+	else {
+		build_cloth_data(config.origin, config.cloth_resolution, config.cloth_size,
+			config.use_provots, config.num_fixed_particles, &data);
+		if (config.reorder_particles) {
+			reorder_spring_data(&data, &new_index);
+		}
+		build_segment_data(&data);
+		system_config.num_particles_per_strand = 0;
+	}
+	const uint32_t num_particles = system_config.num_particles = (uint32_t)data.particles.size();
+	system_config.num_segments = (uint32_t)data.segments.size();
+	system_config.num_fixed_particles = (uint32_t)data.fixed_particles.size();
+
+	CpuSpringSolver solver;
+	solver.set_thread_pool(pool);
+	solver.initialize(system_config, std::move(data), config.layout);
+	solver.set_sphere(config.sphere);
+	solver.set_intersect_sphere(config.intersect_sphere);
+	// Fixed particles follow the head, which does not collide
+	solver.set_sphere_head({ config.origin, 1.0f });
+	solver.set_intersect_sphere_head(false);
+	solver.set_integrator(config.integrator);
+	solver.set_force_accumulation(config.force_accumulation);
+	solver.set_cg_max_iterations(config.cg_max_iterations);
+	solver.set_cg_tolerance(config.cg_tolerance);
+	solver.set_xpbd_iterations(config.xpbd_iterations);
+	solver.set_xpbd_compliance(config.xpbd_compliance);
+
+	const glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	for (uint32_t step = 0; step < config.num_steps; ++step) {
+		const Clock::time_point start = Clock::now();
+		solver.step(config.dt, rotation);
+		(*step_ms_)[step] = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	std::vector<glm::vec3>& positions = *positions_;
+	positions.resize(num_particles);
+	for (uint32_t i = 0; i < num_particles; ++i) {
+		const uint32_t idx = new_index.empty() ? i : new_index[i];
+		if (config.layout == ParticleLayout::eAoS) {
+			positions[i] = solver.get_particles()[idx].pos;
+		}
+		else {
+			const std::vector<float>& p = solver.get_positions();
+			positions[i] = glm::vec3(p[idx], p[num_particles + idx], p[2 * num_particles + idx]);
+		}
+	}
+}
+
+bool write_positions(const std::filesystem::path& path, const std::vector<glm::vec3>& positions)
+{
+	std::ofstream file(path);
+	if (!file) {
+		return false;
+	}
+	file.precision(std::numeric_limits<float>::max_digits10);
+	file << "x,y,z\n";
+	for (const glm::vec3& p : positions) {
+		file << p.x << "," << p.y << "," << p.z << "\n";
+	}
+	return (bool)file;
+}
+
+bool write_timing(const std::filesystem::path& path, const std::vector<float>& step_ms)
+{
+	std::ofstream file(path);
+	if (!file) {
+		return false;
+	}
+	file << "step,ms\n";
+	for (size_t i = 0; i < step_ms.size(); ++i) {
+		file << i << "," << step_ms[i] << "\n";
+	}
+	return (bool)file;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s <config file> [num steps]\n", argv[0]);
+		return 1;
+	}
+
+	BatchConfig config;
+	try {
+		config = load_batch_config(argv[1]);
+		if (argc == 3) {
+			config.num_steps = (uint32_t)std::stoul(argv[2]);
+		}
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	ThreadPool pool(config.num_threads);
+	std::vector<float> step_ms(config.num_steps);
+	std::vector<glm::vec3> positions;
+
+	const char* scene_names[] = { "particles", "rope", "cloth" };
+	const Clock::time_point start = Clock::now();
+	try {
+		if (config.scene == BatchConfig::Scene::eParticles) {
+			run_particles(config, &pool, &step_ms, &positions);
+		}
+		else {
+			run_springs(config, &pool, &step_ms, &positions);
+		}
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	const double total_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+	if (!config.positions_path.empty() && !write_positions(config.positions_path, positions)) {
+		fprintf(stderr, "Error: Can't write %s\n", config.positions_path.string().c_str());
+		return 1;
+	}
+	if (!config.timing_path.empty() && !write_timing(config.timing_path, step_ms)) {
+		fprintf(stderr, "Error: Can't write %s\n", config.timing_path.string().c_str());
+		return 1;
+	}
+
+	printf("%s: %u steps of %g s, %u threads, %s\n", scene_names[(int)config.scene],
+		config.num_steps, config.dt, pool.get_num_threads(),
+		config.layout == ParticleLayout::eAoS ? "aos" : "soa");
+	printf("%zu particles at the end\n", positions.size());
+	if (config.num_steps > 0) {
+		std::vector<float> sorted = step_ms;
+		std::sort(sorted.begin(), sorted.end());
+		const double mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+		printf("total %.3f s, %.1f steps/s\n", total_s, config.num_steps / total_s);
+		printf("step ms: mean %.4f, min %.4f, median %.4f, p95 %.4f, max %.4f\n",
+			mean, sorted.front(), sorted[sorted.size() / 2],
+			sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)], sorted.back());
+	}
+	return 0;
+}
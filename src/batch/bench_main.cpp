@@ -0,0 +1,445 @@
+// Benchmark of the simulations, sweeping their sizes.
+// Runs the CPU solvers, so it needs no window, OpenGL context or ImGui.
+// Prints the results as JSON, to keep track of regressions between builds.
+//
+// usage: particle_sim_bench [options]
+//   --suites <list>   comma separated subset of particles,hair,cloth,mesh (default: all)
+//   --steps <n>       timed steps per case (default: 200)
+//   --warmup <n>      untimed steps before them (default: 10)
+//   --threads <n>     worker threads, 0 for all the hardware threads (default: 0)
+//   --layout <l>      aos or soa (default: aos)
+//   --quick           only the smallest sizes of each sweep
+//   --out <file>      write the JSON to a file instead of stdout
+
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include "BatchConfig.hpp"
+#include "particle_system/SpringSystemData.hpp"
+#include "particle_system/cpu/CpuParticleSolver.hpp"
+#include "particle_system/cpu/CpuSpringSolver.hpp"
+#include "utils/ThreadPool.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+	bool particles = true;
+	bool hair = true;
+	bool cloth = true;
+	bool mesh = true;
+	uint32_t num_steps = 200;
+	uint32_t num_warmup = 10;
+	uint32_t num_threads = 0;
+	ParticleLayout layout = ParticleLayout::eAoS;
+	bool quick = false;
+	std::string out_path;
+};
+
+struct BenchResult {
+	std::string suite;
+	// Parameters of the case, already formatted as JSON members
+	std::string params;
+	uint32_t num_particles;
+	uint32_t num_segments;
+	// Estimation of the memory traffic of a step, see bytes_per_step_*
+	double bytes_per_step;
+	std::vector<float> step_ms;
+};
+
+// Memory traffic of a step, counting each array element once per pass that touches it.
+// Caches make the real traffic lower for small systems, so it is an estimation of the
+// bandwidth the solvers need, not of the one they get from DRAM.
+double bytes_per_step_particles(uint32_t num_alive, ParticleLayout layout)
+{
+	// Positions in and out, read and written. AoS carries the lifetime with them.
+	const double position = layout == ParticleLayout::eAoS ? sizeof(particle::Particle) : 3 * sizeof(float);
+	const double lifetime = layout == ParticleLayout::eAoS ? 0.0 : 3 * sizeof(float);
+	// Alive index read in both passes and written once
+	const double alive = 3 * sizeof(uint32_t);
+	return num_alive * (4 * position + lifetime + alive);
+}
+
+double bytes_per_step_springs(uint32_t num_particles, uint32_t num_segments, ParticleLayout layout)
+{
+	const double position = layout == ParticleLayout::eAoS ? sizeof(spring::Particle) : 3 * sizeof(float);
+	// Every segment reads its indices and length and writes its force.
+	// Every particle reads the forces of its segments through the mappings.
+	const double per_segment = sizeof(glm::ivec2) + sizeof(float) + sizeof(glm::vec3)
+		+ 2 * (sizeof(spring::SegmentMapping) + sizeof(glm::vec3));
+	const double per_particle = 4 * position + sizeof(spring::Particle2SegmentsList);
+	return num_particles * per_particle + num_segments * per_segment;
+}
+
+// Height field of 2 * n * n triangles over the floor of the simulation space,
+// bumpy enough to make the particles hit many different triangles
+void build_terrain_mesh(uint32_t n, float size, std::vector<glm::vec3>* vertices_, std::vector<glm::uvec3>* faces_)
+{
+	std::vector<glm::vec3>& vertices = *vertices_;
+	std::vector<glm::uvec3>& faces = *faces_;
+	vertices.resize((size_t)(n + 1) * (n + 1));
+	for (uint32_t j = 0; j <= n; ++j) {
+		for (uint32_t i = 0; i <= n; ++i) {
+			const float x = size * (float)i / (float)n;
+			const float z = size * (float)j / (float)n;
+			const float y = 1.0f + 0.5f * std::sin(1.3f * x) * std::cos(1.7f * z);
+			vertices[j * (n + 1) + i] = glm::vec3(x, y, z);
+		}
+	}
+	faces.clear();
+	faces.reserve(2 * (size_t)n * n);
+	for (uint32_t j = 0; j < n; ++j) {
+		for (uint32_t i = 0; i < n; ++i) {
+			const uint32_t base = j * (n + 1) + i;
+			faces.push_back(glm::uvec3(base, base + n + 1, base + 1));
+			faces.push_back(glm::uvec3(base + 1, base + n + 1, base + n + 2));
+		}
+	}
+}
+
+// Time each step after the warmup
+template<typename StepFunc>
+std::vector<float> time_steps(const BenchOptions& options, const StepFunc& step)
+{
+	for (uint32_t i = 0; i < options.num_warmup; ++i) {
+		step(i);
+	}
+	std::vector<float> step_ms(options.num_steps);
+	for (uint32_t i = 0; i < options.num_steps; ++i) {
+		const Clock::time_point start = Clock::now();
+		step(options.num_warmup + i);
+		step_ms[i] = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+	return step_ms;
+}
+
+// Every particle is spawned before the warmup and lives for the whole run,
+// so the cost per particle does not depend on the emission rate
+BenchResult bench_particles(const BenchOptions& options, ThreadPool* pool,
+	uint32_t max_particles, uint32_t mesh_resolution)
+{
+	BatchConfig config = default_batch_config(BatchConfig::Scene::eParticles);
+	config.particle_config.max_particles = max_particles;
+	config.emitter.mean_lifetime = 1.0e6f;
+	config.emitter.var_lifetime = 0.0f;
+	// Every particle in the first step, with some margin for the rounding of the rate
+	config.emitter.particles_per_second = ((float)max_particles + 0.5f) / config.dt;
+
+	CpuParticleSolver solver;
+	solver.set_thread_pool(pool);
+	uint32_t num_triangles = 0;
+	if (mesh_resolution > 0) {
+		std::vector<glm::vec3> vertices;
+		std::vector<glm::uvec3> faces;
+		build_terrain_mesh(mesh_resolution, config.particle_config.simulation_space_size, &vertices, &faces);
+		num_triangles = (uint32_t)faces.size();
+		solver.set_mesh(vertices, faces);
+		// Spawn just above the terrain, so the particles reach it during the warmup
+		config.emitter.pos.y = 2.0f;
+	}
+	solver.set_intersect_mesh(mesh_resolution > 0);
+	solver.set_emitters({ config.emitter });
+	solver.initialize(config.particle_config, options.layout);
+	solver.set_sphere(config.sphere);
+	solver.set_intersect_sphere(config.intersect_sphere);
+
+	solver.step(config.dt);
+	config.emitter.particles_per_second = 0.0f;
+	solver.set_emitters({ config.emitter });
+
+	BenchResult result;
+	result.step_ms = time_steps(options, [&](uint32_t) {
+		solver.step(config.dt);
+	});
+	result.num_particles = solver.get_num_alive();
+	result.num_segments = 0;
+	result.bytes_per_step = bytes_per_step_particles(result.num_particles, options.layout);
+	std::ostringstream params;
+	params << "\"max_particles\": " << max_particles;
+	if (mesh_resolution > 0) {
+		result.suite = "mesh";
+		params << ", \"num_triangles\": " << num_triangles;
+	}
+	else {
+		result.suite = "particles";
+	}
+	result.params = params.str();
+	return result;
+}
+
+BenchResult bench_springs(const BenchOptions& options, ThreadPool* pool,
+	const std::string& suite, const std::string& params, BatchConfig::Scene scene,
+	const SpringSystemData& data, uint32_t num_particles_per_strand, uint32_t num_fixed_particles,
+	const Sphere& head, bool intersect_head)
+{
+	BatchConfig config = default_batch_config(scene);
+	spring::SpringSystemConfig system_config = config.spring_config;
+	system_config.num_particles = (uint32_t)data.particles.size();
+	system_config.num_segments = (uint32_t)data.segments.size();
+	system_config.num_fixed_particles = num_fixed_particles;
+	system_config.num_particles_per_strand = num_particles_per_strand;
+
+	CpuSpringSolver solver;
+	solver.set_thread_pool(pool);
+	solver.initialize(system_config, data, options.layout);
+	solver.set_sphere(config.sphere);
+	solver.set_intersect_sphere(config.intersect_sphere);
+	solver.set_sphere_head(head);
+	solver.set_intersect_sphere_head(intersect_head);
+
+	const glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	BenchResult result;
+	result.suite = suite;
+	result.params = params;
+	result.step_ms = time_steps(options, [&](uint32_t) {
+		solver.step(config.dt, rotation);
+	});
+	result.num_particles = system_config.num_particles;
+	result.num_segments = system_config.num_segments;
+	result.bytes_per_step = bytes_per_step_springs(result.num_particles, result.num_segments, options.layout);
+	return result;
+}
+
+// Same head and hair length as SpringSystem
+BenchResult bench_hair(const BenchOptions& options, ThreadPool* pool,
+	uint32_t num_hairs, uint32_t particles_per_strand)
+{
+	const Sphere head = { glm::vec3(2.0f, 5.0f, 5.0f), 1.0f };
+	SpringSystemData data;
+	build_hair_data(head, num_hairs, particles_per_strand, 1.0f, &data);
+
+	std::ostringstream params;
+	params << "\"num_hairs\": " << num_hairs << ", \"particles_per_strand\": " << particles_per_strand;
+	return bench_springs(options, pool, "hair", params.str(), BatchConfig::Scene::eRope,
+		data, particles_per_strand, num_hairs, head, false);
+}
+
+// Same size and fixed particles as ClothSystem
+BenchResult bench_cloth(const BenchOptions& options, ThreadPool* pool, uint32_t resolution)
+{
+	const BatchConfig config = default_batch_config(BatchConfig::Scene::eCloth);
+	SpringSystemData data;
+	build_cloth_data(config.origin, glm::uvec2(resolution), config.cloth_size,
+		config.use_provots, config.num_fixed_particles, &data);
+	if (config.reorder_particles) {
+		std::vector<uint32_t> new_index;
+		reorder_spring_data(&data, &new_index);
+	}
+	build_segment_data(&data);
+
+	std::ostringstream params;
+	params << "\"resolution\": [" << resolution << ", " << resolution << "]";
+	return bench_springs(options, pool, "cloth", params.str(), BatchConfig::Scene::eCloth,
+		data, 0, config.num_fixed_particles, { config.origin, 1.0f }, false);
+}
+
+void write_json(std::ostream& out, const BenchOptions& options, uint32_t num_threads,
+	const std::vector<BenchResult>& results)
+{
+	out << "{\n";
+	out << "  \"threads\": " << num_threads << ",\n";
+	out << "  \"layout\": \"" << (options.layout == ParticleLayout::eAoS ? "aos" : "soa") << "\",\n";
+	out << "  \"steps\": " << options.num_steps << ",\n";
+	out << "  \"warmup\": " << options.num_warmup << ",\n";
+	out << "  \"results\": [";
+	for (size_t r = 0; r < results.size(); ++r) {
+		const BenchResult& result = results[r];
+		std::vector<float> sorted = result.step_ms;
+		std::sort(sorted.begin(), sorted.end());
+		const double total_ms = std::accumulate(sorted.begin(), sorted.end(), 0.0);
+		const double mean_ms = total_ms / sorted.size();
+		const double median_ms = sorted[sorted.size() / 2];
+		const double p95_ms = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+
+		// Rates from the median, which is less noisy than the mean
+		const double steps_per_second = 1.0e3 / median_ms;
+		const double ns_per_particle = result.num_particles > 0 ? median_ms * 1.0e6 / result.num_particles : 0.0;
+		const double bandwidth_gb_s = result.bytes_per_step / (median_ms * 1.0e6);
+
+		out << (r == 0 ? "\n" : ",\n");
+		out << "    {\n";
+		out << "      \"suite\": \"" << result.suite << "\",\n";
+		out << "      \"params\": { " << result.params << " },\n";
+		out << "      \"num_particles\": " << result.num_particles << ",\n";
+		out << "      \"num_segments\": " << result.num_segments << ",\n";
+		out << "      \"step_ms\": { \"mean\": " << mean_ms << ", \"median\": " << median_ms
+			<< ", \"min\": " << sorted.front() << ", \"p95\": " << p95_ms << ", \"max\": " << sorted.back() << " },\n";
+		out << "      \"steps_per_second\": " << steps_per_second << ",\n";
+		out << "      \"ns_per_particle\": " << ns_per_particle << ",\n";
+		out << "      \"bytes_per_step\": " << result.bytes_per_step << ",\n";
+		out << "      \"bandwidth_gb_s\": " << bandwidth_gb_s << "\n";
+		out << "    }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+uint32_t parse_u32(const std::string& option, const char* value)
+{
+	try {
+		size_t end;
+		const unsigned long v = std::stoul(value, &end);
+		if (value[end] == '\0') {
+			return (uint32_t)v;
+		}
+	}
+	catch (const std::exception&) {
+	}
+	throw std::runtime_error("Error: Expected a number after " + option);
+}
+
+BenchOptions parse_options(int argc, char** argv)
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--quick") {
+			options.quick = true;
+			continue;
+		}
+		if (i + 1 == argc) {
+			throw std::runtime_error("Error: Unknown option or missing value " + arg);
+		}
+		const char* value = argv[++i];
+		if (arg == "--steps") {
+			options.num_steps = std::max(1u, parse_u32(arg, value));
+		}
+		else if (arg == "--warmup") {
+			options.num_warmup = parse_u32(arg, value);
+		}
+		else if (arg == "--threads") {
+			options.num_threads = parse_u32(arg, value);
+		}
+		else if (arg == "--layout") {
+			if (std::string(value) == "aos") {
+				options.layout = ParticleLayout::eAoS;
+			}
+			else if (std::string(value) == "soa") {
+				options.layout = ParticleLayout::eSoA;
+			}
+			else {
+				throw std::runtime_error(std::string("Error: Unknown layout ") + value);
+			}
+		}
+		else if (arg == "--suites") {
+			options.particles = options.hair = options.cloth = options.mesh = false;
+			std::istringstream list(value);
+			std::string suite;
+			while (std::getline(list, suite, ',')) {
+				if (suite == "particles") {
+					options.particles = true;
+				}
+				else if (suite == "hair") {
+					options.hair = true;
+				}
+				else if (suite == "cloth") {
+					options.cloth = true;
+				}
+				else if (suite == "mesh") {
+					options.mesh = true;
+				}
+				else {
+					throw std::runtime_error("Error: Unknown suite " + suite);
+				}
+			}
+		}
+		else if (arg == "--out") {
+			options.out_path = value;
+		}
+		else {
+			throw std::runtime_error("Error: Unknown option " + arg);
+		}
+	}
+	return options;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	try {
+		options = parse_options(argc, argv);
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		fprintf(stderr, "usage: %s [--suites particles,hair,cloth,mesh] [--steps n] [--warmup n] "
+			"[--threads n] [--layout aos|soa] [--quick] [--out file]\n", argv[0]);
+		return 1;
+	}
+
+	// Sizes of each sweep. Quick runs only take the first ones.
+	const size_t quick_size = 2;
+	const auto sweep = [&](std::vector<uint32_t> sizes) {
+		if (options.quick && sizes.size() > quick_size) {
+			sizes.resize(quick_size);
+		}
+		return sizes;
+	};
+	const std::vector<uint32_t> particle_counts = sweep({ 1000, 10000, 100000, 1000000 });
+	// num_hairs, particles_per_strand
+	std::vector<glm::uvec2> strand_counts = { { 100, 10 }, { 1000, 10 }, { 1000, 50 }, { 10000, 10 }, { 10000, 50 } };
+	if (options.quick) {
+		strand_counts.resize(quick_size);
+	}
+	const std::vector<uint32_t> cloth_resolutions = sweep({ 10, 32, 64, 128, 256 });
+	// Terrains of 2 * n * n triangles, against a fixed number of particles
+	const std::vector<uint32_t> mesh_resolutions = sweep({ 8, 32, 128, 256 });
+	const uint32_t mesh_particles = 10000;
+
+	ThreadPool pool(options.num_threads);
+	std::vector<BenchResult> results;
+	const auto report = [&](BenchResult result) {
+		std::vector<float> sorted = result.step_ms;
+		std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+		fprintf(stderr, "%-10s %-50s %10.4f ms/step\n", result.suite.c_str(), result.params.c_str(),
+			sorted[sorted.size() / 2]);
+		results.push_back(std::move(result));
+	};
+
+	try {
+		if (options.particles) {
+			for (uint32_t count : particle_counts) {
+				report(bench_particles(options, &pool, count, 0));
+			}
+		}
+		if (options.hair) {
+			for (const glm::uvec2& strands : strand_counts) {
+				report(bench_hair(options, &pool, strands.x, strands.y));
+			}
+		}
+		if (options.cloth) {
+			for (uint32_t resolution : cloth_resolutions) {
+				report(bench_cloth(options, &pool, resolution));
+			}
+		}
+		if (options.mesh) {
+			for (uint32_t resolution : mesh_resolutions) {
+				report(bench_particles(options, &pool, mesh_particles, resolution));
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	if (options.out_path.empty()) {
+		write_json(std::cout, options, pool.get_num_threads(), results);
+	}
+	else {
+		std::ofstream file(options.out_path);
+		write_json(file, options, pool.get_num_threads(), results);
+		if (!file) {
+			fprintf(stderr, "Error: Can't write %s\n", options.out_path.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
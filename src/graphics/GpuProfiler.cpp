@@ -0,0 +1,284 @@
+#include "GpuProfiler.hpp"
+
+#include <glad/glad.h>
+#include <imgui.h>
+#include <algorithm>
+#include <fstream>
+#include "utils/Tracer.hpp"
+
+GpuProfiler::Scope::Scope(GpuProfiler* profiler, Pass pass) : m_profiler(profiler)
+{
+	if (m_profiler != nullptr) {
+		m_profiler->begin_pass(pass);
+	}
+}
+
+GpuProfiler::Scope::~Scope()
+{
+	if (m_profiler != nullptr) {
+		m_profiler->end_pass();
+	}
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	if (m_supported) {
+		for (FrameQueries& frame : m_frames) {
+			glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+		}
+	}
+}
+
+void GpuProfiler::initialize()
+{
+	m_initialized = true;
+
+	GLint counter_bits = 0;
+	glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &counter_bits);
+	m_supported = counter_bits != 0;
+	if (!m_supported) {
+		return;
+	}
+
+	for (FrameQueries& frame : m_frames) {
+		glCreateQueries(GL_TIMESTAMP, (GLsizei)frame.queries.size(), frame.queries.data());
+	}
+}
+
+void GpuProfiler::begin_frame()
+{
+	if (!m_initialized) {
+		initialize();
+	}
+	m_frame_idx += 1;
+	if (!m_supported || !m_enabled) {
+		return;
+	}
+
+	// The clocks do not drift enough to matter during a trace, so one sample is enough.
+	// The GL timestamp is taken when the command reaches the GPU, without waiting for it.
+	if (Tracer::global().is_enabled()) {
+		if (!m_trace_calibrated) {
+			GLint64 gpu_ns;
+			glGetInteger64v(GL_TIMESTAMP, &gpu_ns);
+			m_gpu_to_trace_ns = Tracer::now_ns() - gpu_ns;
+			m_trace_calibrated = true;
+		}
+	}
+	else {
+		m_trace_calibrated = false;
+	}
+
+	// Collect in submission order, stopping at the first one not finished.
+	// The oldest set is the next one in the ring.
+	for (uint32_t i = 1; i <= NUM_FRAMES_IN_FLIGHT; ++i) {
+		FrameQueries& frame = m_frames[(m_current + i) % NUM_FRAMES_IN_FLIGHT];
+		if (frame.pending && !collect(&frame)) {
+			break;
+		}
+	}
+
+	m_current = (m_current + 1) % NUM_FRAMES_IN_FLIGHT;
+	FrameQueries& frame = m_frames[m_current];
+	if (frame.pending) {
+		// Still running after NUM_FRAMES_IN_FLIGHT frames, waiting for it would stall
+		frame.pending = false;
+		m_num_dropped_frames += 1;
+	}
+	frame.num_scopes = 0;
+	frame.frame_idx = m_frame_idx;
+	m_recording_frame = true;
+}
+
+void GpuProfiler::end_frame()
+{
+	if (!m_recording_frame) {
+		return;
+	}
+	if (m_pass_open) {
+		end_pass();
+	}
+	FrameQueries& frame = m_frames[m_current];
+	frame.pending = frame.num_scopes != 0;
+	m_recording_frame = false;
+}
+
+void GpuProfiler::begin_pass(Pass pass)
+{
+	if (!m_recording_frame || m_pass_open) {
+		return;
+	}
+	FrameQueries& frame = m_frames[m_current];
+	if (frame.num_scopes == MAX_SCOPES_PER_FRAME) {
+		m_num_overflowed_scopes += 1;
+		return;
+	}
+	frame.passes[frame.num_scopes] = pass;
+	glQueryCounter(frame.queries[2 * frame.num_scopes], GL_TIMESTAMP);
+	m_pass_open = true;
+}
+
+void GpuProfiler::end_pass()
+{
+	if (!m_pass_open) {
+		return;
+	}
+	FrameQueries& frame = m_frames[m_current];
+	glQueryCounter(frame.queries[2 * frame.num_scopes + 1], GL_TIMESTAMP);
+	frame.num_scopes += 1;
+	m_pass_open = false;
+}
+
+bool GpuProfiler::collect(FrameQueries* frame_)
+{
+	FrameQueries& frame = *frame_;
+
+	// Timestamps are written in order, so the last one being available means all are
+	GLint available = 0;
+	glGetQueryObjectiv(frame.queries[2 * frame.num_scopes - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available == 0) {
+		return false;
+	}
+
+	FrameTimes& times = m_history[m_history_idx];
+	times.frame_idx = frame.frame_idx;
+	times.ms.fill(0.0f);
+	for (uint32_t i = 0; i < frame.num_scopes; ++i) {
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(frame.queries[2 * i], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+		times.ms[(uint32_t)frame.passes[i]] += (float)((double)(end - begin) * 1.0e-6);
+		if (m_trace_calibrated) {
+			Tracer::global().record_gpu(get_pass_name(frame.passes[i]),
+				(int64_t)begin + m_gpu_to_trace_ns, (int64_t)end + m_gpu_to_trace_ns);
+		}
+	}
+	m_history_idx = (m_history_idx + 1) % NUM_HISTORY;
+	m_num_history = std::min(m_num_history + 1, NUM_HISTORY);
+
+	frame.pending = false;
+	return true;
+}
+
+const GpuProfiler::FrameTimes& GpuProfiler::get_history(uint32_t age) const
+{
+	return m_history[(m_history_idx + NUM_HISTORY - 1 - age) % NUM_HISTORY];
+}
+
+float GpuProfiler::get_average_ms(Pass pass) const
+{
+	const uint32_t num = std::min(m_num_history, NUM_AVERAGE);
+	if (num == 0) {
+		return 0.0f;
+	}
+	double sum = 0.0;
+	for (uint32_t i = 0; i < num; ++i) {
+		sum += get_history(i).ms[(uint32_t)pass];
+	}
+	return (float)(sum / num);
+}
+
+bool GpuProfiler::write_csv(const std::filesystem::path& path) const
+{
+	std::ofstream file(path);
+	if (!file) {
+		return false;
+	}
+	file << "frame";
+	for (uint32_t p = 0; p < NUM_PASSES; ++p) {
+		file << "," << get_pass_name((Pass)p) << "_ms";
+	}
+	file << ",total_ms\n";
+	for (uint32_t age = m_num_history; age-- > 0;) {
+		const FrameTimes& times = get_history(age);
+		file << times.frame_idx;
+		float total = 0.0f;
+		for (float ms : times.ms) {
+			file << "," << ms;
+			total += ms;
+		}
+		file << "," << total << "\n";
+	}
+	return (bool)file;
+}
+
+void GpuProfiler::imgui_draw()
+{
+	if (!m_supported) {
+		ImGui::Text("Timer queries are not supported by this context");
+		return;
+	}
+	if (ImGui::Checkbox("Enabled", &m_enabled) && !m_enabled) {
+		m_recording_frame = false;
+		for (FrameQueries& frame : m_frames) {
+			frame.pending = false;
+		}
+		m_num_history = 0;
+		m_history_idx = 0;
+	}
+
+	ImGui::Text("Mean of the last %u frames", std::min(m_num_history, NUM_AVERAGE));
+	if (ImGui::BeginTable("gpu_passes", 3)) {
+		ImGui::TableSetupColumn("Pass");
+		ImGui::TableSetupColumn("Mean ms");
+		ImGui::TableSetupColumn("Max ms");
+		ImGui::TableHeadersRow();
+
+		float total = 0.0f;
+		const uint32_t num = std::min(m_num_history, NUM_AVERAGE);
+		for (uint32_t p = 0; p < NUM_PASSES; ++p) {
+			const float mean = get_average_ms((Pass)p);
+			float max = 0.0f;
+			for (uint32_t i = 0; i < num; ++i) {
+				max = std::max(max, get_history(i).ms[p]);
+			}
+			total += mean;
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn(); ImGui::Text("%s", get_pass_name((Pass)p));
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", mean);
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", max);
+		}
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn(); ImGui::Text("total");
+		ImGui::TableNextColumn(); ImGui::Text("%.3f", total);
+		ImGui::EndTable();
+	}
+
+	ImGui::Text("Dropped frames: %llu", (unsigned long long)m_num_dropped_frames);
+	if (m_num_overflowed_scopes != 0) {
+		ImGui::Text("Passes over the limit of a frame: %llu", (unsigned long long)m_num_overflowed_scopes);
+	}
+
+	ImGui::Separator();
+	ImGui::InputText("CSV file", m_csv_path, sizeof(m_csv_path));
+	if (ImGui::Button("Dump CSV")) {
+		m_csv_error = !write_csv(m_csv_path);
+	}
+	if (m_csv_error) {
+		ImGui::SameLine();
+		ImGui::Text("Can't write the file");
+	}
+}
+
+const char* GpuProfiler::get_pass_name(Pass pass)
+{
+	switch (pass)
+	{
+	case Pass::eSpawn:
+		return "spawn";
+	case Pass::eAdvect:
+		return "advect";
+	case Pass::eSpringForce:
+		return "spring_force";
+	case Pass::eRender:
+		return "render";
+	case Pass::eUI:
+		return "ui";
+	case Pass::eSort:
+		return "sort";
+	case Pass::eCollide:
+		return "collide";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <filesystem>
+
+// GPU time of the passes of each frame, measured with GL_TIMESTAMP queries.
+// The queries of a frame are read some frames later, from a ring of
+// NUM_FRAMES_IN_FLIGHT query sets, so reading them never waits for the GPU.
+// Frames whose results are still not ready when their set is reused are dropped.
+// Contexts without timer queries (0 bits in the counter) leave the profiler unsupported.
+// While Tracer is enabled, the collected passes are also added to its GPU track.
+class GpuProfiler {
+public:
+	enum class Pass {
+		eSpawn = 0,
+		eAdvect = 1,
+		eSpringForce = 2,
+		eRender = 3,
+		eUI = 4,
+		eSort = 5,
+		eCollide = 6,
+		eCount = 7,
+	};
+
+	// Times the commands issued during its lifetime. Does nothing with a null profiler.
+	class Scope {
+	public:
+		Scope(GpuProfiler* profiler, Pass pass);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		GpuProfiler* m_profiler;
+	};
+
+	GpuProfiler() = default;
+	~GpuProfiler();
+
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	// Collect the finished frames and start recording a new one.
+	// The queries are created in the first call, which needs the OpenGL context.
+	void begin_frame();
+	void end_frame();
+
+	// Passes do not nest. A pass can be timed several times in a frame, and the times add up.
+	void begin_pass(Pass pass);
+	void end_pass();
+
+	void set_enabled(bool enabled) { m_enabled = enabled; }
+	bool is_enabled() const { return m_enabled; }
+	bool is_supported() const { return m_supported; }
+
+	// Mean of the last NUM_AVERAGE collected frames, in ms
+	float get_average_ms(Pass pass) const;
+
+	// Times of the collected frames in the history, one row per frame
+	bool write_csv(const std::filesystem::path& path) const;
+
+	void imgui_draw();
+
+	static const char* get_pass_name(Pass pass);
+
+private:
+	static constexpr uint32_t NUM_PASSES = (uint32_t)Pass::eCount;
+	static constexpr uint32_t NUM_FRAMES_IN_FLIGHT = 4;
+	// Enough for two passes of the maximum number of substeps, plus render and UI
+	static constexpr uint32_t MAX_SCOPES_PER_FRAME = 512;
+	static constexpr uint32_t NUM_HISTORY = 1024;
+	static constexpr uint32_t NUM_AVERAGE = 64;
+
+	struct FrameQueries {
+		// Begin and end timestamps of each scope
+		std::array<uint32_t, 2 * MAX_SCOPES_PER_FRAME> queries;
+		std::array<Pass, MAX_SCOPES_PER_FRAME> passes;
+		uint32_t num_scopes = 0;
+		uint64_t frame_idx = 0;
+		bool pending = false;
+	};
+
+	struct FrameTimes {
+		uint64_t frame_idx;
+		std::array<float, NUM_PASSES> ms;
+	};
+
+	bool m_enabled = true;
+	bool m_initialized = false;
+	bool m_supported = false;
+	bool m_recording_frame = false;
+	bool m_pass_open = false;
+
+	std::array<FrameQueries, NUM_FRAMES_IN_FLIGHT> m_frames;
+	uint32_t m_current = 0;
+	uint64_t m_frame_idx = 0;
+
+	std::array<FrameTimes, NUM_HISTORY> m_history;
+	uint32_t m_num_history = 0;
+	uint32_t m_history_idx = 0;
+
+	// Offset from the GPU timestamps to the time base of Tracer, while tracing
+	int64_t m_gpu_to_trace_ns = 0;
+	bool m_trace_calibrated = false;
+
+	uint64_t m_num_dropped_frames = 0;
+	uint64_t m_num_overflowed_scopes = 0;
+
+	char m_csv_path[256] = "gpu_profile.csv";
+	bool m_csv_error = false;
+
+	void initialize();
+	// Returns false if the results of the frame are not available yet
+	bool collect(FrameQueries* frame);
+	const FrameTimes& get_history(uint32_t age) const;
+};
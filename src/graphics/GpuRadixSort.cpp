@@ -0,0 +1,115 @@
+#include "GpuRadixSort.hpp"
+
+#include <glad/glad.h>
+#include <utility>
+#include "PassGraph.hpp"
+#include "radix_sort.in"
+
+static_assert(RADIX_SORT_NUM_PASSES * RADIX_SORT_BITS_PER_PASS == 32, "The passes must cover the whole key");
+static_assert(RADIX_SORT_NUM_PASSES % 2 == 0, "The result must end in the buffers of the caller");
+
+GpuRadixSort::~GpuRadixSort()
+{
+	if (m_args != 0) {
+		const uint32_t buffers[] = { m_keys_tmp, m_values_tmp, m_histogram, m_args };
+		glDeleteBuffers(4, buffers);
+	}
+}
+
+void GpuRadixSort::initialize()
+{
+	const std::filesystem::path shad_dir = std::filesystem::path(PROJECT_DIR) / "resources/shaders";
+	m_prepare_program = ShaderProgram(&Shader(shad_dir / "radix_sort_prepare.comp", Shader::Type::Compute), 1);
+	m_count_program = ShaderProgram(&Shader(shad_dir / "radix_sort_count.comp", Shader::Type::Compute), 1);
+	m_scan_program = ShaderProgram(&Shader(shad_dir / "radix_sort_scan.comp", Shader::Type::Compute), 1);
+	m_scatter_program = ShaderProgram(&Shader(shad_dir / "radix_sort_scatter.comp", Shader::Type::Compute), 1);
+
+	glCreateBuffers(1, &m_keys_tmp);
+	glCreateBuffers(1, &m_values_tmp);
+	glCreateBuffers(1, &m_histogram);
+	glCreateBuffers(1, &m_args);
+	glNamedBufferStorage(m_args, 4 * sizeof(uint32_t), nullptr, 0);
+}
+
+void GpuRadixSort::reserve(uint32_t max_elements)
+{
+	if (m_max_elements >= max_elements) {
+		return;
+	}
+	m_max_elements = max_elements;
+	const uint32_t max_blocks = (max_elements + RADIX_SORT_BLOCK_SIZE - 1) / RADIX_SORT_BLOCK_SIZE;
+	glNamedBufferData(m_keys_tmp, sizeof(uint32_t) * max_elements, nullptr, GL_DYNAMIC_DRAW);
+	glNamedBufferData(m_values_tmp, sizeof(uint32_t) * max_elements, nullptr, GL_DYNAMIC_DRAW);
+	glNamedBufferData(m_histogram, sizeof(uint32_t) * RADIX_SORT_NUM_DIGITS * max_blocks, nullptr, GL_DYNAMIC_DRAW);
+}
+
+void GpuRadixSort::sort(PassGraph* pass_graph, uint32_t keys, uint32_t values,
+	uint32_t count_buffer, uint32_t count_index, uint32_t max_elements)
+{
+	if (m_args == 0) {
+		initialize();
+	}
+	reserve(max_elements);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_COUNT, count_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_ARGS, m_args);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_HISTOGRAM, m_histogram);
+
+	pass_graph->pass({
+		PassGraph::read(count_buffer),
+		PassGraph::write(m_args),
+		});
+	m_prepare_program.use_program();
+	glUniform1ui(0, count_index);
+	glUniform1ui(1, max_elements);
+	glDispatchCompute(1, 1, 1);
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_args);
+	uint32_t keys_in = keys, values_in = values;
+	uint32_t keys_out = m_keys_tmp, values_out = m_values_tmp;
+	for (uint32_t p = 0; p < RADIX_SORT_NUM_PASSES; ++p) {
+		const uint32_t shift = p * RADIX_SORT_BITS_PER_PASS;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_KEYS_IN, keys_in);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_VALUES_IN, values_in);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_KEYS_OUT, keys_out);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_VALUES_OUT, values_out);
+
+		pass_graph->pass({
+			PassGraph::read(m_args, PassGraph::Access::eCommand),
+			PassGraph::read(m_args),
+			PassGraph::read(keys_in),
+			PassGraph::write(m_histogram),
+			});
+		m_count_program.use_program();
+		glUniform1ui(0, shift);
+		glDispatchComputeIndirect(0);
+
+		pass_graph->pass({
+			PassGraph::read(m_args),
+			PassGraph::write(m_histogram),
+			});
+		m_scan_program.use_program();
+		glDispatchCompute(1, 1, 1);
+
+		pass_graph->pass({
+			PassGraph::read(m_args, PassGraph::Access::eCommand),
+			PassGraph::read(m_args),
+			PassGraph::read(m_histogram),
+			PassGraph::read(keys_in),
+			PassGraph::read(values_in),
+			PassGraph::write(keys_out),
+			PassGraph::write(values_out),
+			});
+		m_scatter_program.use_program();
+		glUniform1ui(0, shift);
+		glDispatchComputeIndirect(0);
+
+		std::swap(keys_in, keys_out);
+		std::swap(values_in, values_out);
+	}
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+	// The pass that reads the result finds it in the input bindings
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_KEYS_IN, keys);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_VALUES_IN, values);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include "ShaderProgram.hpp"
+
+class PassGraph;
+
+// Stable radix sort of 32 bit keys with 32 bit values, in storage buffers.
+// RADIX_SORT_NUM_PASSES passes of 4 bits, each one a histogram per block of keys,
+// a scan of the histograms and a scatter that ranks each block in shared memory.
+// The number of elements is read on the GPU, and the passes are sized from it with
+// indirect dispatches. The shaders use the bindings of radix_sort.in.
+class GpuRadixSort {
+public:
+	GpuRadixSort() = default;
+	~GpuRadixSort();
+
+	GpuRadixSort(const GpuRadixSort&) = delete;
+	GpuRadixSort& operator=(const GpuRadixSort&) = delete;
+
+	// Sort the first elements of the keys and values buffers, as many as the uint at
+	// count_index of count_buffer, up to max_elements. The result ends in the same buffers.
+	// The programs and the scratch buffers are created in the first call, which needs the OpenGL context.
+	void sort(PassGraph* pass_graph, uint32_t keys, uint32_t values,
+		uint32_t count_buffer, uint32_t count_index, uint32_t max_elements);
+
+private:
+	ShaderProgram m_prepare_program;
+	ShaderProgram m_count_program;
+	ShaderProgram m_scan_program;
+	ShaderProgram m_scatter_program;
+
+	uint32_t m_keys_tmp = 0;
+	uint32_t m_values_tmp = 0;
+	uint32_t m_histogram = 0;
+	uint32_t m_args = 0;
+	uint32_t m_max_elements = 0;
+
+	void initialize();
+	void reserve(uint32_t max_elements);
+};
@@ -0,0 +1,103 @@
+#include "PassGraph.hpp"
+
+#include <glad/glad.h>
+
+namespace {
+uint32_t barrier_bit(PassGraph::Access access)
+{
+	switch (access)
+	{
+	case PassGraph::Access::eStorage:
+		return GL_SHADER_STORAGE_BARRIER_BIT;
+	case PassGraph::Access::eAtomicCounter:
+		return GL_ATOMIC_COUNTER_BARRIER_BIT;
+	case PassGraph::Access::eCommand:
+		return GL_COMMAND_BARRIER_BIT;
+	case PassGraph::Access::eVertexAttrib:
+		return GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT;
+	case PassGraph::Access::eElementArray:
+		return GL_ELEMENT_ARRAY_BARRIER_BIT;
+	case PassGraph::Access::eBufferUpdate:
+		return GL_BUFFER_UPDATE_BARRIER_BIT;
+	default:
+		return GL_ALL_BARRIER_BITS;
+	}
+}
+
+// Every way a shader write can be consumed
+constexpr uint32_t ALL_BUFFER_BITS = GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT
+	| GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT
+	| GL_BUFFER_UPDATE_BARRIER_BIT;
+} // namespace
+
+void PassGraph::pass(std::initializer_list<Use> uses)
+{
+	m_num_passes += 1;
+
+	uint32_t bits = 0;
+	for (const Use& use : uses) {
+		const BufferState& state = get_state(use.buffer);
+		bits |= state.pending_bits & barrier_bit(use.access);
+		// Any barrier orders the earlier reads before the writes
+		if (use.shader_write && state.pending_reads) {
+			bits |= barrier_bit(use.access);
+		}
+	}
+	issue(bits);
+
+	for (const Use& use : uses) {
+		BufferState& state = get_state(use.buffer);
+		if (use.shader_write) {
+			state.pending_bits = ALL_BUFFER_BITS;
+		}
+		if (use.access != Access::eBufferUpdate) {
+			state.pending_reads = true;
+		}
+	}
+}
+
+PassGraph::BufferState& PassGraph::get_state(uint32_t buffer)
+{
+	for (BufferState& state : m_buffers) {
+		if (state.buffer == buffer) {
+			return state;
+		}
+	}
+	m_buffers.push_back({ buffer, 0, false });
+	return m_buffers.back();
+}
+
+void PassGraph::flush()
+{
+	uint32_t bits = 0;
+	for (const BufferState& state : m_buffers) {
+		bits |= state.pending_bits;
+		if (state.pending_reads) {
+			bits |= GL_SHADER_STORAGE_BARRIER_BIT;
+		}
+	}
+	issue(bits);
+}
+
+void PassGraph::issue(uint32_t bits)
+{
+	if (bits == 0) {
+		return;
+	}
+	glMemoryBarrier(bits);
+	m_num_barriers += 1;
+
+	// Barriers are not per buffer, the bits are done for all of them
+	for (BufferState& state : m_buffers) {
+		state.pending_bits &= ~bits;
+		state.pending_reads = false;
+	}
+}
+
+void PassGraph::get_stats(uint32_t* num_barriers_, uint32_t* num_passes_)
+{
+	*num_barriers_ = m_num_barriers;
+	*num_passes_ = m_num_passes;
+	m_num_barriers = 0;
+	m_num_passes = 0;
+}
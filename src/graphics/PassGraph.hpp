@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+// Memory barriers between the passes of a system that share buffers.
+// Passes are declared in submission order, right before their commands, with the
+// buffers they access and how. A pass only waits for the earlier shader writes that
+// it reads or overwrites, with the barrier bits of the kind of access it does,
+// and for the earlier reads of the buffers that its shaders write.
+// Passes with no pending dependencies do not issue any barrier, and can overlap.
+//
+// Only shader writes (storage blocks, atomic counters) need barriers. Buffers that
+// shaders never write, like the configs or the collision meshes, need not be declared.
+class PassGraph {
+public:
+	enum class Access {
+		// Storage blocks, from any stage
+		eStorage = 0,
+		eAtomicCounter = 1,
+		// Arguments of indirect draws and dispatches
+		eCommand = 2,
+		eVertexAttrib = 3,
+		eElementArray = 4,
+		// glBufferSubData, glClearBufferSubData and the like
+		eBufferUpdate = 5,
+	};
+
+	struct Use {
+		uint32_t buffer;
+		Access access;
+		bool shader_write;
+	};
+
+	static Use read(uint32_t buffer, Access access = Access::eStorage) { return { buffer, access, false }; }
+	// Written by the shaders, and maybe read
+	static Use write(uint32_t buffer, Access access = Access::eStorage) { return { buffer, access, true }; }
+	static Use update(uint32_t buffer) { return { buffer, Access::eBufferUpdate, false }; }
+
+	// Issue the barrier the pass needs before its commands, and record its writes
+	void pass(std::initializer_list<Use> uses);
+
+	// Wait for every pending write, before code that does not declare its accesses
+	void flush();
+
+	// Barriers issued and passes declared since the last call
+	void get_stats(uint32_t* num_barriers_, uint32_t* num_passes_);
+
+private:
+	struct BufferState {
+		uint32_t buffer;
+		// Barrier bits that the accesses to the buffer still need
+		uint32_t pending_bits;
+		// Read by a pass after the last barrier, so shader writes must wait
+		bool pending_reads;
+	};
+
+	// A handful of buffers per system, a linear search is enough
+	std::vector<BufferState> m_buffers;
+	uint32_t m_num_barriers = 0;
+	uint32_t m_num_passes = 0;
+
+	BufferState& get_state(uint32_t buffer);
+	void issue(uint32_t bits);
+};
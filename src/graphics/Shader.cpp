@@ -41,7 +41,7 @@ void fill_stream(const std::filesystem::path& path, std::stringstream& stream) {
 	}
 }
 
-Shader::Shader(const std::filesystem::path& path, Type type)
+Shader::Shader(const std::filesystem::path& path, Type type, const std::vector<std::string>& defines)
 	: m_type(type)
 {
 	
@@ -49,7 +49,18 @@ Shader::Shader(const std::filesystem::path& path, Type type)
 
 	fill_stream(path, stream);
 	
-	const std::string code = stream.str();
+	std::string code = stream.str();
+
+	if (!defines.empty()) {
+		std::string defines_code;
+		for (const std::string& d : defines) {
+			defines_code += "#define " + d + "\n";
+		}
+		// The #version directive must stay first
+		size_t pos = code.find("#version");
+		pos = pos == std::string::npos ? 0 : code.find('\n', pos) + 1;
+		code.insert(pos, defines_code);
+	}
 
 
 	// compilation
@@ -3,6 +3,7 @@
 #include <string>
 #include <glm/glm.hpp>
 #include <filesystem>
+#include <vector>
 
 
 class Shader
@@ -17,7 +18,8 @@ public:
 	};
 
 	Shader() = default;
-	Shader(const std::filesystem::path& path, Type type);
+	// Each define is added as "#define <define>" right after the #version line
+	Shader(const std::filesystem::path& path, Type type, const std::vector<std::string>& defines = {});
 
 	Shader(const Shader&) = delete;
 	Shader& operator=(const Shader&) = delete;
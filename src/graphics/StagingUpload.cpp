@@ -0,0 +1,71 @@
+#include "StagingUpload.hpp"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "utils/ThreadPool.hpp"
+#include "utils/Tracer.hpp"
+
+namespace {
+// Each copy starts aligned, for the fast paths of memcpy
+constexpr size_t ENTRY_ALIGNMENT = 64;
+// Bytes that each task of the pool copies
+constexpr size_t BLOCK_SIZE = 1 << 20;
+} // namespace
+
+void StagingUpload::add(uint32_t buffer, const void* data, size_t size, uint32_t usage)
+{
+	Entry entry = { buffer, data, size, usage, 0 };
+	if (data != nullptr && size != 0) {
+		entry.offset = m_staging_size;
+		m_staging_size += (size + ENTRY_ALIGNMENT - 1) / ENTRY_ALIGNMENT * ENTRY_ALIGNMENT;
+	}
+	m_entries.push_back(entry);
+}
+
+void StagingUpload::flush(ThreadPool& pool)
+{
+	Tracer::Scope trace("StagingUpload::flush");
+
+	uint32_t staging = 0;
+	if (m_staging_size != 0) {
+		glCreateBuffers(1, &staging);
+		glNamedBufferStorage(staging, m_staging_size, nullptr, GL_MAP_WRITE_BIT);
+		uint8_t* mapped = (uint8_t*)glMapNamedBufferRange(staging, 0, m_staging_size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped == nullptr) {
+			glDeleteBuffers(1, &staging);
+			m_entries.clear();
+			m_staging_size = 0;
+			throw std::runtime_error("Could not map the staging buffer");
+		}
+
+		for (const Entry& entry : m_entries) {
+			if (entry.data == nullptr || entry.size == 0) {
+				continue;
+			}
+			const uint32_t num_blocks = (uint32_t)((entry.size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+			pool.parallel_for(num_blocks, [&](uint32_t begin, uint32_t end, uint32_t) {
+				const size_t first = (size_t)begin * BLOCK_SIZE;
+				const size_t last = std::min((size_t)end * BLOCK_SIZE, entry.size);
+				std::memcpy(mapped + entry.offset + first, (const uint8_t*)entry.data + first, last - first);
+			});
+		}
+		glUnmapNamedBuffer(staging);
+	}
+
+	for (const Entry& entry : m_entries) {
+		glNamedBufferData(entry.buffer, entry.size, nullptr, entry.usage);
+		if (entry.data != nullptr && entry.size != 0) {
+			glCopyNamedBufferSubData(staging, entry.buffer, entry.offset, 0, entry.size);
+		}
+	}
+
+	// Deleted once the copies are done
+	if (staging != 0) {
+		glDeleteBuffers(1, &staging);
+	}
+	m_entries.clear();
+	m_staging_size = 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Initial contents of a set of buffers, written to a single staging buffer and copied
+// to the buffers on the GPU, instead of one glBufferData per buffer. The driver copies
+// the data of glBufferData on the calling thread, one buffer after the other, while the
+// staging buffer is filled by all the threads of the pool at once.
+//
+// Used when a system is reset, where a big cloth or hair system uploads hundreds of MBs.
+class StagingUpload {
+public:
+	// Reallocate buffer with size bytes and usage, and copy data in the next flush().
+	// data must stay valid until then. With no data the contents are left undefined.
+	void add(uint32_t buffer, const void* data, size_t size, uint32_t usage);
+
+	// Write every buffer added since the last call
+	void flush(ThreadPool& pool);
+
+private:
+	struct Entry {
+		uint32_t buffer;
+		const void* data;
+		size_t size;
+		uint32_t usage;
+		// In the staging buffer
+		size_t offset;
+	};
+
+	std::vector<Entry> m_entries;
+	size_t m_staging_size = 0;
+};
@@ -1,5 +1,7 @@
 #include "TriangleMesh.hpp"
 #include <fstream>
+#include <cstring>
+#include <cassert>
 #include <iostream>
 #include <tinyply.h>
 #include <glad/glad.h>
@@ -11,19 +13,19 @@ TriangleMesh::TriangleMesh()
 
 TriangleMesh::TriangleMesh(const std::filesystem::path& path)
 {
+	std::memset(m_vbos, 0, sizeof(m_vbos));
 	parse_ply(path.string().c_str());
-
-	glGenBuffers(sizeof(m_vbos) / sizeof(*m_vbos), m_vbos);
 }
 
 TriangleMesh::TriangleMesh(
 	const std::vector<glm::uvec3>& indices,
 	const std::vector<glm::vec3>& vertices)
 {
-	glGenBuffers(sizeof(m_vbos) / sizeof(*m_vbos), m_vbos);
+	std::memset(m_vbos, 0, sizeof(m_vbos));
 	m_faces = indices;
 	m_vertices = vertices;
 	
+	generate_face_normals();
 	generate_normals();
 }
 
@@ -36,10 +38,11 @@ TriangleMesh::~TriangleMesh()
 
 TriangleMesh::TriangleMesh(const TriangleMesh& o)
 {
-	glGenBuffers(sizeof(m_vbos) / sizeof(*m_vbos), m_vbos);
+	std::memset(m_vbos, 0, sizeof(m_vbos));
 	m_vertices = o.m_vertices;
 	m_faces = o.m_faces;
 	m_normals = o.m_normals;
+	m_face_normals = o.m_face_normals;
 }
 
 TriangleMesh& TriangleMesh::operator=(TriangleMesh&& o)
@@ -54,6 +57,7 @@ TriangleMesh& TriangleMesh::operator=(TriangleMesh&& o)
 	m_vertices = std::move(o.m_vertices);
 	m_faces = std::move(o.m_faces);
 	m_normals = std::move(o.m_normals);
+	m_face_normals = std::move(o.m_face_normals);
 
 	return *this;
 }
@@ -89,10 +93,16 @@ void TriangleMesh::apply_transform(const glm::mat4& t)
 	for (glm::vec3& v : m_vertices) {
 		v = glm::vec3(t * glm::vec4(v, 1.0));
 	}
+	generate_face_normals();
 }
 
 void TriangleMesh::upload_to_gpu(bool dynamic_verts, bool dynamic_indices)
 {
+	// Buffers are created on the first upload, so meshes can be loaded without a context
+	if (m_vbo_vertices == 0) {
+		glGenBuffers(sizeof(m_vbos) / sizeof(*m_vbos), m_vbos);
+	}
+
 	glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vertices);
 	glBufferData(GL_ARRAY_BUFFER,
 		m_vertices.size() * sizeof(glm::vec3),
@@ -206,26 +216,32 @@ void TriangleMesh::parse_ply(const char* fileName)
 		throw std::runtime_error("Error: Cant read face format");
 	}
 
+	generate_face_normals();
 	if (!normals) {
 		generate_normals();
 	}
 }
 
-void TriangleMesh::generate_normals()
+void TriangleMesh::generate_face_normals()
 {
-	m_normals.clear();
-	m_normals.resize(m_vertices.size());
-
 	// Compute the planes of all triangles
-	std::vector<glm::vec3> triangleNormals(m_faces.size());
+	m_face_normals.resize(m_faces.size());
 	for (uint32_t t = 0; t < (uint32_t)m_faces.size(); ++t) {
 		const glm::vec3& v0 = m_vertices[m_faces[t][0]];
 		const glm::vec3& v1 = m_vertices[m_faces[t][1]];
 		const glm::vec3& v2 = m_vertices[m_faces[t][2]];
 
 		glm::vec3 n = glm::cross(v1 - v0, v2 - v0);
-		triangleNormals[t] = glm::normalize(n);
+		m_face_normals[t] = glm::normalize(n);
 	}
+}
+
+void TriangleMesh::generate_normals()
+{
+	m_normals.clear();
+	m_normals.resize(m_vertices.size());
+
+	const std::vector<glm::vec3>& triangleNormals = m_face_normals;
 
 	// Compute V:{F}
 	std::vector<std::vector<uint32_t>> vert2faces(m_vertices.size());
@@ -38,6 +38,11 @@ public:
 		return m_faces;
 	}
 
+	// Unit normal of each face, following the winding of the indices
+	const std::vector<glm::vec3>& get_face_normals() const {
+		return m_face_normals;
+	}
+
 	uint32_t get_vbo_vertices() const { return m_vbo_vertices; }
 	uint32_t get_vbo_indices() const { return m_vbo_indices; }
 	uint32_t get_vbo_normals() const { return m_vbo_normals; }
@@ -51,6 +56,7 @@ private:
 	std::vector<glm::vec3> m_vertices;
 	std::vector<glm::vec3> m_normals;
 	std::vector<glm::uvec3> m_faces;
+	std::vector<glm::vec3> m_face_normals;
 
 	union
 	{
@@ -62,6 +68,7 @@ private:
 		uint32_t m_vbos[3];
 	};
 
+	void generate_face_normals();
 	void generate_normals();
 };
 
@@ -0,0 +1,97 @@
+#include "UploadRing.hpp"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "utils/Tracer.hpp"
+
+UploadRing::~UploadRing()
+{
+	for (void* fence : m_fences) {
+		if (fence != nullptr) {
+			glDeleteSync((GLsync)fence);
+		}
+	}
+	if (m_buffer != 0) {
+		glUnmapNamedBuffer(m_buffer);
+		glDeleteBuffers(1, &m_buffer);
+	}
+}
+
+void UploadRing::initialize()
+{
+	GLint uniform_alignment = 0, storage_alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+	m_alignment = (uint32_t)std::max({ uniform_alignment, storage_alignment, 16 });
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers(1, &m_buffer);
+	glNamedBufferStorage(m_buffer, NUM_REGIONS * REGION_SIZE, nullptr, flags);
+	m_mapped = (uint8_t*)glMapNamedBufferRange(m_buffer, 0, NUM_REGIONS * REGION_SIZE, flags);
+	if (m_mapped == nullptr) {
+		throw std::runtime_error("Could not map the upload ring");
+	}
+}
+
+void UploadRing::begin_frame()
+{
+	if (m_buffer == 0) {
+		initialize();
+		return;
+	}
+	next_region();
+}
+
+void UploadRing::next_region()
+{
+	// The commands issued so far are the last ones that read the current region
+	if (m_fences[m_region] != nullptr) {
+		glDeleteSync((GLsync)m_fences[m_region]);
+	}
+	m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	m_region = (m_region + 1) % NUM_REGIONS;
+	m_offset = 0;
+	m_generation += 1;
+
+	GLsync fence = (GLsync)m_fences[m_region];
+	if (fence == nullptr) {
+		return;
+	}
+	// Usually signaled long ago, NUM_REGIONS - 1 frames have been submitted since
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_TIMEOUT_EXPIRED) {
+		Tracer::Scope trace("UploadRing::wait");
+		m_num_stalls += 1;
+		do {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+	}
+	if (result == GL_WAIT_FAILED) {
+		std::cerr << "Error waiting for the fence of the upload ring" << std::endl;
+	}
+	glDeleteSync(fence);
+	m_fences[m_region] = nullptr;
+}
+
+UploadRing::Range UploadRing::upload(const void* data, uint32_t size)
+{
+	if (m_buffer == 0) {
+		initialize();
+	}
+	if (size > REGION_SIZE) {
+		throw std::runtime_error("Upload larger than a region of the upload ring");
+	}
+	// A full region moves on early, which waits for the GPU if it is still reading the next one
+	if (m_offset + size > REGION_SIZE) {
+		next_region();
+	}
+
+	const uint32_t offset = m_region * REGION_SIZE + m_offset;
+	std::memcpy(m_mapped + offset, data, size);
+	m_offset = (m_offset + size + m_alignment - 1) / m_alignment * m_alignment;
+	return { m_buffer, offset, size };
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+
+// Small data that the CPU rewrites often, like the configs and the interaction shapes,
+// written straight into a persistent and coherent mapped buffer instead of with
+// glBufferSubData, which can wait for the GPU to finish reading the old contents.
+// The buffer is split in NUM_REGIONS regions, one per frame in flight. Each frame
+// writes to the next region, after waiting for the fence of the last frame that used it,
+// so the data of the frames still in flight is never overwritten.
+//
+// Uploads only live until their region is reused, so users upload their data again
+// when the generation changes, before the commands that read it.
+class UploadRing {
+public:
+	static constexpr uint64_t INVALID_GENERATION = UINT64_MAX;
+
+	struct Range {
+		uint32_t buffer;
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	UploadRing() = default;
+	~UploadRing();
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	// Fence the region of the previous frame and move to the next one.
+	// The buffer is created in the first call, which needs the OpenGL context.
+	void begin_frame();
+
+	// Copy the data to the current region. Aligned to bind as a uniform or storage block.
+	Range upload(const void* data, uint32_t size);
+
+	// Changes every time the region changes. Ranges of older generations may be overwritten.
+	uint64_t get_generation() const { return m_generation; }
+
+	// Frames that had to wait for the GPU to release their region
+	uint64_t get_num_stalls() const { return m_num_stalls; }
+
+private:
+	static constexpr uint32_t NUM_REGIONS = 3;
+	static constexpr uint32_t REGION_SIZE = 64 * 1024;
+
+	uint32_t m_buffer = 0;
+	uint8_t* m_mapped = nullptr;
+	uint32_t m_alignment = 256;
+
+	// Signaled when the GPU is done with the commands that read each region
+	std::array<void*, NUM_REGIONS> m_fences = {};
+	uint32_t m_region = 0;
+	uint32_t m_offset = 0;
+	uint64_t m_generation = 0;
+	uint64_t m_num_stalls = 0;
+
+	void initialize();
+	void next_region();
+};
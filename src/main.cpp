@@ -1,13 +1,12 @@
 #include <iostream>
 
 #include "GlobalContext.hpp"
+#include "utils/Tracer.hpp"
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
-#include <thread>
-#include <chrono>
 
 static void glfw_error_callback(int error, const char* description)
 {
@@ -31,23 +30,30 @@ gl_message_callback(GLenum source,
 void main_loop(GLFWwindow* window) {
     bool show_demo_window = true;
     GlobalContext gc;
-    double prev_frame_time = glfwGetTime();
+    Tracer::global().set_thread_name("main");
 
     while (!glfwWindowShouldClose(window)) {
-        double actual_frame_time = glfwGetTime();
-        while (actual_frame_time - prev_frame_time < 1.0 / gc.get_max_fps()) {
-            std::this_thread::sleep_for(std::chrono::nanoseconds(50));
-            actual_frame_time = glfwGetTime();
+        {
+            Tracer::Scope trace("wait_next_frame");
+            gc.get_frame_pacer().wait_next_frame();
         }
-        prev_frame_time = actual_frame_time;
+        Tracer::Scope trace_frame("frame");
+        gc.get_gpu_profiler().begin_frame();
+        gc.get_upload_ring().begin_frame();
 
         // Poll and handle events (inputs, window resize, etc.)
-        glfwPollEvents();
+        {
+            Tracer::Scope trace("poll_events");
+            glfwPollEvents();
+        }
 
         // Start the Dear ImGui frame
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+        {
+            Tracer::Scope trace("ImGui::NewFrame");
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+        }
 
         if (ImGui::BeginMainMenuBar())
         {
@@ -66,7 +72,10 @@ void main_loop(GLFWwindow* window) {
         gc.update();
 
         // Rendering
-        ImGui::Render();
+        {
+            Tracer::Scope trace("ImGui::Render");
+            ImGui::Render();
+        }
         int display_w, display_h;
         glfwGetFramebufferSize(window, &display_w, &display_h);
         glViewport(0, 0, display_w, display_h);
@@ -79,9 +88,18 @@ void main_loop(GLFWwindow* window) {
 
         // Render UI
         glDisable(GL_DEPTH_TEST);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            Tracer::Scope trace("render_ui");
+            gc.get_gpu_profiler().begin_pass(GpuProfiler::Pass::eUI);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            gc.get_gpu_profiler().end_pass();
+        }
+        gc.get_gpu_profiler().end_frame();
 
-        glfwSwapBuffers(window);
+        {
+            Tracer::Scope trace("swap_buffers");
+            glfwSwapBuffers(window);
+        }
     }
 }
 
@@ -1,51 +1,33 @@
 #include "ClothSystem.hpp"
+#include "SpringSystemData.hpp"
+#include "SpringForces.hpp"
+#include "utils/Tracer.hpp"
+#include "utils/ThreadPool.hpp"
 
 #include <imgui.h>
 #include <glad/glad.h>
 #include <array>
+#include <cassert>
 #include <glm/gtc/type_ptr.hpp>
+#include <chrono>
 
 using namespace spring;
 
 ClothSystem::ClothSystem()
 {
-	const std::filesystem::path proj_dir(PROJECT_DIR);
-	const std::filesystem::path shad_dir = proj_dir / "resources/shaders";
+	load_programs();
 
-	std::array<Shader, 2> particle_shaders = {
-		Shader((shad_dir / "spring_point.vert"), Shader::Type::Vertex),
-		Shader((shad_dir / "spring_point.frag"), Shader::Type::Fragment)
-	};
-
-	m_basic_draw_point = ShaderProgram(particle_shaders.data(), (uint32_t)particle_shaders.size());
-
-	m_advect_particle_program = ShaderProgram(
-		&Shader(shad_dir / "advect_particles_springs.comp", Shader::Type::Compute), 1
-	);
-
-	m_spring_force_program = ShaderProgram(
-		&Shader(shad_dir / "spring_forces.comp", Shader::Type::Compute), 1
-	);
-
-	std::array<Shader, 4> tess_shaders = {
-		Shader((shad_dir / "cloth_tess.vert"), Shader::Type::Vertex),
-		Shader((shad_dir / "cloth_tess.frag"), Shader::Type::Fragment),
-		Shader((shad_dir / "cloth_tess.tesc"), Shader::Type::TessellationControl),
-		Shader((shad_dir / "cloth_tess.tese"), Shader::Type::TessellationEvaluation)
-	};
-	m_tessellation_program = ShaderProgram(tess_shaders.data(), (uint32_t)tess_shaders.size());
 
-
-	glGenBuffers(2, m_vbo_particle_buffers);
-	glGenBuffers(1, &m_system_config_bo);
-	glGenBuffers(1, &m_spring_indices_bo);
-	glGenBuffers(1, &m_patches_indices_bo);
-	glGenBuffers(1, &m_sphere_ssb);
-	glGenBuffers(1, &m_forces_buffer);
-	glGenBuffers(1, &m_original_lengths_buffer);
-	glGenBuffers(1, &m_fixed_points_buffer);
-	glGenBuffers(1, &m_particle_2_segments_list);
-	glGenBuffers(1, &m_segments_list_buffer);
+	// Created, not only named, as they are first written with the DSA functions
+	glCreateBuffers(4, m_vbo_particle_buffers);
+	glCreateBuffers(1, &m_spring_indices_bo);
+	glCreateBuffers(1, &m_patches_indices_bo);
+	glCreateBuffers(1, &m_forces_buffer);
+	glCreateBuffers(1, &m_original_lengths_buffer);
+	glCreateBuffers(1, &m_fixed_points_buffer);
+	glCreateBuffers(1, &m_particle_2_segments_list);
+	glCreateBuffers(1, &m_segments_list_buffer);
+	glCreateBuffers(1, &m_color_segments_buffer);
 
 	glGenVertexArrays(1, &m_segment_vao);
 	glGenVertexArrays(1, &m_patches_vao);
@@ -72,41 +54,58 @@ ClothSystem::ClothSystem()
 	m_system_config.num_fixed_particles = 1;
 	m_system_config.num_particles_per_strand = 0;
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_system_config_bo);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(SpringSystemConfig),
-		nullptr, GL_STATIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-	// Initialize shapes
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		2 * sizeof(Sphere),
-		nullptr, GL_STATIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
 	initialize_system();
 	update_interaction_data();
 }
 
 void ClothSystem::update(float time, float dt)
 {
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[m_flipflop_state]);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[1 - m_flipflop_state]);
-
-	glClearNamedBufferSubData(m_forces_buffer, GL_R32F,
-		0, sizeof(glm::vec4) * m_system_config.num_segments, GL_RED, GL_FLOAT, nullptr);
+	Tracer::Scope trace("ClothSystem::update");
+	upload_frame_data();
+	if (m_solver_mode == SolverMode::eSegments) {
+		update_segments(dt);
+	}
+	else if (m_solver_mode == SolverMode::eGrid) {
+		update_grid(dt);
+	}
+	else {
+		update_cpu(dt);
+	}
 
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	// flip state
+	m_flipflop_state = !m_flipflop_state;
+}
 
-	m_spring_force_program.use_program();
-	glUniform1f(0, dt);
-	glDispatchCompute(m_system_config.num_segments / 32
-		+ (m_system_config.num_segments % 32 == 0 ? 0 : 1)
-		, 1, 1);
+void ClothSystem::update_segments(float dt)
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[m_flipflop_state]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[1 - m_flipflop_state]);
 
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	if (m_force_accumulation == ForceAccumulation::eColoredScatter) {
+		scatter_spring_forces(m_spring_force_program, m_forces_buffer, m_vbo_particle_buffers,
+			m_color_offsets, dt, &m_pass_graph, m_gpu_profiler);
+	}
+	else {
+		// Every segment writes its force, no need to clear them
+		GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eSpringForce);
+		m_pass_graph.pass({
+			PassGraph::read(m_vbo_particle_buffers[0]),
+			PassGraph::read(m_vbo_particle_buffers[1]),
+			PassGraph::write(m_forces_buffer),
+			});
+		m_spring_force_program.use_program();
+		glUniform1f(0, dt);
+		glDispatchCompute(m_system_config.num_segments / 32
+			+ (m_system_config.num_segments % 32 == 0 ? 0 : 1)
+			, 1, 1);
+	}
 
+	GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eAdvect);
+	m_pass_graph.pass({
+		PassGraph::read(m_forces_buffer),
+		PassGraph::write(m_vbo_particle_buffers[0]),
+		PassGraph::write(m_vbo_particle_buffers[1]),
+		});
 	m_advect_particle_program.use_program();
 	glUniform1f(0, dt);
 	glm::quat q = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
@@ -114,14 +113,78 @@ void ClothSystem::update(float time, float dt)
 	glDispatchCompute(m_system_config.num_particles / 32
 		+ (m_system_config.num_particles % 32 == 0 ? 0 : 1)
 		, 1, 1);
+}
 
-	// flip state
-	m_flipflop_state = !m_flipflop_state;
+void ClothSystem::update_grid(float dt)
+{
+	// Buffers bound as in, out, next in and next out.
+	// The next pair gets the current (after collisions) and new positions,
+	// so the following step reads it as out and in.
+	constexpr uint32_t pair_buffers[2][4] = { { 0, 1, 2, 3 }, { 3, 2, 1, 0 } };
+	const uint32_t* bufs = pair_buffers[m_flipflop_state];
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[bufs[0]]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[bufs[1]]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_NEXT_IN, m_vbo_particle_buffers[bufs[2]]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_NEXT_OUT, m_vbo_particle_buffers[bufs[3]]);
+
+	// Forces and advection in a single pass, timed as advect
+	{
+		GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eAdvect);
+		m_pass_graph.pass({
+			PassGraph::read(m_vbo_particle_buffers[bufs[0]]),
+			PassGraph::read(m_vbo_particle_buffers[bufs[1]]),
+			PassGraph::write(m_vbo_particle_buffers[bufs[2]]),
+			PassGraph::write(m_vbo_particle_buffers[bufs[3]]),
+			});
+		m_advect_grid_program.use_program();
+		glUniform1f(0, dt);
+		glm::quat q = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		glUniform4fv(3, 1, glm::value_ptr(q));
+		glDispatchCompute(m_system_config.num_particles / 32
+			+ (m_system_config.num_particles % 32 == 0 ? 0 : 1)
+			, 1, 1);
+	}
+
+	// The draw programs read the new positions from the out binding
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[bufs[2]]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[bufs[3]]);
+}
+
+void ClothSystem::update_cpu(float dt)
+{
+	Tracer::Scope trace("ClothSystem::update_cpu");
+	const auto start = std::chrono::steady_clock::now();
+	m_cpu_solver.step(dt, glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+	m_cpu_step_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Upload the result where the segments solver would have written it
+	const uint32_t out = 1 - (uint32_t)m_flipflop_state;
+	m_pass_graph.pass({ PassGraph::update(m_vbo_particle_buffers[out]) });
+	if (m_layout == ParticleLayout::eAoS) {
+		glNamedBufferSubData(m_vbo_particle_buffers[out],
+			0, sizeof(Particle) * m_cpu_solver.get_particles().size(),
+			m_cpu_solver.get_particles().data());
+	}
+	else {
+		glNamedBufferSubData(m_vbo_particle_buffers[out],
+			0, sizeof(float) * m_cpu_solver.get_positions().size(),
+			m_cpu_solver.get_positions().data());
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[m_flipflop_state]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[out]);
 }
 
 void ClothSystem::gl_render(const glm::mat4& proj_view, const glm::vec3& eye_world)
 {
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	upload_frame_data();
+	// The vertex shaders read the positions from the storage buffers
+	m_pass_graph.pass({
+		PassGraph::read(m_vbo_particle_buffers[0]),
+		PassGraph::read(m_vbo_particle_buffers[1]),
+		PassGraph::read(m_vbo_particle_buffers[2]),
+		PassGraph::read(m_vbo_particle_buffers[3]),
+		});
 
 	if (m_draw_mode == DrawMode::ePolylines) {
 		if (m_draw_points || m_draw_lines) {
@@ -172,6 +235,13 @@ void ClothSystem::imgui_draw()
 {
 	ImGui::PushID("clothSys");
 	ImGui::Text("Cloth System Config");
+	uint32_t num_barriers, num_passes;
+	m_pass_graph.get_stats(&num_barriers, &num_passes);
+	ImGui::Text("Barriers %u / passes %u", num_barriers, num_passes);
+	ParticleLayout layout = m_layout;
+	if (ImGui::Combo("Layout", (int*)&layout, "Array of structs\0Struct of arrays\0")) {
+		set_layout(layout);
+	}
 
 	bool update = false;
 	update |= ImGui::DragFloat("Gravity", &m_system_config.gravity, 0.01f);
@@ -235,6 +305,44 @@ void ClothSystem::imgui_draw()
 	ImGui::InputScalar("Num Fixed particles", ImGuiDataType_U32, &m_num_fixed_particles);
 
 	ImGui::Checkbox("Provot's Spring Model", &m_use_provots);
+	ImGui::Checkbox("Reorder particles", &m_reorder_particles);
+	if (ImGui::IsItemHovered()) {
+		ImGui::SetTooltip("Morton order of the particles and segments on reset. Not for the fused grid solver.");
+	}
+	if (m_solver_mode == SolverMode::eSegments) {
+		ForceAccumulation accumulation = m_force_accumulation;
+		if (ImGui::Combo("Forces", (int*)&accumulation, "Gather\0Colored scatter\0")) {
+			set_force_accumulation(accumulation);
+		}
+		if (m_force_accumulation == ForceAccumulation::eColoredScatter) {
+			ImGui::Text("%u colors of segments", (uint32_t)m_color_offsets.size() - 1);
+		}
+	}
+	if (ImGui::Combo("Solver", (int*)&m_solver_mode, "Segments\0Fused grid\0Implicit (CPU)\0XPBD (CPU)\0")) {
+		initialize_system();
+	}
+	if (m_solver_mode == SolverMode::eImplicit) {
+		uint32_t iterations = m_cpu_solver.get_cg_max_iterations();
+		if (ImGui::InputScalar("CG max iterations", ImGuiDataType_U32, &iterations)) {
+			m_cpu_solver.set_cg_max_iterations(iterations);
+		}
+		float tolerance = m_cpu_solver.get_cg_tolerance();
+		if (ImGui::InputFloat("CG tolerance", &tolerance, 0.0f, 0.0f, "%.1e")) {
+			m_cpu_solver.set_cg_tolerance(tolerance);
+		}
+		ImGui::Text("CPU step %.3f ms, %u CG iterations", m_cpu_step_ms, m_cpu_solver.get_cg_iterations());
+	}
+	else if (m_solver_mode == SolverMode::eXPBD) {
+		uint32_t iterations = m_cpu_solver.get_xpbd_iterations();
+		if (ImGui::InputScalar("XPBD iterations", ImGuiDataType_U32, &iterations)) {
+			m_cpu_solver.set_xpbd_iterations(iterations);
+		}
+		float compliance = m_cpu_solver.get_xpbd_compliance();
+		if (ImGui::InputFloat("Compliance", &compliance, 0.0f, 0.0f, "%.1e")) {
+			m_cpu_solver.set_xpbd_compliance(std::max(compliance, 0.0f));
+		}
+		ImGui::Text("CPU step %.3f ms, %u colors", m_cpu_step_ms, m_cpu_solver.get_num_colors());
+	}
 
 	if (ImGui::Button("Reset")) {
 		initialize_system();
@@ -244,231 +352,204 @@ void ClothSystem::imgui_draw()
 }
 
 
-void ClothSystem::initialize_system()
+void ClothSystem::set_layout(ParticleLayout layout)
 {
-	m_flipflop_state = false;
-
-	// TODO
-	{
-		for (uint32_t i = 0; i < 2; ++i) {
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_vbo_particle_buffers[i]);
-			glBufferData(GL_SHADER_STORAGE_BUFFER,
-				m_system_config.num_particles * sizeof(Particle),
-				nullptr, GL_DYNAMIC_DRAW);
-		}
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-		{
-			const uint32_t num_particles = m_system_config.num_particles = m_resolution_cloth.x * m_resolution_cloth.y;
-			m_system_config.num_fixed_particles = m_num_fixed_particles;
-			m_system_config.num_particles_per_strand = 0; //todo: delete
-
-			std::vector<Particle> p; p.reserve(num_particles);
-			// const glm::vec3 dir = glm::normalize(rope_init_dir);
-			float delta_x = m_cloth_size.x / (float)m_resolution_cloth.x;
-			float delta_y = m_cloth_size.y / (float)m_resolution_cloth.y;
-			for (uint32_t j = 0; j < m_resolution_cloth.y; ++j) {
-				for (uint32_t i = 0; i < m_resolution_cloth.x; ++i) {
-					p.push_back({});
-					p.back().pos = m_sphere_head.pos + glm::vec3((float)i * delta_x, 0.0f, (float)j * delta_y);
-				}
-			}
-			glNamedBufferData(
-				m_vbo_particle_buffers[0], // buffer name
-				num_particles * sizeof(Particle),	// size
-				p.data(),	// data
-				GL_DYNAMIC_DRAW
-			);
-			glNamedBufferData(
-				m_vbo_particle_buffers[1], // buffer name
-				num_particles * sizeof(Particle),	// size
-				p.data(),	// data
-				GL_DYNAMIC_DRAW
-			);
-
-			// Segment indices
-			std::vector<glm::ivec2> indices;
-			std::vector<std::vector<SegmentMapping>> mappings_buffer(num_particles);
-			uint32_t total_mappings = 0;
-			for (uint32_t j = 0; j < m_resolution_cloth.y; ++j) {
-				for (uint32_t i = 0; i < m_resolution_cloth.x; ++i) {
-					uint32_t base = j * m_resolution_cloth.x + i;
-
-					if (i != m_resolution_cloth.x - 1) {
-						uint32_t right = j * m_resolution_cloth.x + i + 1;
-
-						uint32_t idx = (uint32_t)indices.size();
-						indices.push_back(glm::ivec2(base, right));
-						mappings_buffer[base].push_back({ idx, 0 });
-						mappings_buffer[right].push_back({ idx, 1 });
-
-						total_mappings += 2;
-					}
-					if (j != m_resolution_cloth.y - 1) {
-						uint32_t up = (j + 1) * m_resolution_cloth.x + i;
-
-						uint32_t idx = (uint32_t)indices.size();
-						indices.push_back(glm::ivec2(base, up));
-
-						mappings_buffer[base].push_back({ idx, 0 });
-						mappings_buffer[up].push_back({ idx, 1 });
-
-						total_mappings += 2;
-
-					}
-
-					// Provot's
-					if (m_use_provots) {
-
-						// Bend
-						if (i < m_resolution_cloth.x - 2) {
-							uint32_t right2 = j * m_resolution_cloth.x + i + 2;
-
-							uint32_t idx = (uint32_t)indices.size();
-							indices.push_back(glm::ivec2(base, right2));
-							mappings_buffer[base].push_back({ idx, 0 });
-							mappings_buffer[right2].push_back({ idx, 1 });
-
-							total_mappings += 2;
-						}
-						if (j < m_resolution_cloth.y - 2) {
-							uint32_t up2 = (j + 2) * m_resolution_cloth.x + i;
-
-							uint32_t idx = (uint32_t)indices.size();
-							indices.push_back(glm::ivec2(base, up2));
-
-							mappings_buffer[base].push_back({ idx, 0 });
-							mappings_buffer[up2].push_back({ idx, 1 });
-
-							total_mappings += 2;
-						}
-
-						// Shear
-						if (j != m_resolution_cloth.y - 1 && i != m_resolution_cloth.x - 1) {
-							uint32_t up_right = (j + 1) * m_resolution_cloth.x + i + 1;
-
-							uint32_t idx = (uint32_t)indices.size();
-							indices.push_back(glm::ivec2(base, up_right));
-
-							mappings_buffer[base].push_back({ idx, 0 });
-							mappings_buffer[up_right].push_back({ idx, 1 });
+	m_layout = layout;
+	load_programs();
+	initialize_system();
+	update_interaction_data();
+}
 
-							total_mappings += 2;
-						}
+void ClothSystem::set_force_accumulation(ForceAccumulation accumulation)
+{
+	m_force_accumulation = accumulation;
+	load_programs();
+	initialize_system();
+	update_interaction_data();
+}
 
-						if (j > 0 && i != m_resolution_cloth.x - 1) {
-							uint32_t down_right = (j - 1) * m_resolution_cloth.x + i + 1;
+void ClothSystem::load_programs()
+{
+	const std::filesystem::path shad_dir = std::filesystem::path(PROJECT_DIR) / "resources/shaders";
+	const std::vector<std::string> defines = get_particle_layout_defines(m_layout);
+	std::vector<std::string> force_defines = defines;
+	if (m_force_accumulation == ForceAccumulation::eColoredScatter) {
+		force_defines.push_back("SCATTER_FORCES");
+	}
 
-							uint32_t idx = (uint32_t)indices.size();
-							indices.push_back(glm::ivec2(base, down_right));
+	std::array<Shader, 2> particle_shaders = {
+		Shader((shad_dir / "spring_point.vert"), Shader::Type::Vertex, defines),
+		Shader((shad_dir / "spring_point.frag"), Shader::Type::Fragment)
+	};
 
-							mappings_buffer[base].push_back({ idx, 0 });
-							mappings_buffer[down_right].push_back({ idx, 1 });
+	m_basic_draw_point = ShaderProgram(particle_shaders.data(), (uint32_t)particle_shaders.size());
 
-							total_mappings += 2;
-						}
-					}
-				}
-			}
+	m_advect_particle_program = ShaderProgram(
+		&Shader(shad_dir / "advect_particles_springs.comp", Shader::Type::Compute, force_defines), 1
+	);
 
-			std::vector<Particle2SegmentsList> particle2segments_map(num_particles);
-			std::vector<SegmentMapping> mappings;
-			mappings.reserve(total_mappings);
-			for (uint32_t i = 0; i < num_particles; ++i) {
-				uint32_t idx = (uint32_t)mappings.size();
-				mappings.insert(std::end(mappings),
-					std::begin(mappings_buffer[i]), std::end(mappings_buffer[i]));
+	m_spring_force_program = ShaderProgram(
+		&Shader(shad_dir / "spring_forces.comp", Shader::Type::Compute, force_defines), 1
+	);
 
-				particle2segments_map[i] = { idx, (uint32_t)mappings_buffer[i].size() };
-			}
+	std::vector<std::string> grid_defines = defines;
+	grid_defines.push_back("CLOTH_GRID_FORCES");
+	m_advect_grid_program = ShaderProgram(
+		&Shader(shad_dir / "advect_particles_springs.comp", Shader::Type::Compute, grid_defines), 1
+	);
 
+	std::array<Shader, 4> tess_shaders = {
+		Shader((shad_dir / "cloth_tess.vert"), Shader::Type::Vertex, defines),
+		Shader((shad_dir / "cloth_tess.frag"), Shader::Type::Fragment),
+		Shader((shad_dir / "cloth_tess.tesc"), Shader::Type::TessellationControl),
+		Shader((shad_dir / "cloth_tess.tese"), Shader::Type::TessellationEvaluation)
+	};
+	m_tessellation_program = ShaderProgram(tess_shaders.data(), (uint32_t)tess_shaders.size());
+}
 
-			m_system_config.num_segments = (uint32_t)indices.size();
+void ClothSystem::initialize_system()
+{
+	Tracer::Scope trace("ClothSystem::initialize_system");
+	// The buffers are reallocated and rewritten below
+	m_pass_graph.flush();
+	m_flipflop_state = false;
 
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_spring_indices_bo);
-			glBufferData(GL_SHADER_STORAGE_BUFFER,
-				sizeof(glm::ivec2) * indices.size(),
-				indices.data(), GL_STATIC_DRAW);
+	SpringSystemData& data = m_data;
+	build_cloth_data(m_sphere_head.pos, m_resolution_cloth, m_cloth_size,
+		m_use_provots, m_num_fixed_particles, &data);
+	// New index of each particle of the grid, or empty if they stay by rows
+	std::vector<uint32_t>& new_index = m_new_index;
+	new_index.clear();
+	if (m_reorder_particles && m_solver_mode != SolverMode::eGrid) {
+		reorder_spring_data(&data, &new_index);
+	}
+	// Per segment data, the grid solver computes it from the grid
+	if (m_solver_mode != SolverMode::eGrid) {
+		build_segment_data(&data);
+	}
+	else {
+		data.original_lengths.clear();
+		data.particle2segments.clear();
+		data.segment_mappings.clear();
+	}
+	// Colors of the segments for the scatter of the forces, which needs no segments per particle
+	const bool scatter = m_solver_mode == SolverMode::eSegments
+		&& m_force_accumulation == ForceAccumulation::eColoredScatter;
+	if (scatter) {
+		build_segment_colors(&data);
+		data.particle2segments.clear();
+		data.segment_mappings.clear();
+	}
+	else {
+		data.color_segments.clear();
+		data.color_offsets.clear();
+	}
+	m_color_offsets = data.color_offsets;
 
-			// Patch indices
-			std::vector<int32_t> patch_indices; 
-			patch_indices.reserve(m_resolution_cloth.x * m_resolution_cloth.y * 9);
-			for (int32_t j = 0; j < (int32_t)m_resolution_cloth.y; ++j) {
-				for (int32_t i = 0; i < (int32_t)m_resolution_cloth.x; ++i) {
-					// create patch
-					for (int32_t dj = -1; dj < 2; ++dj) {
-						const int32_t new_j = std::clamp(j + dj, 0, (int32_t)m_resolution_cloth.y - 1);
-						for (int32_t di = -1; di < 2; ++di) {
-							const int32_t new_i = std::clamp(i + di, 0, (int32_t)m_resolution_cloth.x - 1);
+	const uint32_t num_particles = m_system_config.num_particles = (uint32_t)data.particles.size();
+	m_system_config.num_segments = (uint32_t)data.segments.size();
+	m_system_config.num_fixed_particles = (uint32_t)data.fixed_particles.size();
+	m_system_config.num_particles_per_strand = 0;
 
-							patch_indices.push_back(new_j * m_resolution_cloth.x + new_i);
-						}
+	// Patch indices, 9 per particle of the grid
+	const glm::uvec2 res = m_resolution_cloth;
+	m_patch_indices.resize(res.x * res.y * 9);
+	ThreadPool::global().parallel_for(res.y, [&](uint32_t row_begin, uint32_t row_end, uint32_t) {
+		for (int32_t j = (int32_t)row_begin; j < (int32_t)row_end; ++j) {
+			int32_t* patch = m_patch_indices.data() + (size_t)j * res.x * 9;
+			for (int32_t i = 0; i < (int32_t)res.x; ++i) {
+				// create patch
+				for (int32_t dj = -1; dj < 2; ++dj) {
+					const int32_t new_j = std::clamp(j + dj, 0, (int32_t)res.y - 1);
+					for (int32_t di = -1; di < 2; ++di) {
+						const int32_t new_i = std::clamp(i + di, 0, (int32_t)res.x - 1);
+
+						const uint32_t idx = new_j * res.x + new_i;
+						*patch++ = new_index.empty() ? idx : new_index[idx];
 					}
 				}
 			}
-			m_num_elements_patches = (uint32_t)patch_indices.size();
-
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patches_indices_bo);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-				sizeof(patch_indices[0]) * patch_indices.size(),
-				patch_indices.data(), GL_STATIC_DRAW);
-			
-
-			// Segment lengths
-			std::vector<float> original_lengths(m_system_config.num_segments);
-			for (uint32_t i = 0; i < m_system_config.num_segments; ++i) {
-				original_lengths[i] = glm::length(p[indices[i].x].pos - p[indices[i].y].pos);
-			}
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_original_lengths_buffer);
-			glBufferData(GL_SHADER_STORAGE_BUFFER,
-				sizeof(float) * original_lengths.size(),
-				original_lengths.data(), GL_STATIC_DRAW);
-
-			
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_particle_2_segments_list);
-			glBufferData(GL_SHADER_STORAGE_BUFFER,
-				sizeof(Particle2SegmentsList) * particle2segments_map.size(),
-				particle2segments_map.data(), GL_STATIC_DRAW);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_segments_list_buffer);
-			glBufferData(GL_SHADER_STORAGE_BUFFER,
-				sizeof(SegmentMapping) * mappings.size(),
-				mappings.data(), GL_STATIC_DRAW);
-			// Upload also fixed particles, modify original points
-			for (uint32_t i = 0; i < m_system_config.num_fixed_particles; ++i) {
-				p[i].pos -= m_sphere_head.pos;
-			}
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_fixed_points_buffer);
-			glBufferData(GL_SHADER_STORAGE_BUFFER,
-				sizeof(Particle) * m_system_config.num_fixed_particles,
-				p.data(),
-				GL_STATIC_DRAW);
 		}
+	}, 16);
+	m_num_elements_patches = (uint32_t)m_patch_indices.size();
 
-		// force buffers
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_forces_buffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER,
-			sizeof(glm::vec4) * m_system_config.num_segments,
-			nullptr, GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-		glClearNamedBufferSubData(m_forces_buffer, GL_R32F,
-			0, sizeof(glm::vec4) * m_system_config.num_segments, GL_RED, GL_FLOAT, nullptr);
+	// Every buffer is reallocated and written through a single staging buffer
+	StagingUpload& upload = m_staging_upload;
+	upload.add(m_color_segments_buffer, data.color_segments.data(),
+		sizeof(uint32_t) * data.color_segments.size(), GL_STATIC_DRAW);
 
+	if (m_layout == ParticleLayout::eSoA) {
+		positions_to_soa(data.particles, &m_soa_positions);
+	}
+	const size_t particles_size = m_layout == ParticleLayout::eAoS ?
+		num_particles * sizeof(Particle) : m_soa_positions.size() * sizeof(float);
+	const void* particles_data = m_layout == ParticleLayout::eAoS ?
+		(const void*)data.particles.data() : (const void*)m_soa_positions.data();
+	for (uint32_t k = 0; k < 2; ++k) {
+		upload.add(m_vbo_particle_buffers[k], particles_data, particles_size, GL_DYNAMIC_DRAW);
+	}
+	// The grid solver writes the second pair, it is fully written every step
+	const size_t next_size = m_solver_mode == SolverMode::eGrid ? particles_size : 0;
+	for (uint32_t k = 2; k < 4; ++k) {
+		upload.add(m_vbo_particle_buffers[k], nullptr, next_size, GL_DYNAMIC_DRAW);
 	}
 
+	// Segment indices, also drawn as lines
+	upload.add(m_spring_indices_bo, data.segments.data(),
+		sizeof(glm::ivec2) * data.segments.size(), GL_STATIC_DRAW);
+	upload.add(m_patches_indices_bo, m_patch_indices.data(),
+		sizeof(int32_t) * m_patch_indices.size(), GL_STATIC_DRAW);
+
+	upload.add(m_original_lengths_buffer, data.original_lengths.data(),
+		sizeof(float) * data.original_lengths.size(), GL_STATIC_DRAW);
+	upload.add(m_particle_2_segments_list, data.particle2segments.data(),
+		sizeof(Particle2SegmentsList) * data.particle2segments.size(), GL_STATIC_DRAW);
+	upload.add(m_segments_list_buffer, data.segment_mappings.data(),
+		sizeof(SegmentMapping) * data.segment_mappings.size(), GL_STATIC_DRAW);
+
+	// Fixed particles, relative to the interaction sphere
+	upload.add(m_fixed_points_buffer, data.fixed_particles.data(),
+		sizeof(Particle) * data.fixed_particles.size(), GL_STATIC_DRAW);
+
+	// force buffers, spring_forces.comp writes all of them every step.
+	// Per particle when scattered, and cleared before.
+	uint32_t num_forces = 0;
+	if (m_solver_mode == SolverMode::eSegments) {
+		num_forces = scatter ? m_system_config.num_particles : m_system_config.num_segments;
+	}
+	upload.add(m_forces_buffer, nullptr, sizeof(glm::vec4) * num_forces, GL_DYNAMIC_DRAW);
+	upload.flush(ThreadPool::global());
+
+	// Rest lengths of the grid solver
+	m_advect_grid_program.use_program();
+	glUniform2ui(4, m_resolution_cloth.x, m_resolution_cloth.y);
+	glUniform2f(5, m_cloth_size.x / (float)m_resolution_cloth.x, m_cloth_size.y / (float)m_resolution_cloth.y);
+	glUniform1ui(6, m_use_provots ? 1 : 0);
+	glUseProgram(0);
+
 	update_system_config();
+	if (m_solver_mode == SolverMode::eImplicit || m_solver_mode == SolverMode::eXPBD) {
+		m_cpu_solver.initialize(m_system_config, data, m_layout);
+		m_cpu_solver.set_integrator(m_solver_mode == SolverMode::eImplicit ?
+			CpuSpringSolver::Integrator::eImplicit : CpuSpringSolver::Integrator::eXPBD);
+	}
 	reset_bindings();
 }
 
 void ClothSystem::update_interaction_data()
 {
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Sphere), sizeof(Sphere), &m_sphere_head);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
 
-	m_advect_particle_program.use_program();
-	glUniform1ui(1, m_intersect_sphere ? 1 : 0);
-	// Always disable second sphere
-	glUniform1ui(2, 0);
+	m_cpu_solver.set_intersect_sphere(m_intersect_sphere);
+	m_cpu_solver.set_sphere_head(m_sphere_head);
+	m_cpu_solver.set_intersect_sphere_head(false);
+
+	for (ShaderProgram* program : { &m_advect_particle_program, &m_advect_grid_program }) {
+		program->use_program();
+		glUniform1ui(1, m_intersect_sphere ? 1 : 0);
+		// Always disable second sphere
+		glUniform1ui(2, 0);
+	}
 
 	glUseProgram(0);
 
@@ -476,23 +557,34 @@ void ClothSystem::update_interaction_data()
 
 void ClothSystem::update_system_config()
 {
-	glNamedBufferSubData(
-		m_system_config_bo, // buffer name
-		0, // offset
-		sizeof(SpringSystemConfig),	// size
-		&m_system_config	// data
-	);
+	Tracer::Scope trace("ClothSystem::update_system_config");
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
+	m_cpu_solver.set_config(m_system_config);
 }
 
 void ClothSystem::update_sphere()
 {
-	Sphere s;
-	s.pos = m_sphere_scene.pos;
-	s.radius = m_sphere_scene.radius * m_scale_sphere_interaction; // make it slightly bigger for tessellation
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
+	m_cpu_solver.set_sphere({ m_sphere_scene.pos, m_sphere_scene.radius * m_scale_sphere_interaction });
+}
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Sphere), &s);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+void ClothSystem::upload_frame_data()
+{
+	assert(m_upload_ring != nullptr);
+	if (m_frame_data_generation != m_upload_ring->get_generation()) {
+		// The scene sphere, then the head
+		const std::array<Sphere, 2> spheres = { Sphere{
+			m_sphere_scene.pos,
+			m_sphere_scene.radius * m_scale_sphere_interaction // make it slightly bigger for tessellation
+			}, m_sphere_head };
+		m_config_range = m_upload_ring->upload(&m_system_config, sizeof(SpringSystemConfig));
+		m_sphere_range = m_upload_ring->upload(spheres.data(), sizeof(spheres));
+		m_frame_data_generation = m_upload_ring->get_generation();
+	}
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEM_CONFIG,
+		m_config_range.buffer, m_config_range.offset, m_config_range.size);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING_SHAPE_SPHERE,
+		m_sphere_range.buffer, m_sphere_range.offset, m_sphere_range.size);
 }
 
 void ClothSystem::set_sphere(const glm::vec3& pos, float radius)
@@ -505,16 +597,14 @@ void ClothSystem::set_sphere(const glm::vec3& pos, float radius)
 
 void ClothSystem::reset_bindings() const
 {
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEM_CONFIG, m_system_config_bo);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[0]);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[1]);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SEGMENT_INDICES, m_spring_indices_bo);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_FORCES, m_forces_buffer);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SHAPE_SPHERE, m_sphere_ssb);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ORIGINAL_LENGTHS, m_original_lengths_buffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_FIXED_POINTS, m_fixed_points_buffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLE_TO_SEGMENTS_LIST, m_particle_2_segments_list);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SEGMENTS_MAPPING_LIST, m_segments_list_buffer);
-
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COLOR_SEGMENTS, m_color_segments_buffer);
 }
 
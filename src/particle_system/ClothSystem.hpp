@@ -1,8 +1,15 @@
 #pragma once
 
 #include "graphics/ShaderProgram.hpp"
+#include "graphics/GpuProfiler.hpp"
+#include "graphics/PassGraph.hpp"
+#include "graphics/UploadRing.hpp"
+#include "graphics/StagingUpload.hpp"
 #include "spring_types.in"
 #include "intersections.comp.in"
+#include "ParticleLayout.hpp"
+#include "cpu/CpuSpringSolver.hpp"
+#include "SpringSystemData.hpp"
 
 class ClothSystem {
 public:
@@ -23,14 +30,36 @@ public:
 
 	void reset_bindings() const;
 
+	// Changing the layout rebuilds the programs and resets the simulation
+	void set_layout(ParticleLayout layout);
+	ParticleLayout get_layout() const { return m_layout; }
+
+	// Same for the accumulation of the forces of the segments solver
+	void set_force_accumulation(ForceAccumulation accumulation);
+	ForceAccumulation get_force_accumulation() const { return m_force_accumulation; }
+
+	// Times the GPU passes of update(). Can be null.
+	void set_gpu_profiler(GpuProfiler* profiler) { m_gpu_profiler = profiler; }
+	// Where the config and the interaction shapes are uploaded. Needed before updating or rendering.
+	void set_upload_ring(UploadRing* upload_ring) { m_upload_ring = upload_ring; }
+
 private:
+	ParticleLayout m_layout = ParticleLayout::eAoS;
+	GpuProfiler* m_gpu_profiler = nullptr;
+	PassGraph m_pass_graph;
 
-	spring::SpringSystemConfig m_system_config;
-	uint32_t m_system_config_bo;
+	UploadRing* m_upload_ring = nullptr;
+	// Generation of the ring of the config and shapes bound, or invalid if they changed after
+	uint64_t m_frame_data_generation = UploadRing::INVALID_GENERATION;
+	UploadRing::Range m_config_range = {};
+	UploadRing::Range m_sphere_range = {};
 
+	spring::SpringSystemConfig m_system_config;
 
 	bool m_flipflop_state = false;
-	uint32_t m_vbo_particle_buffers[2];
+	// The segments solver ping-pongs the first two buffers.
+	// The grid solver reads one pair and writes the other, see update_grid()
+	uint32_t m_vbo_particle_buffers[4];
 	uint32_t m_spring_indices_bo;
 	uint32_t m_patches_indices_bo;
 	uint32_t m_forces_buffer;
@@ -38,19 +67,30 @@ private:
 	uint32_t m_fixed_points_buffer;
 	uint32_t m_particle_2_segments_list;
 	uint32_t m_segments_list_buffer;
+	// Segments sorted by color, and where each color starts
+	uint32_t m_color_segments_buffer;
+	std::vector<uint32_t> m_color_offsets;
+	ForceAccumulation m_force_accumulation = ForceAccumulation::eGather;
 
 	ShaderProgram m_basic_draw_point;
 	ShaderProgram m_advect_particle_program;
 	ShaderProgram m_spring_force_program;
+	ShaderProgram m_advect_grid_program;
 	ShaderProgram m_tessellation_program;
 
-	uint32_t m_sphere_ssb;
 
 	uint32_t m_segment_vao;
 	uint32_t m_patches_vao;
 
 	uint32_t m_num_elements_patches = 0;
 
+	// Host data of the last reset. Kept, so resetting a cloth of the same size does not allocate.
+	SpringSystemData m_data;
+	std::vector<uint32_t> m_new_index;
+	std::vector<float> m_soa_positions;
+	std::vector<int32_t> m_patch_indices;
+	StagingUpload m_staging_upload;
+
 	Sphere m_sphere_head = { glm::vec3(3.5f, 5.0f, 3.8f), 1.0f };
 	Sphere m_sphere_scene;
 	float m_scale_sphere_interaction = 1.01f;
@@ -61,6 +101,22 @@ private:
 
 
 	bool m_use_provots = true;
+	// Morton order of the particles, except for the grid solver that needs them by rows
+	bool m_reorder_particles = true;
+
+	enum class SolverMode {
+		// One force per segment, gathered per particle through the segment mappings
+		eSegments = 0,
+		// Forces computed per particle from its grid neighbours, in a single pass
+		eGrid = 1,
+		// Backward Euler on the CPU, stable with stiff springs and large steps
+		eImplicit = 2,
+		// Segments as distance constraints, projected on the CPU by colors
+		eXPBD = 3,
+	};
+	SolverMode m_solver_mode = SolverMode::eSegments;
+	CpuSpringSolver m_cpu_solver;
+	float m_cpu_step_ms = 0.0f;
 	bool m_draw_points = true;
 	bool m_draw_lines = true;
 	bool m_intersect_sphere = true;
@@ -75,6 +131,13 @@ private:
 	glm::vec3 m_specular = glm::vec3(0.6196f, 0.6686f, 0.149f);
 	glm::vec3 m_diffuse = glm::vec3(0.4176f, 0.0235f, 0.012f);
 
+	void load_programs();
+	// Upload the config and the shapes if needed, and bind them
+	void upload_frame_data();
+	void update_segments(float dt);
+	void update_grid(float dt);
+	// Step of the CPU solver modes
+	void update_cpu(float dt);
 	void initialize_system();
 	void update_interaction_data();
 	void update_system_config();
@@ -0,0 +1,156 @@
+#include "MeshBVH.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <cfloat>
+
+namespace {
+constexpr uint32_t NUM_BINS = 16;
+
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void grow(const glm::vec3& p) {
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+	void grow(const glm::vec3& b_min, const glm::vec3& b_max) {
+		min = glm::min(min, b_min);
+		max = glm::max(max, b_max);
+	}
+	float half_area() const {
+		const glm::vec3 e = max - min;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+} // namespace
+
+void MeshBVH::build(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces)
+{
+	const uint32_t num_triangles = (uint32_t)faces.size();
+	m_nodes.clear();
+	m_depth = 0;
+	m_triangle_indices.resize(num_triangles);
+	std::iota(m_triangle_indices.begin(), m_triangle_indices.end(), 0);
+	if (num_triangles == 0) {
+		return;
+	}
+
+	m_centroids.resize(num_triangles);
+	m_tri_min.resize(num_triangles);
+	m_tri_max.resize(num_triangles);
+	for (uint32_t t = 0; t < num_triangles; ++t) {
+		const glm::vec3& v0 = vertices[faces[t].x];
+		const glm::vec3& v1 = vertices[faces[t].y];
+		const glm::vec3& v2 = vertices[faces[t].z];
+		m_tri_min[t] = glm::min(v0, glm::min(v1, v2));
+		m_tri_max[t] = glm::max(v0, glm::max(v1, v2));
+		m_centroids[t] = (v0 + v1 + v2) / 3.0f;
+	}
+
+	m_nodes.reserve(2 * num_triangles);
+	m_nodes.emplace_back();
+	build_recursive(0, 0, num_triangles, 1);
+
+	m_centroids.clear();
+	m_tri_min.clear();
+	m_tri_max.clear();
+}
+
+void MeshBVH::build_recursive(uint32_t node_idx, uint32_t first, uint32_t count, uint32_t depth)
+{
+	m_depth = std::max(m_depth, depth);
+
+	AABB bounds, centroid_bounds;
+	for (uint32_t i = first; i < first + count; ++i) {
+		const uint32_t t = m_triangle_indices[i];
+		bounds.grow(m_tri_min[t], m_tri_max[t]);
+		centroid_bounds.grow(m_centroids[t]);
+	}
+	m_nodes[node_idx].aabb_min = bounds.min;
+	m_nodes[node_idx].aabb_max = bounds.max;
+	m_nodes[node_idx].left_or_first = first;
+	m_nodes[node_idx].num_triangles = count;
+
+	// The traversal stack can not hold deeper trees
+	if (count <= 1 || depth >= BVH_MAX_DEPTH) {
+		return;
+	}
+
+	// Binned SAH
+	float best_cost = FLT_MAX;
+	int32_t best_axis = -1;
+	uint32_t best_split = 0;
+	for (int32_t axis = 0; axis < 3; ++axis) {
+		const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+		if (extent <= 0.0f) {
+			continue;
+		}
+		const float scale = (float)NUM_BINS / extent;
+
+		AABB bins[NUM_BINS];
+		uint32_t bin_counts[NUM_BINS] = {};
+		for (uint32_t i = first; i < first + count; ++i) {
+			const uint32_t t = m_triangle_indices[i];
+			const uint32_t b = std::min(NUM_BINS - 1,
+				(uint32_t)((m_centroids[t][axis] - centroid_bounds.min[axis]) * scale));
+			bin_counts[b] += 1;
+			bins[b].grow(m_tri_min[t], m_tri_max[t]);
+		}
+
+		float left_area[NUM_BINS - 1];
+		uint32_t left_count[NUM_BINS - 1];
+		AABB acc;
+		uint32_t acc_count = 0;
+		for (uint32_t b = 0; b < NUM_BINS - 1; ++b) {
+			acc.grow(bins[b].min, bins[b].max);
+			acc_count += bin_counts[b];
+			left_area[b] = acc.half_area();
+			left_count[b] = acc_count;
+		}
+
+		acc = AABB();
+		acc_count = 0;
+		for (uint32_t b = NUM_BINS - 1; b > 0; --b) {
+			acc.grow(bins[b].min, bins[b].max);
+			acc_count += bin_counts[b];
+			if (acc_count == 0 || left_count[b - 1] == 0) {
+				continue;
+			}
+			const float cost = (float)left_count[b - 1] * left_area[b - 1] + (float)acc_count * acc.half_area();
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	const float leaf_cost = (float)count * bounds.half_area();
+	if (best_axis < 0 || (best_cost >= leaf_cost && count <= MAX_LEAF_TRIANGLES)) {
+		return;
+	}
+
+	const float scale = (float)NUM_BINS / (centroid_bounds.max[best_axis] - centroid_bounds.min[best_axis]);
+	const float min_axis = centroid_bounds.min[best_axis];
+	uint32_t* mid = std::partition(
+		m_triangle_indices.data() + first,
+		m_triangle_indices.data() + first + count,
+		[&](uint32_t t) {
+			const uint32_t b = std::min(NUM_BINS - 1, (uint32_t)((m_centroids[t][best_axis] - min_axis) * scale));
+			return b < best_split;
+		});
+	const uint32_t left_count = (uint32_t)(mid - m_triangle_indices.data()) - first;
+
+	// The first child goes right after its parent
+	m_nodes[node_idx].num_triangles = 0;
+	const uint32_t left_idx = (uint32_t)m_nodes.size();
+	m_nodes.emplace_back();
+	build_recursive(left_idx, first, left_count, depth + 1);
+
+	const uint32_t right_idx = (uint32_t)m_nodes.size();
+	m_nodes.emplace_back();
+	m_nodes[node_idx].left_or_first = right_idx;
+	build_recursive(right_idx, first + left_count, count - left_count, depth + 1);
+}
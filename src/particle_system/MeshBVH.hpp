@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "intersections.comp.in"
+
+// Bounding volume hierarchy over the triangles of a collision mesh.
+// Built on the CPU with binned SAH. The node array is in depth first order and
+// can be uploaded as is to be traversed by advect_particles.comp.
+class MeshBVH {
+public:
+	MeshBVH() = default;
+
+	void build(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces);
+
+	const std::vector<BVHNode>& get_nodes() const { return m_nodes; }
+
+	// Face indices, in the order referenced by the leaves
+	const std::vector<uint32_t>& get_triangle_indices() const { return m_triangle_indices; }
+
+	uint32_t get_depth() const { return m_depth; }
+
+	bool empty() const { return m_nodes.empty(); }
+
+	static constexpr uint32_t MAX_LEAF_TRIANGLES = 4;
+
+private:
+	std::vector<BVHNode> m_nodes;
+	std::vector<uint32_t> m_triangle_indices;
+	uint32_t m_depth = 0;
+
+	// Scratch data of the build
+	std::vector<glm::vec3> m_centroids;
+	std::vector<glm::vec3> m_tri_min;
+	std::vector<glm::vec3> m_tri_max;
+
+	void build_recursive(uint32_t node_idx, uint32_t first, uint32_t count, uint32_t depth);
+};
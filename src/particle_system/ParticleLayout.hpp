@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Memory layout of the particle buffers. See particle_storage.in for the GPU side.
+enum class ParticleLayout {
+	eAoS = 0, // Arrays of Particle structs
+	eSoA = 1, // Positions as x, y and z arrays. Lifetimes go in their own buffer.
+};
+
+// Defines needed to build the programs that access the particle buffers
+inline std::vector<std::string> get_particle_layout_defines(ParticleLayout layout) {
+	if (layout == ParticleLayout::eSoA) {
+		return { "PARTICLE_LAYOUT_SOA" };
+	}
+	return {};
+}
+
+// Split the positions of particles into x, y and z arrays with a stride of particles.size()
+template<typename P>
+void positions_to_soa(const std::vector<P>& particles, std::vector<float>* out_) {
+	std::vector<float>& out = *out_;
+	const size_t stride = particles.size();
+	out.resize(3 * stride);
+	for (size_t i = 0; i < stride; ++i) {
+		out[i] = particles[i].pos.x;
+		out[stride + i] = particles[i].pos.y;
+		out[2 * stride + i] = particles[i].pos.z;
+	}
+}
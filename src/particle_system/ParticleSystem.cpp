@@ -1,32 +1,46 @@
 #include "ParticleSystem.hpp"
 
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <glad/glad.h>
 #include <imgui.h>
 #include <numeric>
+#include <chrono>
+#include <glm/gtc/type_ptr.hpp>
 
 #include "graphics/my_gl_header.hpp"
+#include "cpu/emitters.hpp"
+#include "radix_sort.in"
+#include "utils/ThreadPool.hpp"
+#include "utils/Tracer.hpp"
 
 using namespace particle;
 
+namespace {
+// Emitter of a new system, and the first one added in the UI
+Emitter default_emitter()
+{
+	Emitter emitter = {};
+	emitter.pos = glm::vec3(5.0f);
+	emitter.shape = EMITTER_POINT;
+	emitter.size = glm::vec3(1.0f);
+	emitter.particles_per_second = 10.0f;
+	emitter.mean_lifetime = 2.0f;
+	emitter.var_lifetime = 1.0f;
+	emitter.particle_speed = 5.f;
+	return emitter;
+}
+} // namespace
+
 ParticleSystem::ParticleSystem()
 {
 	const std::filesystem::path proj_dir(PROJECT_DIR);
-	const std::filesystem::path shad_dir = proj_dir / "resources/shaders";
 
 	m_ico_mesh = TriangleMesh(proj_dir / "resources/ply/icosahedron.ply");
 	m_ico_mesh.upload_to_gpu();
 
-
-	m_advect_compute_program = ShaderProgram(
-		&Shader(shad_dir / "advect_particles.comp", Shader::Type::Compute),
-		1
-	);
-
-	m_simple_spawner_program = ShaderProgram(
-		&Shader(shad_dir / "simple_spawner.comp", Shader::Type::Compute),
-		1
-	);
+	load_programs();
 
 
 	glGenVertexArrays(1, &m_ico_draw_vao);
@@ -35,10 +49,33 @@ ParticleSystem::ParticleSystem()
 	// Generate particle buffers
 	glGenBuffers(2, m_vbo_particle_buffers);
 	glGenBuffers(2, m_draw_indirect_buffers);
+	glCreateBuffers(1, &m_dispatch_indirect_buffer);
+	// The advect pass, and then the passes of the particle collisions
+	glNamedBufferStorage(m_dispatch_indirect_buffer, 6 * sizeof(uint32_t), nullptr, 0);
+	glCreateBuffers(1, &m_spawn_args_buffer);
+	glNamedBufferStorage(m_spawn_args_buffer, 4 * sizeof(uint32_t), nullptr, 0);
+	glCreateBuffers(1, &m_compaction_status_buffer);
+	glCreateBuffers(1, &m_emitters_ssb);
+	glCreateBuffers(1, &m_emitter_states_ssb);
+	// Allocated by the first sort
+	glCreateBuffers(1, &m_sort_keys);
+	glCreateBuffers(1, &m_sort_values);
+	glCreateBuffers(2, m_sorted_particle_buffers);
+	glCreateBuffers(1, &m_sorted_particle_lifetimes);
+	// Allocated by the first collisions
+	glCreateBuffers(1, &m_grid_cell_counts);
+	glCreateBuffers(1, &m_grid_cell_starts);
+	glCreateBuffers(1, &m_grid_block_sums);
+	glCreateBuffers(1, &m_grid_entries);
+	glCreateBuffers(1, &m_grid_sorted_positions);
 	glGenBuffers(2, m_alive_particle_indices);
 	glGenBuffers(1, &m_dead_particle_indices);
 	glGenBuffers(1, &m_dead_particle_count);
-	glGenBuffers(1, &m_sphere_ssb);
+	glGenBuffers(1, &m_particle_lifetimes);
+	glGenBuffers(1, &m_bvh_nodes_ssb);
+	glGenBuffers(1, &m_bvh_triangles_ssb);
+	glGenBuffers(1, &m_face_normals_ssb);
+	glCreateBuffers(1, &m_mesh_area_cdf_ssb);
 
 	for (uint32_t i = 0; i < 2; ++i) {
 		// Initialise indirect draw buffer, and bind in 3
@@ -65,29 +102,10 @@ ParticleSystem::ParticleSystem()
 	m_system_config.friction = 0.01f;
 
 
-	m_spawner_config.pos = glm::vec3(5.0f);
-	m_spawner_config.mean_lifetime = 2.0f;
-	m_spawner_config.var_lifetime = 1.0f;
-	m_spawner_config.particle_speed = 5.f;
-
-	// Generate buffer config
-	glGenBuffers(1, &m_system_config_bo);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_system_config_bo);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(ParticleSystemConfig) + sizeof(ParticleSpawnerConfig),
-		nullptr, GL_STATIC_DRAW);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEM_CONFIG, m_system_config_bo);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	set_emitters({ default_emitter() });
 
 	update_sytem_config();
 
-	// Initialize shapes
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(Sphere),
-		nullptr, GL_STATIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
 	initialize_system();
 
 
@@ -97,6 +115,17 @@ ParticleSystem::ParticleSystem()
 
 void ParticleSystem::update(float time, float dt)
 {
+	Tracer::Scope trace("ParticleSystem::update");
+	if (m_backend == Backend::eCPU) {
+		update_cpu(dt);
+		return;
+	}
+
+	upload_frame_data();
+	if (m_sort_interval != 0 && m_step_idx % m_sort_interval == 0) {
+		sort_particles();
+	}
+
 	// Bind in compute shader as bindings 1 and 2
 	// 1 is previous frame, and 2 is the next
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[m_flipflop_state]);
@@ -106,42 +135,133 @@ void ParticleSystem::update(float time, float dt)
 	
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ALIVE_LIST_IN, m_alive_particle_indices[m_flipflop_state]);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ALIVE_LIST_OUT, m_alive_particle_indices[1 - (uint32_t)m_flipflop_state]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COUNTER_ALIVE_OUT, m_draw_indirect_buffers[1 - (uint32_t)m_flipflop_state]);
+	if (m_emitters_dirty) {
+		upload_emitters();
+	}
+
+	const uint32_t in = (uint32_t)m_flipflop_state;
+	const uint32_t out = 1 - in;
 
-	// Clear the atomic counter of alive particles
+	// Clear the atomic counter of alive particles, once the last draw has read it
+	m_pass_graph.pass({ PassGraph::update(m_draw_indirect_buffers[out]) });
 	glClearNamedBufferSubData(m_draw_indirect_buffers[1 - m_flipflop_state], GL_R32F,
 		offsetof(DrawElementsIndirectCommand, primCount),
 		sizeof(uint32_t), GL_RED, GL_FLOAT, nullptr);
 
-	uint32_t num_particles_to_instantiate;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COUNTER_ALIVE_IN, m_draw_indirect_buffers[in]);
+
 	{
-		m_accum_particles_emmited += m_emmit_particles_per_second * dt;
-		float floor_part = std::floor(m_accum_particles_emmited);
-		m_accum_particles_emmited -= floor_part;
-		num_particles_to_instantiate = static_cast<uint32_t>(floor_part);
-	}
-	if (num_particles_to_instantiate != 0) {
-		m_simple_spawner_program.use_program();
-		glUniform1f(0, time);
+		GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eSpawn);
+		const uint32_t num_emitters = (uint32_t)m_emitters.size();
+		// Particles of every emitter, and the size of the spawner dispatch
+		m_pass_graph.pass({
+			PassGraph::write(m_emitter_states_ssb),
+			PassGraph::write(m_spawn_args_buffer),
+			});
+		m_emitter_counts_program.use_program();
+		glUniform1f(0, dt);
+		glUniform1ui(1, num_emitters);
+		// Same as GROUP_SIZE * PARTICLES_PER_THREAD in batch_spawner.comp
+		glUniform1ui(2, 64 * 8);
+		glDispatchCompute(1, 1, 1);
+
+		// Takes dead particles and appends them to the alive list of the current step.
+		// The counters are updated afterwards, by the pass that prepares the advect dispatch.
+		m_pass_graph.pass({
+			PassGraph::read(m_spawn_args_buffer, PassGraph::Access::eCommand),
+			PassGraph::read(m_spawn_args_buffer),
+			PassGraph::read(m_emitter_states_ssb),
+			PassGraph::write(m_vbo_particle_buffers[in]),
+			PassGraph::write(m_vbo_particle_buffers[out]),
+			PassGraph::write(m_particle_lifetimes),
+			PassGraph::write(m_alive_particle_indices[in]),
+			PassGraph::read(m_dead_particle_indices),
+			PassGraph::read(m_draw_indirect_buffers[in]),
+			PassGraph::read(m_dead_particle_count),
+			});
+		m_spawner_program.use_program();
+		glUniform1ui(0, m_step_idx);
 		glUniform1f(1, dt);
-		glUniform1ui(2, num_particles_to_instantiate);
-		glDispatchCompute(num_particles_to_instantiate / 32
-			+ (num_particles_to_instantiate % 32 == 0 ? 0 : 1), 1, 1);
-		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		glUniform1ui(2, num_emitters);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_spawn_args_buffer);
+		glDispatchComputeIndirect(0);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
 	}
 	// Start compute shader
-	m_advect_compute_program.use_program();
-	glUniform1f(0, dt);
-	glDispatchCompute(m_system_config.max_particles / 32
-		+ (m_system_config.max_particles % 32 == 0 ? 0 : 1)
-		, 1, 1);
+	{
+		GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eAdvect);
+		// Same as GROUP_SIZE in advect_particles.comp
+		const uint32_t group_size = m_compaction == Compaction::eWorkgroupScan ? 256 : 32;
+
+		// Commits the spawned particles to the counters. Then, only the particles alive
+		// are advected, not the whole budget of max_particles
+		m_pass_graph.pass({
+			PassGraph::read(m_spawn_args_buffer),
+			PassGraph::write(m_draw_indirect_buffers[in]),
+			PassGraph::write(m_dead_particle_count),
+			PassGraph::write(m_dispatch_indirect_buffer),
+			});
+		m_prepare_dispatch_program.use_program();
+		glUniform1ui(0, group_size);
+		// Same as GROUP_SIZE in the shaders of the particle collisions
+		glUniform1ui(1, 256);
+		glDispatchCompute(1, 1, 1);
+
+		if (m_compaction == Compaction::eWorkgroupScan) {
+			// The look-back of the last step may still read it
+			m_pass_graph.pass({ PassGraph::update(m_compaction_status_buffer) });
+			glClearNamedBufferData(m_compaction_status_buffer, GL_R32F, GL_RED, GL_FLOAT, nullptr);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COMPACTION_STATUS, m_compaction_status_buffer);
+		}
+		// The workgroup scan adds to the counters out and dead as storage blocks, and the
+		// dead one was just written as such. The count in is always an atomic counter.
+		const PassGraph::Access counters_access = m_compaction == Compaction::eWorkgroupScan
+			? PassGraph::Access::eStorage : PassGraph::Access::eAtomicCounter;
+		m_pass_graph.pass({
+			PassGraph::read(m_dispatch_indirect_buffer, PassGraph::Access::eCommand),
+			PassGraph::write(m_vbo_particle_buffers[in]),
+			PassGraph::write(m_vbo_particle_buffers[out]),
+			PassGraph::write(m_particle_lifetimes),
+			PassGraph::write(m_alive_particle_indices[in]),
+			PassGraph::write(m_alive_particle_indices[out]),
+			PassGraph::write(m_dead_particle_indices),
+			PassGraph::write(m_draw_indirect_buffers[in], PassGraph::Access::eAtomicCounter),
+			PassGraph::write(m_draw_indirect_buffers[out], counters_access),
+			PassGraph::write(m_dead_particle_count, counters_access),
+			PassGraph::write(m_compaction_status_buffer),
+			});
+		m_advect_compute_program.use_program();
+		glUniform1f(0, dt);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_dispatch_indirect_buffer);
+		glDispatchComputeIndirect(0);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	}
+
+	if (m_particle_collisions) {
+		collide_particles();
+	}
 
 	// flip state
 	m_flipflop_state = !m_flipflop_state;
+	m_step_idx += 1;
 }
 
-void ParticleSystem::gl_render_particles() const
+void ParticleSystem::gl_render_particles(const glm::mat4& proj_view)
 {
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	// The draw command reads the alive counter, and the vertex shader the positions
+	m_pass_graph.pass({
+		PassGraph::read(m_vbo_particle_buffers[0]),
+		PassGraph::read(m_vbo_particle_buffers[1]),
+		PassGraph::read(m_particle_lifetimes),
+		PassGraph::read(m_alive_particle_indices[0]),
+		PassGraph::read(m_alive_particle_indices[1]),
+		PassGraph::read(m_draw_indirect_buffers[m_flipflop_state], PassGraph::Access::eCommand),
+		});
+	upload_frame_data();
+
+	m_draw_program.use_program();
+	glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(proj_view));
 
 	glBindVertexArray(m_ico_draw_vao);
 
@@ -164,6 +284,34 @@ void ParticleSystem::imgui_draw()
 
 	ImGui::PushID("Particlesystem");
 	ImGui::Text("Particle System Config");
+	Backend backend = m_backend;
+	if (ImGui::Combo("Backend", (int*)&backend, "GPU\0CPU\0")) {
+		set_backend(backend);
+	}
+	if (m_backend == Backend::eCPU) {
+		ImGui::Text("CPU step %.3f ms, %u threads", m_cpu_step_ms, ThreadPool::global().get_num_threads());
+	}
+	uint32_t num_barriers, num_passes;
+	m_pass_graph.get_stats(&num_barriers, &num_passes);
+	ImGui::Text("Barriers %u / passes %u", num_barriers, num_passes);
+	ParticleLayout layout = m_layout;
+	if (ImGui::Combo("Layout", (int*)&layout, "Array of structs\0Struct of arrays\0")) {
+		set_layout(layout);
+	}
+	if (m_backend == Backend::eGPU) {
+		Compaction compaction = m_compaction;
+		if (ImGui::Combo("Compaction", (int*)&compaction, "Atomic per particle\0Workgroup scan\0")) {
+			set_compaction(compaction);
+		}
+		ImGui::InputScalar("Sort interval", ImGuiDataType_U32, &m_sort_interval);
+		if (ImGui::IsItemHovered()) {
+			ImGui::SetTooltip("Steps between sorts of the particles by cell. 0 never sorts.");
+		}
+		ImGui::Checkbox("Particle collisions", &m_particle_collisions);
+		if (m_particle_collisions) {
+			ImGui::DragFloat("Collision relaxation", &m_collision_relaxation, 0.01f, 0.0f, 1.0f);
+		}
+	}
 	update |= ImGui::DragFloat("Gravity", &m_system_config.gravity, 0.01f);
 	update |= ImGui::DragFloat("Particle size", &m_system_config.particle_size, 0.01f, 0.0f, 2.0f);
 	update |= ImGui::InputFloat("Simulation space size", &m_system_config.simulation_space_size, 0.1f);
@@ -172,17 +320,48 @@ void ParticleSystem::imgui_draw()
 	update |= ImGui::InputFloat("Friction", &m_system_config.friction, 0.01f);
 
 	ImGui::Separator();
-	if (ImGui::TreeNode("Spawner Config")) {
-		ImGui::DragFloat("Particles/Second", &m_emmit_particles_per_second, 1.0f, 10.0f);
-
-
-		update |= ImGui::DragFloat3("Position", &m_spawner_config.pos.x, 0.01f);
-		
-		update |= ImGui::DragFloat("Initial Velocity", &m_spawner_config.particle_speed, 0.02f, 0.0f, FLT_MAX);
-
-		update |= ImGui::DragFloat("Mean lifetime", &m_spawner_config.mean_lifetime, 0.2f, 0.0f, FLT_MAX);
-		update |= ImGui::DragFloat("Var lifetime", &m_spawner_config.var_lifetime, 0.2f, 0.0f, FLT_MAX);
-
+	if (ImGui::TreeNode("Emitters")) {
+		std::vector<Emitter> emitters = m_emitters;
+		bool update_emitters = false;
+		int32_t remove_idx = -1;
+		for (uint32_t i = 0; i < (uint32_t)emitters.size(); ++i) {
+			Emitter& e = emitters[i];
+			ImGui::PushID(i);
+			if (ImGui::TreeNode("Emitter", "Emitter %u", i)) {
+				update_emitters |= ImGui::Combo("Shape", (int*)&e.shape, "Point\0Sphere\0Box\0Mesh\0Disc\0");
+				update_emitters |= ImGui::DragFloat("Particles/Second", &e.particles_per_second, 1.0f, 0.0f, FLT_MAX);
+				if (e.shape != EMITTER_MESH) {
+					update_emitters |= ImGui::DragFloat3("Position", &e.pos.x, 0.01f);
+				}
+				if (e.shape == EMITTER_BOX) {
+					update_emitters |= ImGui::DragFloat3("Half extents", &e.size.x, 0.01f, 0.0f, FLT_MAX);
+				}
+				else if (e.shape != EMITTER_MESH) {
+					update_emitters |= ImGui::DragFloat("Radius", &e.size.x, 0.01f, 0.0f, FLT_MAX);
+				}
+
+				update_emitters |= ImGui::DragFloat("Initial Velocity", &e.particle_speed, 0.02f, 0.0f, FLT_MAX);
+
+				update_emitters |= ImGui::DragFloat("Mean lifetime", &e.mean_lifetime, 0.2f, 0.0f, FLT_MAX);
+				update_emitters |= ImGui::DragFloat("Var lifetime", &e.var_lifetime, 0.2f, 0.0f, FLT_MAX);
+				if (ImGui::Button("Remove")) {
+					remove_idx = (int32_t)i;
+				}
+				ImGui::TreePop();
+			}
+			ImGui::PopID();
+		}
+		if (ImGui::Button("Add emitter")) {
+			emitters.push_back(emitters.empty() ? default_emitter() : emitters.back());
+			update_emitters = true;
+		}
+		if (remove_idx >= 0) {
+			emitters.erase(emitters.begin() + remove_idx);
+			update_emitters = true;
+		}
+		if (update_emitters) {
+			set_emitters(emitters);
+		}
 
 		ImGui::TreePop();
 	}
@@ -214,10 +393,8 @@ void ParticleSystem::set_sphere(const glm::vec3& pos, float radius)
 {
 	m_sphere.pos = pos;
 	m_sphere.radius = radius;
-
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Sphere), &m_sphere);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	m_cpu_solver.set_sphere(m_sphere);
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
 }
 
 void ParticleSystem::remove_sphere()
@@ -231,46 +408,198 @@ void ParticleSystem::set_mesh(const TriangleMesh& mesh, const glm::mat4& transfo
 	m_intersect_mesh = TriangleMesh(mesh);
 	m_intersect_mesh.apply_transform(transform);
 	m_intersect_mesh.upload_to_gpu();
+	m_cpu_solver.set_mesh(m_intersect_mesh.get_vertices(), m_intersect_mesh.get_faces());
+
+	// Upload the acceleration structure
+	m_mesh_bvh.build(m_intersect_mesh.get_vertices(), m_intersect_mesh.get_faces());
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bvh_nodes_ssb);
+	glBufferData(GL_SHADER_STORAGE_BUFFER,
+		m_mesh_bvh.get_nodes().size() * sizeof(BVHNode),
+		m_mesh_bvh.get_nodes().data(), GL_STATIC_DRAW);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bvh_triangles_ssb);
+	glBufferData(GL_SHADER_STORAGE_BUFFER,
+		m_mesh_bvh.get_triangle_indices().size() * sizeof(uint32_t),
+		m_mesh_bvh.get_triangle_indices().data(), GL_STATIC_DRAW);
+
+	// std430 arrays of vec3 have a stride of 16 bytes
+	const std::vector<glm::vec3>& face_normals = m_intersect_mesh.get_face_normals();
+	std::vector<glm::vec4> face_normals_padded(face_normals.size());
+	for (size_t i = 0; i < face_normals.size(); ++i) {
+		face_normals_padded[i] = glm::vec4(face_normals[i], 0.0f);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_face_normals_ssb);
+	glBufferData(GL_SHADER_STORAGE_BUFFER,
+		face_normals_padded.size() * sizeof(glm::vec4),
+		face_normals_padded.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_VERTICES, m_intersect_mesh.get_vbo_vertices());
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_INDICES, m_intersect_mesh.get_vbo_indices());
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_NORMALS, m_intersect_mesh.get_vbo_normals());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_BVH_NODES, m_bvh_nodes_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_BVH_TRIANGLES, m_bvh_triangles_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_FACE_NORMALS, m_face_normals_ssb);
+
+	// Triangles of the mesh emitters, by area
+	std::vector<float> area_cdf;
+	cpu::build_area_cdf(m_intersect_mesh.get_vertices(), m_intersect_mesh.get_faces(), &area_cdf);
+	glNamedBufferData(m_mesh_area_cdf_ssb, area_cdf.size() * sizeof(float), area_cdf.data(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_AREA_CDF, m_mesh_area_cdf_ssb);
+}
 
+void ParticleSystem::set_emitters(const std::vector<Emitter>& emitters)
+{
+	m_emitters = emitters;
+	m_emitters_dirty = true;
+	m_cpu_solver.set_emitters(m_emitters);
 }
 
-void ParticleSystem::reset_bindings() const
+void ParticleSystem::set_backend(Backend backend)
 {
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEM_CONFIG, m_system_config_bo);
+	m_backend = backend;
+	initialize_system();
+}
+
+void ParticleSystem::set_compaction(Compaction compaction)
+{
+	m_compaction = compaction;
+	load_programs();
+	// Uniforms of the new programs
+	update_intersection_sphere();
+	update_intersection_mesh();
+}
 
+void ParticleSystem::set_layout(ParticleLayout layout)
+{
+	m_layout = layout;
+	load_programs();
+	initialize_system();
+	update_intersection_sphere();
+	update_intersection_mesh();
+}
+
+void ParticleSystem::reset_bindings() const
+{
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_VERTICES, m_intersect_mesh.get_vbo_vertices());
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_INDICES, m_intersect_mesh.get_vbo_indices());
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_NORMALS, m_intersect_mesh.get_vbo_normals());
-
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SHAPE_SPHERE, m_sphere_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_BVH_NODES, m_bvh_nodes_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_BVH_TRIANGLES, m_bvh_triangles_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_FACE_NORMALS, m_face_normals_ssb);
 
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_DEAD_LIST, m_dead_particle_indices);
 	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, BINDING_ATOMIC_DEAD, m_dead_particle_count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COUNTER_DEAD, m_dead_particle_count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_DISPATCH_INDIRECT, m_dispatch_indirect_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLE_LIFETIMES, m_particle_lifetimes);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_MESH_AREA_CDF, m_mesh_area_cdf_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_EMITTERS, m_emitters_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_EMITTER_STATES, m_emitter_states_ssb);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SPAWN_ARGS, m_spawn_args_buffer);
 
 
 }
 
+void ParticleSystem::load_programs()
+{
+	const std::filesystem::path shad_dir = std::filesystem::path(PROJECT_DIR) / "resources/shaders";
+	const std::vector<std::string> defines = get_particle_layout_defines(m_layout);
+	std::vector<std::string> advect_defines = defines;
+	if (m_compaction == Compaction::eWorkgroupScan) {
+		advect_defines.push_back("COMPACTION_WORKGROUP_SCAN");
+	}
+
+	std::array<Shader, 2> draw_shaders = {
+		Shader((shad_dir / "simpl.vert"), Shader::Type::Vertex, defines),
+		Shader((shad_dir / "simpl.frag"), Shader::Type::Fragment)
+	};
+	m_draw_program = ShaderProgram(draw_shaders.data(), (uint32_t)draw_shaders.size());
+
+	m_advect_compute_program = ShaderProgram(
+		&Shader(shad_dir / "advect_particles.comp", Shader::Type::Compute, advect_defines),
+		1
+	);
+
+	m_emitter_counts_program = ShaderProgram(
+		&Shader(shad_dir / "emitter_counts.comp", Shader::Type::Compute),
+		1
+	);
+
+	m_spawner_program = ShaderProgram(
+		&Shader(shad_dir / "batch_spawner.comp", Shader::Type::Compute, defines),
+		1
+	);
+
+	m_prepare_dispatch_program = ShaderProgram(
+		&Shader(shad_dir / "prepare_advect_dispatch.comp", Shader::Type::Compute),
+		1
+	);
+
+	m_morton_keys_program = ShaderProgram(
+		&Shader(shad_dir / "morton_keys.comp", Shader::Type::Compute, defines),
+		1
+	);
+
+	m_reorder_program = ShaderProgram(
+		&Shader(shad_dir / "reorder_particles.comp", Shader::Type::Compute, defines),
+		1
+	);
+
+	m_grid_count_program = ShaderProgram(
+		&Shader(shad_dir / "grid_count.comp", Shader::Type::Compute, defines),
+		1
+	);
+	const char* grid_scan_stages[3] = { "GRID_SCAN_BLOCKS", "GRID_SCAN_BLOCK_SUMS", "GRID_SCAN_ADD" };
+	for (uint32_t i = 0; i < 3; ++i) {
+		m_grid_scan_programs[i] = ShaderProgram(
+			&Shader(shad_dir / "grid_scan.comp", Shader::Type::Compute, { grid_scan_stages[i] }),
+			1
+		);
+	}
+	m_grid_scatter_program = ShaderProgram(
+		&Shader(shad_dir / "grid_scatter.comp", Shader::Type::Compute, defines),
+		1
+	);
+	m_particle_collisions_program = ShaderProgram(
+		&Shader(shad_dir / "particle_collisions.comp", Shader::Type::Compute, defines),
+		1
+	);
+}
+
 void ParticleSystem::initialize_system()
 {
-	// TODO
-	m_accum_particles_emmited = 1.0f;
+	Tracer::Scope trace("ParticleSystem::initialize_system");
+	if (m_backend == Backend::eCPU) {
+		m_cpu_solver.initialize(m_system_config, m_layout);
+	}
+
+	// The buffers are reallocated and rewritten below
+	m_pass_graph.flush();
+
+	// The emitters start again with no fraction of particle
+	if (m_max_emitters_in_buffers != 0) {
+		glClearNamedBufferData(m_emitter_states_ssb, GL_R32F, GL_RED, GL_FLOAT, nullptr);
+	}
 
 	m_flipflop_state = false;
+	m_step_idx = 0;
 	std::vector<Particle> particles(m_system_config.max_particles, { glm::vec3(5.0f) });
 	for (uint32_t i = 0; i < m_system_config.max_particles; ++i) {
 		particles[i].pos.x += (float)i;
 		particles[i].pos.y += (float)(i) * 0.2f;
 	}
 
-	if (m_max_particles_in_buffers < m_system_config.max_particles) {
+	// In the SoA layout the shaders take the stride of the positions from the size of the buffer
+	const bool soa = m_layout == ParticleLayout::eSoA;
+	if (m_max_particles_in_buffers < m_system_config.max_particles || m_layout_in_buffers != m_layout
+		|| (soa && m_max_particles_in_buffers != m_system_config.max_particles)) {
+		const size_t particle_size = soa ? 3 * sizeof(float) : sizeof(Particle);
 		for (uint32_t i = 0; i < 2; ++i) {
 			// Reserve particle data
 			glBindBuffer(GL_ARRAY_BUFFER, m_vbo_particle_buffers[i]);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * m_system_config.max_particles,
+			glBufferData(GL_ARRAY_BUFFER, particle_size * m_system_config.max_particles,
 				nullptr, GL_DYNAMIC_DRAW);
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
 			// Reserve particle indices
@@ -285,7 +614,19 @@ void ParticleSystem::initialize_system()
 		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * m_system_config.max_particles,
 			nullptr, GL_DYNAMIC_DRAW);
 
+		// Lifetimes do not go with the positions
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_particle_lifetimes);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, soa ? sizeof(float) * m_system_config.max_particles : sizeof(float),
+			nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		// Counter of started workgroups, and the status of each of them
+		// Same as GROUP_SIZE in advect_particles.comp with Compaction::eWorkgroupScan
+		const uint32_t max_groups = (m_system_config.max_particles + 255) / 256;
+		glNamedBufferData(m_compaction_status_buffer, sizeof(uint32_t) * (1 + max_groups), nullptr, GL_DYNAMIC_DRAW);
+
 		m_max_particles_in_buffers = m_system_config.max_particles;
+		m_layout_in_buffers = m_layout;
 	}
 
 	// Initialize dead particles (all)
@@ -326,24 +667,236 @@ void ParticleSystem::initialize_system()
 
 void ParticleSystem::update_sytem_config()
 {
-	glNamedBufferSubData(
-		m_system_config_bo, // buffer name
-		0, // offset
-		sizeof(ParticleSystemConfig),	// size
-		&m_system_config	// data
-	);
-	
-	glNamedBufferSubData(
-		m_system_config_bo, // buffer name
-		sizeof(ParticleSystemConfig), // offset
-		sizeof(ParticleSpawnerConfig),	// size
-		&m_spawner_config	// data
-	);
+	Tracer::Scope trace("ParticleSystem::update_sytem_config");
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
+	m_cpu_solver.set_config(m_system_config);
+}
+
+void ParticleSystem::upload_emitters()
+{
+	const uint32_t num_emitters = (uint32_t)m_emitters.size();
+	// The last steps may still read the emitters and write their states
+	m_pass_graph.pass({
+		PassGraph::update(m_emitters_ssb),
+		PassGraph::update(m_emitter_states_ssb),
+		});
+	if (m_max_emitters_in_buffers < num_emitters) {
+		// Grow geometrically, the UI adds the emitters one by one
+		m_max_emitters_in_buffers = std::max(num_emitters, 2 * m_max_emitters_in_buffers);
+		glNamedBufferData(m_emitters_ssb, sizeof(Emitter) * m_max_emitters_in_buffers, nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferData(m_emitter_states_ssb, sizeof(EmitterState) * m_max_emitters_in_buffers, nullptr, GL_DYNAMIC_DRAW);
+		m_num_emitters_in_buffers = 0;
+	}
+	// Same as CpuParticleSolver::set_emitters
+	if (num_emitters != m_num_emitters_in_buffers) {
+		glClearNamedBufferData(m_emitter_states_ssb, GL_R32F, GL_RED, GL_FLOAT, nullptr);
+	}
+	glNamedBufferSubData(m_emitters_ssb, 0, sizeof(Emitter) * num_emitters, m_emitters.data());
+	m_num_emitters_in_buffers = num_emitters;
+	m_emitters_dirty = false;
+}
+
+void ParticleSystem::sort_particles()
+{
+	Tracer::Scope trace("ParticleSystem::sort_particles");
+	GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eSort);
+	const uint32_t in = (uint32_t)m_flipflop_state;
+	const uint32_t out = 1 - in;
+
+	// Same sizes as the particle buffers, which they replace
+	if (m_max_particles_in_sort_buffers != m_max_particles_in_buffers
+		|| m_layout_in_sort_buffers != m_layout_in_buffers) {
+		const bool soa = m_layout_in_buffers == ParticleLayout::eSoA;
+		const size_t particle_size = soa ? 3 * sizeof(float) : sizeof(Particle);
+		for (uint32_t i = 0; i < 2; ++i) {
+			glNamedBufferData(m_sorted_particle_buffers[i], particle_size * m_max_particles_in_buffers,
+				nullptr, GL_DYNAMIC_DRAW);
+		}
+		glNamedBufferData(m_sorted_particle_lifetimes, soa ? sizeof(float) * m_max_particles_in_buffers : sizeof(float),
+			nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferData(m_sort_keys, sizeof(uint32_t) * m_max_particles_in_buffers, nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferData(m_sort_values, sizeof(uint32_t) * m_max_particles_in_buffers, nullptr, GL_DYNAMIC_DRAW);
+		m_max_particles_in_sort_buffers = m_max_particles_in_buffers;
+		m_layout_in_sort_buffers = m_layout_in_buffers;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[in]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[out]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_SORTED_IN, m_sorted_particle_buffers[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_SORTED_OUT, m_sorted_particle_buffers[1]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLE_LIFETIMES_SORTED, m_sorted_particle_lifetimes);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ALIVE_LIST_IN, m_alive_particle_indices[in]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COUNTER_ALIVE_IN, m_draw_indirect_buffers[in]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_KEYS_IN, m_sort_keys);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_RADIX_VALUES_IN, m_sort_values);
+
+	// Same as GROUP_SIZE in morton_keys.comp and reorder_particles.comp
+	const uint32_t num_groups = (m_system_config.max_particles + 255) / 256;
+
+	// Cell of each alive particle, and its index
+	m_pass_graph.pass({
+		PassGraph::read(m_vbo_particle_buffers[in]),
+		PassGraph::read(m_alive_particle_indices[in]),
+		PassGraph::read(m_draw_indirect_buffers[in]),
+		PassGraph::write(m_sort_keys),
+		PassGraph::write(m_sort_values),
+		});
+	m_morton_keys_program.use_program();
+	glDispatchCompute(num_groups, 1, 1);
+
+	// As many as the instance count of the draw command
+	m_radix_sort.sort(&m_pass_graph, m_sort_keys, m_sort_values, m_draw_indirect_buffers[in],
+		offsetof(DrawElementsIndirectCommand, primCount) / sizeof(uint32_t), m_system_config.max_particles);
+
+	m_pass_graph.pass({
+		PassGraph::read(m_sort_values),
+		PassGraph::read(m_draw_indirect_buffers[in]),
+		PassGraph::read(m_vbo_particle_buffers[in]),
+		PassGraph::read(m_vbo_particle_buffers[out]),
+		PassGraph::read(m_particle_lifetimes),
+		PassGraph::write(m_sorted_particle_buffers[0]),
+		PassGraph::write(m_sorted_particle_buffers[1]),
+		PassGraph::write(m_sorted_particle_lifetimes),
+		PassGraph::write(m_alive_particle_indices[in]),
+		PassGraph::write(m_dead_particle_indices),
+		});
+	m_reorder_program.use_program();
+	glDispatchCompute(num_groups, 1, 1);
+
+	// The sorted copies become the particle buffers
+	std::swap(m_vbo_particle_buffers[in], m_sorted_particle_buffers[0]);
+	std::swap(m_vbo_particle_buffers[out], m_sorted_particle_buffers[1]);
+	if (m_layout == ParticleLayout::eSoA) {
+		std::swap(m_particle_lifetimes, m_sorted_particle_lifetimes);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLE_LIFETIMES, m_particle_lifetimes);
+	}
+}
+
+void ParticleSystem::collide_particles()
+{
+	Tracer::Scope trace("ParticleSystem::collide_particles");
+	GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eCollide);
+	// The positions of the step are in the out buffers
+	const uint32_t out = 1 - (uint32_t)m_flipflop_state;
+
+	// Cells as wide as a particle, but not so many that clearing and scanning them costs more than the particles
+	const float space_size = m_system_config.simulation_space_size;
+	const float cell_size = std::max(2.0f * m_system_config.particle_size, space_size / (float)MAX_GRID_DIMS);
+	const uint32_t grid_dims = std::max((uint32_t)std::ceil(space_size / cell_size), 1u);
+	const uint32_t num_cells = grid_dims * grid_dims * grid_dims;
+	// Same as CELLS_PER_BLOCK in grid_scan.comp
+	const uint32_t num_blocks = (num_cells + 1023) / 1024;
+
+	if (m_max_cells_in_grid_buffers < num_cells) {
+		glNamedBufferData(m_grid_cell_counts, sizeof(uint32_t) * num_cells, nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferData(m_grid_cell_starts, sizeof(uint32_t) * num_cells, nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferData(m_grid_block_sums, sizeof(uint32_t) * num_blocks, nullptr, GL_DYNAMIC_DRAW);
+		m_max_cells_in_grid_buffers = num_cells;
+	}
+	if (m_max_particles_in_grid_buffers < m_system_config.max_particles) {
+		glNamedBufferData(m_grid_entries, 2 * sizeof(uint32_t) * m_system_config.max_particles, nullptr, GL_DYNAMIC_DRAW);
+		// A GridParticle in particle_grid.in, the index goes in the padding of the position
+		glNamedBufferData(m_grid_sorted_positions, 4 * sizeof(uint32_t) * m_system_config.max_particles, nullptr, GL_DYNAMIC_DRAW);
+		m_max_particles_in_grid_buffers = m_system_config.max_particles;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_GRID_CELL_COUNTS, m_grid_cell_counts);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_GRID_CELL_STARTS, m_grid_cell_starts);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_GRID_BLOCK_SUMS, m_grid_block_sums);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_GRID_ENTRIES, m_grid_entries);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_GRID_SORTED_POSITIONS, m_grid_sorted_positions);
+	// The second set of arguments of the buffer is sized for the passes over the alive particles
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_dispatch_indirect_buffer);
+	const GLintptr grid_dispatch_offset = 3 * sizeof(uint32_t);
+
+	m_pass_graph.pass({ PassGraph::update(m_grid_cell_counts) });
+	glClearNamedBufferData(m_grid_cell_counts, GL_R32F, GL_RED, GL_FLOAT, nullptr);
+
+	m_pass_graph.pass({
+		PassGraph::read(m_dispatch_indirect_buffer, PassGraph::Access::eCommand),
+		PassGraph::read(m_vbo_particle_buffers[out]),
+		PassGraph::read(m_alive_particle_indices[out]),
+		PassGraph::read(m_draw_indirect_buffers[out]),
+		PassGraph::write(m_grid_cell_counts),
+		PassGraph::write(m_grid_entries),
+		});
+	m_grid_count_program.use_program();
+	glUniform1f(0, cell_size);
+	glUniform1ui(1, grid_dims);
+	glDispatchComputeIndirect(grid_dispatch_offset);
+
+	// Start of each cell
+	m_pass_graph.pass({
+		PassGraph::read(m_grid_cell_counts),
+		PassGraph::write(m_grid_cell_starts),
+		PassGraph::write(m_grid_block_sums),
+		});
+	m_grid_scan_programs[0].use_program();
+	glUniform1ui(0, num_cells);
+	glDispatchCompute(num_blocks, 1, 1);
+
+	m_pass_graph.pass({ PassGraph::write(m_grid_block_sums) });
+	m_grid_scan_programs[1].use_program();
+	glUniform1ui(0, num_cells);
+	glDispatchCompute(1, 1, 1);
+
+	m_pass_graph.pass({
+		PassGraph::read(m_grid_block_sums),
+		PassGraph::write(m_grid_cell_starts),
+		});
+	m_grid_scan_programs[2].use_program();
+	glUniform1ui(0, num_cells);
+	glDispatchCompute(num_blocks, 1, 1);
+
+	m_pass_graph.pass({
+		PassGraph::read(m_dispatch_indirect_buffer, PassGraph::Access::eCommand),
+		PassGraph::read(m_vbo_particle_buffers[out]),
+		PassGraph::read(m_alive_particle_indices[out]),
+		PassGraph::read(m_draw_indirect_buffers[out]),
+		PassGraph::read(m_grid_entries),
+		PassGraph::read(m_grid_cell_starts),
+		PassGraph::write(m_grid_sorted_positions),
+		});
+	m_grid_scatter_program.use_program();
+	glUniform1f(0, cell_size);
+	glUniform1ui(1, grid_dims);
+	glDispatchComputeIndirect(grid_dispatch_offset);
+
+	m_pass_graph.pass({
+		PassGraph::read(m_dispatch_indirect_buffer, PassGraph::Access::eCommand),
+		PassGraph::read(m_draw_indirect_buffers[out]),
+		PassGraph::read(m_grid_cell_counts),
+		PassGraph::read(m_grid_cell_starts),
+		PassGraph::read(m_grid_sorted_positions),
+		PassGraph::write(m_vbo_particle_buffers[out]),
+		});
+	m_particle_collisions_program.use_program();
+	glUniform1f(0, cell_size);
+	glUniform1ui(1, grid_dims);
+	glUniform1f(2, m_collision_relaxation);
+	glDispatchComputeIndirect(grid_dispatch_offset);
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
 
+void ParticleSystem::upload_frame_data()
+{
+	assert(m_upload_ring != nullptr);
+	if (m_frame_data_generation != m_upload_ring->get_generation()) {
+		m_config_range = m_upload_ring->upload(&m_system_config, sizeof(ParticleSystemConfig));
+		m_sphere_range = m_upload_ring->upload(&m_sphere, sizeof(Sphere));
+		m_frame_data_generation = m_upload_ring->get_generation();
+	}
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEM_CONFIG,
+		m_config_range.buffer, m_config_range.offset, m_config_range.size);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING_SHAPE_SPHERE,
+		m_sphere_range.buffer, m_sphere_range.offset, m_sphere_range.size);
 }
 
 void ParticleSystem::update_intersection_sphere()
 {
+	m_cpu_solver.set_intersect_sphere(m_intersect_sphere_enabled);
+
 	m_advect_compute_program.use_program();
 	if (m_intersect_sphere_enabled) {
 		glUniform1ui(1, 1);
@@ -356,6 +909,8 @@ void ParticleSystem::update_intersection_sphere()
 
 void ParticleSystem::update_intersection_mesh()
 {
+	m_cpu_solver.set_intersect_mesh(m_intersect_mesh_enabled);
+
 	m_advect_compute_program.use_program();
 	if (m_intersect_mesh_enabled) {
 		glUniform1ui(2, 1);
@@ -365,3 +920,48 @@ void ParticleSystem::update_intersection_mesh()
 	}
 	glUseProgram(0);
 }
+
+void ParticleSystem::update_cpu(float dt)
+{
+	Tracer::Scope trace("ParticleSystem::update_cpu");
+	const auto start = std::chrono::steady_clock::now();
+	m_cpu_solver.step(dt);
+	m_cpu_step_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Upload the result to the buffers that the GPU path would have written,
+	// so drawing does not need to know which backend is running
+	const uint32_t out = 1 - (uint32_t)m_flipflop_state;
+	const uint32_t num_alive = m_cpu_solver.get_num_alive();
+	// The GPU path may have run before the switch of backend
+	m_pass_graph.pass({
+		PassGraph::update(m_vbo_particle_buffers[out]),
+		PassGraph::update(m_particle_lifetimes),
+		PassGraph::update(m_alive_particle_indices[out]),
+		PassGraph::update(m_draw_indirect_buffers[out]),
+		});
+	if (m_layout == ParticleLayout::eAoS) {
+		glNamedBufferSubData(m_vbo_particle_buffers[out],
+			0, sizeof(Particle) * m_cpu_solver.get_particles().size(),
+			m_cpu_solver.get_particles().data());
+	}
+	else {
+		glNamedBufferSubData(m_vbo_particle_buffers[out],
+			0, sizeof(float) * m_cpu_solver.get_positions().size(),
+			m_cpu_solver.get_positions().data());
+		glNamedBufferSubData(m_particle_lifetimes,
+			0, sizeof(float) * m_cpu_solver.get_lifetimes().size(),
+			m_cpu_solver.get_lifetimes().data());
+	}
+	glNamedBufferSubData(m_alive_particle_indices[out],
+		0, sizeof(uint32_t) * num_alive,
+		m_cpu_solver.get_alive_indices().data());
+	glNamedBufferSubData(m_draw_indirect_buffers[out],
+		offsetof(DrawElementsIndirectCommand, primCount), sizeof(uint32_t),
+		&num_alive);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[out]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ALIVE_LIST_OUT, m_alive_particle_indices[out]);
+
+	// flip state
+	m_flipflop_state = !m_flipflop_state;
+}
@@ -1,9 +1,16 @@
 #pragma once
 
 #include "graphics/ShaderProgram.hpp"
+#include "graphics/GpuProfiler.hpp"
+#include "graphics/GpuRadixSort.hpp"
+#include "graphics/PassGraph.hpp"
+#include "graphics/UploadRing.hpp"
 #include "graphics/TriangleMesh.hpp"
+#include "MeshBVH.hpp"
+#include "ParticleLayout.hpp"
 #include "particle_types.in"
 #include "intersections.comp.in"
+#include "cpu/CpuParticleSolver.hpp"
 #include <memory>
 
 
@@ -17,7 +24,7 @@ public:
 
 	void update(float time, float dt);
 
-	void gl_render_particles() const;
+	void gl_render_particles(const glm::mat4& proj_view);
 
 	void imgui_draw();
 
@@ -26,41 +33,159 @@ public:
 
 	void set_mesh(const TriangleMesh& mesh, const glm::mat4& transform);
 
+	// All the emitters are spawned by a single dispatch. The emitters keep
+	// the fraction of particle they carry, unless their number changes.
+	void set_emitters(const std::vector<particle::Emitter>& emitters);
+	const std::vector<particle::Emitter>& get_emitters() const { return m_emitters; }
+
 	void reset_bindings() const;
 
 	float get_simulation_space_size() const { return m_system_config.simulation_space_size;  }
 
+	enum class Backend {
+		eGPU = 0,
+		eCPU = 1,
+	};
+
+	// Changing the backend resets the simulation
+	void set_backend(Backend backend);
+	Backend get_backend() const { return m_backend; }
+
+	// Changing the layout rebuilds the programs and resets the simulation
+	void set_layout(ParticleLayout layout);
+	ParticleLayout get_layout() const { return m_layout; }
+
+	// How the advect pass appends the particles to the alive and dead lists
+	enum class Compaction {
+		// One atomic per particle
+		eAtomic = 0,
+		// A prefix sum per workgroup, and one atomic per workgroup and list
+		eWorkgroupScan = 1,
+	};
+
+	// Changing the compaction rebuilds the programs
+	void set_compaction(Compaction compaction);
+	Compaction get_compaction() const { return m_compaction; }
+
+	// Every sort_interval GPU steps, the particles are sorted by the Morton code of their cell
+	// and moved so that the alive ones fill the first slots, in that order.
+	// Neighbouring particles are then close in memory. 0 never sorts.
+	void set_sort_interval(uint32_t sort_interval) { m_sort_interval = sort_interval; }
+	uint32_t get_sort_interval() const { return m_sort_interval; }
+
+	// Collisions between the particles, as spheres of radius particle_size, after each GPU step.
+	// The particles are counting sorted into a uniform grid over the simulation space to find their neighbours.
+	void set_particle_collisions(bool enabled) { m_particle_collisions = enabled; }
+	bool get_particle_collisions() const { return m_particle_collisions; }
+
+	// Times the GPU passes of update(). Can be null.
+	void set_gpu_profiler(GpuProfiler* profiler) { m_gpu_profiler = profiler; }
+	// Where the config and the interaction shapes are uploaded. Needed before updating or rendering.
+	void set_upload_ring(UploadRing* upload_ring) { m_upload_ring = upload_ring; }
+
 private:
 	TriangleMesh m_ico_mesh;
 	uint32_t m_ico_draw_vao;
 
 	bool m_flipflop_state = false;
+	// Seed of the spawner
+	uint32_t m_step_idx = 0;
 	uint32_t m_vbo_particle_buffers[2];
 	uint32_t m_alive_particle_indices[2];
 	uint32_t m_dead_particle_indices, m_dead_particle_count;
+	// Only used by ParticleLayout::eSoA
+	uint32_t m_particle_lifetimes;
 
 	uint32_t m_draw_indirect_buffers[2];
-
+	// Workgroups of the advect pass, from the particles alive after spawning
+	uint32_t m_dispatch_indirect_buffer;
+	// Workgroups of the spawner and particles of all the emitters, from emitter_counts.comp
+	uint32_t m_spawn_args_buffer;
+	// Look-back of the advect pass with Compaction::eWorkgroupScan, so the alive list keeps its order
+	uint32_t m_compaction_status_buffer;
+
+	ParticleLayout m_layout = ParticleLayout::eAoS;
+	ParticleLayout m_layout_in_buffers = ParticleLayout::eAoS;
+	Compaction m_compaction = Compaction::eAtomic;
+
+	ShaderProgram m_draw_program;
 	ShaderProgram m_advect_compute_program;
-	ShaderProgram m_simple_spawner_program;
+	ShaderProgram m_emitter_counts_program;
+	ShaderProgram m_spawner_program;
+	ShaderProgram m_prepare_dispatch_program;
+	ShaderProgram m_morton_keys_program;
+	ShaderProgram m_reorder_program;
+
+	uint32_t m_sort_interval = 0;
+	GpuRadixSort m_radix_sort;
+	uint32_t m_sort_keys, m_sort_values;
+	// Where the sort copies the particles to. Swapped with the particle buffers afterwards.
+	uint32_t m_sorted_particle_buffers[2];
+	uint32_t m_sorted_particle_lifetimes;
+	uint32_t m_max_particles_in_sort_buffers = 0;
+	ParticleLayout m_layout_in_sort_buffers = ParticleLayout::eAoS;
+
+	// Cells per axis of the grid of the collisions, at most
+	static constexpr uint32_t MAX_GRID_DIMS = 128;
+	bool m_particle_collisions = false;
+	// Fraction of the overlap solved in each step
+	float m_collision_relaxation = 0.5f;
+	ShaderProgram m_grid_count_program;
+	// Scan of the blocks, of their sums, and addition of the sums
+	ShaderProgram m_grid_scan_programs[3];
+	ShaderProgram m_grid_scatter_program;
+	ShaderProgram m_particle_collisions_program;
+	uint32_t m_grid_cell_counts, m_grid_cell_starts, m_grid_block_sums;
+	uint32_t m_grid_entries, m_grid_sorted_positions;
+	uint32_t m_max_cells_in_grid_buffers = 0;
+	uint32_t m_max_particles_in_grid_buffers = 0;
 
 	particle::ParticleSystemConfig m_system_config;
-	particle::ParticleSpawnerConfig m_spawner_config;
-	uint32_t m_system_config_bo;
-
-	float m_emmit_particles_per_second = 10.0f;
-	float m_accum_particles_emmited = 0.0f;
 	uint32_t m_max_particles_in_buffers = 0;
 
-	uint32_t m_sphere_ssb;
+	std::vector<particle::Emitter> m_emitters;
+	// Uploaded before the next GPU step
+	bool m_emitters_dirty = true;
+	uint32_t m_emitters_ssb;
+	uint32_t m_emitter_states_ssb;
+	uint32_t m_max_emitters_in_buffers = 0;
+	uint32_t m_num_emitters_in_buffers = 0;
+
 	bool m_intersect_sphere_enabled = true;
 	Sphere m_sphere;
 
 	bool m_intersect_mesh_enabled = true;
 	TriangleMesh m_intersect_mesh;
-
+	MeshBVH m_mesh_bvh;
+	uint32_t m_bvh_nodes_ssb;
+	uint32_t m_bvh_triangles_ssb;
+	uint32_t m_face_normals_ssb;
+	// For the mesh emitters
+	uint32_t m_mesh_area_cdf_ssb;
+
+	Backend m_backend = Backend::eGPU;
+	CpuParticleSolver m_cpu_solver;
+
+	GpuProfiler* m_gpu_profiler = nullptr;
+	PassGraph m_pass_graph;
+
+	UploadRing* m_upload_ring = nullptr;
+	// Generation of the ring of the config and shapes bound, or invalid if they changed after
+	uint64_t m_frame_data_generation = UploadRing::INVALID_GENERATION;
+	UploadRing::Range m_config_range = {};
+	UploadRing::Range m_sphere_range = {};
+	float m_cpu_step_ms = 0.0f;
+
+	void load_programs();
+	// Upload the config and the shapes if needed, and bind them
+	void upload_frame_data();
 	void initialize_system();
 	void update_sytem_config();
 	void update_intersection_sphere();
 	void update_intersection_mesh();
+	void upload_emitters();
+	void sort_particles();
+	void collide_particles();
+
+	void update_cpu(float dt);
 };
\ No newline at end of file
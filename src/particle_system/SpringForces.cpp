@@ -0,0 +1,29 @@
+#include "SpringForces.hpp"
+
+#include <glad/glad.h>
+
+void scatter_spring_forces(const ShaderProgram& program, uint32_t forces_buffer,
+	const uint32_t particle_buffers[2], const std::vector<uint32_t>& color_offsets, float dt,
+	PassGraph* pass_graph, GpuProfiler* gpu_profiler)
+{
+	GpuProfiler::Scope scope(gpu_profiler, GpuProfiler::Pass::eSpringForce);
+	pass_graph->pass({ PassGraph::update(forces_buffer) });
+	glClearNamedBufferData(forces_buffer, GL_R32F, GL_RED, GL_FLOAT, nullptr);
+
+	program.use_program();
+	glUniform1f(0, dt);
+	// Each color adds to the forces of the previous ones
+	for (uint32_t color = 0; color + 1 < (uint32_t)color_offsets.size(); ++color) {
+		const uint32_t num_segments = color_offsets[color + 1] - color_offsets[color];
+		pass_graph->pass({
+			PassGraph::read(particle_buffers[0]),
+			PassGraph::read(particle_buffers[1]),
+			PassGraph::write(forces_buffer),
+			});
+		glUniform1ui(1, color_offsets[color]);
+		glUniform1ui(2, num_segments);
+		glDispatchCompute(num_segments / 32
+			+ (num_segments % 32 == 0 ? 0 : 1)
+			, 1, 1);
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "graphics/ShaderProgram.hpp"
+#include "graphics/GpuProfiler.hpp"
+#include "graphics/PassGraph.hpp"
+
+// Forces of the springs added to a force per particle, with spring_forces.comp built with
+// SCATTER_FORCES, one dispatch per color of segments. Clears the forces first.
+// Shared by SpringSystem and ClothSystem, which bind the particles and segments before.
+// particle_buffers are the ping-pong pair read by the forces.
+void scatter_spring_forces(const ShaderProgram& program, uint32_t forces_buffer,
+	const uint32_t particle_buffers[2], const std::vector<uint32_t>& color_offsets, float dt,
+	PassGraph* pass_graph, GpuProfiler* gpu_profiler);
@@ -1,9 +1,15 @@
 #include "SpringSystem.hpp"
+#include "SpringForces.hpp"
 
 #include <imgui.h>
 #include <glad/glad.h>
 #include <array>
+#include <cassert>
 #include <glm/gtc/type_ptr.hpp>
+#include <chrono>
+
+#include "utils/ThreadPool.hpp"
+#include "utils/Tracer.hpp"
 
 
 using namespace spring;
@@ -13,31 +19,18 @@ SpringSystem::SpringSystem()
 	const std::filesystem::path proj_dir(PROJECT_DIR);
 	const std::filesystem::path shad_dir = proj_dir / "resources/shaders";
 
-	std::array<Shader, 2> particle_shaders = {
-		Shader((shad_dir / "spring_point.vert"), Shader::Type::Vertex),
-		Shader((shad_dir / "spring_point.frag"), Shader::Type::Fragment)
-	};
-
-	m_basic_draw_point = ShaderProgram(particle_shaders.data(), (uint32_t)particle_shaders.size());
+	load_programs();
 
-	m_advect_particle_program = ShaderProgram(
-		&Shader(shad_dir / "advect_particles_springs.comp", Shader::Type::Compute), 1
-	);
-
-	m_spring_force_program = ShaderProgram(
-		&Shader(shad_dir / "spring_forces.comp", Shader::Type::Compute), 1
-	);
-
-	glGenBuffers(2, m_vbo_particle_buffers);
-	glGenBuffers(1, &m_system_config_bo);
-	glGenBuffers(1, &m_spring_indices_bo);
-	glGenBuffers(1, &m_patches_indices_bo);
-	glGenBuffers(1, &m_sphere_ssb);
-	glGenBuffers(1, &m_forces_buffer);
-	glGenBuffers(1, &m_original_lengths_buffer);
-	glGenBuffers(1, &m_fixed_points_buffer);
-	glGenBuffers(1, &m_particle_2_segments_list);
-	glGenBuffers(1, &m_segments_list_buffer);
+	// Created, not only named, as they are first written with the DSA functions
+	glCreateBuffers(2, m_vbo_particle_buffers);
+	glCreateBuffers(1, &m_spring_indices_bo);
+	glCreateBuffers(1, &m_patches_indices_bo);
+	glCreateBuffers(1, &m_forces_buffer);
+	glCreateBuffers(1, &m_original_lengths_buffer);
+	glCreateBuffers(1, &m_fixed_points_buffer);
+	glCreateBuffers(1, &m_particle_2_segments_list);
+	glCreateBuffers(1, &m_segments_list_buffer);
+	glCreateBuffers(1, &m_color_segments_buffer);
 
 	glGenVertexArrays(1, &m_segment_vao);
 	glGenVertexArrays(1, &m_patches_vao);
@@ -58,14 +51,6 @@ SpringSystem::SpringSystem()
 	};
 	m_sphere_draw_program = ShaderProgram(sphere_shaders.data(), (uint32_t)sphere_shaders.size());
 
-	std::array<Shader, 4> hair_shaders = {
-		Shader((shad_dir / "hair.vert"), Shader::Type::Vertex),
-		Shader((shad_dir / "hair.frag"), Shader::Type::Fragment),
-		Shader((shad_dir / "hair.tesc"), Shader::Type::TessellationControl),
-		Shader((shad_dir / "hair.tese"), Shader::Type::TessellationEvaluation)
-	};
-	m_hair_draw_program = ShaderProgram(hair_shaders.data(), (uint32_t)hair_shaders.size());
-
 	glGenVertexArrays(1, &m_sphere_vao);
 	glBindVertexArray(m_sphere_vao);
 	m_sphere_mesh.gl_bind_to_vao();
@@ -84,19 +69,6 @@ SpringSystem::SpringSystem()
 	m_system_config.num_fixed_particles = 1;
 	m_system_config.num_particles_per_strand = 0;
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_system_config_bo);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(SpringSystemConfig),
-		nullptr, GL_STATIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-	// Initialize shapes
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		2 * sizeof(Sphere),
-		nullptr, GL_STATIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
 	initialize_system();
 	update_intersection_sphere();
 	update_interaction_data();
@@ -104,28 +76,49 @@ SpringSystem::SpringSystem()
 
 void SpringSystem::update(float time, float dt)
 {
+	Tracer::Scope trace("SpringSystem::update");
+	if (m_backend == Backend::eCPU) {
+		update_cpu(dt);
+		return;
+	}
+
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[m_flipflop_state]);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[1 - m_flipflop_state]);
+	upload_frame_data();
 
-	glClearNamedBufferSubData(m_forces_buffer, GL_R32F,
-		0, sizeof(glm::vec4) * m_system_config.num_segments, GL_RED, GL_FLOAT, nullptr);
-	
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
-
-	m_spring_force_program.use_program();
-	glUniform1f(0, dt);
-	glDispatchCompute(m_system_config.num_segments / 32
-		+ (m_system_config.num_segments % 32 == 0 ? 0 : 1)
-		, 1, 1);
-
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	if (m_force_accumulation == ForceAccumulation::eColoredScatter) {
+		scatter_spring_forces(m_spring_force_program, m_forces_buffer, m_vbo_particle_buffers,
+			m_color_offsets, dt, &m_pass_graph, m_gpu_profiler);
+	}
+	else {
+		GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eSpringForce);
+		// Every segment writes its force, no need to clear them
+		m_pass_graph.pass({
+			PassGraph::read(m_vbo_particle_buffers[0]),
+			PassGraph::read(m_vbo_particle_buffers[1]),
+			PassGraph::write(m_forces_buffer),
+			});
+		m_spring_force_program.use_program();
+		glUniform1f(0, dt);
+		glDispatchCompute(m_system_config.num_segments / 32
+			+ (m_system_config.num_segments % 32 == 0 ? 0 : 1)
+			, 1, 1);
+	}
 
-	m_advect_particle_program.use_program();
-	glUniform1f(0, dt);
-	glUniform4fv(3, 1, glm::value_ptr(m_rotation));
-	glDispatchCompute(m_system_config.num_particles / 32
-		+ (m_system_config.num_particles % 32 == 0 ? 0 : 1)
-		, 1, 1);
+	{
+		GpuProfiler::Scope scope(m_gpu_profiler, GpuProfiler::Pass::eAdvect);
+		m_pass_graph.pass({
+			PassGraph::read(m_forces_buffer),
+			PassGraph::write(m_vbo_particle_buffers[0]),
+			PassGraph::write(m_vbo_particle_buffers[1]),
+			});
+		m_advect_particle_program.use_program();
+		glUniform1f(0, dt);
+		glUniform4fv(3, 1, glm::value_ptr(m_rotation));
+		glDispatchCompute(m_system_config.num_particles / 32
+			+ (m_system_config.num_particles % 32 == 0 ? 0 : 1)
+			, 1, 1);
+	}
 
 	// flip state
 	m_flipflop_state = !m_flipflop_state;
@@ -133,6 +126,7 @@ void SpringSystem::update(float time, float dt)
 
 void SpringSystem::gl_render(const glm::mat4& proj_view, const glm::vec3& eye_world)
 {
+	upload_frame_data();
 
 	// Draw sphere
 	if (m_init_system == InitSystems::eSphere && m_draw_head) {
@@ -146,7 +140,11 @@ void SpringSystem::gl_render(const glm::mat4& proj_view, const glm::vec3& eye_wo
 			GL_UNSIGNED_INT, (void*)0);
 	}
 
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	// The vertex shaders read the positions from the storage buffers
+	m_pass_graph.pass({
+		PassGraph::read(m_vbo_particle_buffers[0]),
+		PassGraph::read(m_vbo_particle_buffers[1]),
+		});
 
 	if (m_draw_mode == DrawMode::ePolylines) {
 		if (m_draw_points || m_draw_lines) {
@@ -198,6 +196,54 @@ void SpringSystem::imgui_draw()
 {
 	ImGui::PushID("springSys");
 	ImGui::Text("Spring System Config");
+	Backend backend = m_backend;
+	if (ImGui::Combo("Backend", (int*)&backend, "GPU\0CPU\0")) {
+		set_backend(backend);
+	}
+	if (m_backend == Backend::eCPU) {
+		ImGui::Text("CPU step %.3f ms, %u threads, %u strands", m_cpu_step_ms,
+			ThreadPool::global().get_num_threads(), m_cpu_solver.get_num_strands());
+		CpuSpringSolver::Integrator integrator = m_cpu_solver.get_integrator();
+		if (ImGui::Combo("Integrator", (int*)&integrator, "Verlet\0Implicit Euler\0XPBD\0")) {
+			m_cpu_solver.set_integrator(integrator);
+		}
+		if (integrator == CpuSpringSolver::Integrator::eImplicit) {
+			uint32_t iterations = m_cpu_solver.get_cg_max_iterations();
+			if (ImGui::InputScalar("CG max iterations", ImGuiDataType_U32, &iterations)) {
+				m_cpu_solver.set_cg_max_iterations(iterations);
+			}
+			float tolerance = m_cpu_solver.get_cg_tolerance();
+			if (ImGui::InputFloat("CG tolerance", &tolerance, 0.0f, 0.0f, "%.1e")) {
+				m_cpu_solver.set_cg_tolerance(tolerance);
+			}
+			ImGui::Text("CG iterations %u", m_cpu_solver.get_cg_iterations());
+		}
+		else if (integrator == CpuSpringSolver::Integrator::eXPBD) {
+			uint32_t iterations = m_cpu_solver.get_xpbd_iterations();
+			if (ImGui::InputScalar("XPBD iterations", ImGuiDataType_U32, &iterations)) {
+				m_cpu_solver.set_xpbd_iterations(iterations);
+			}
+			float compliance = m_cpu_solver.get_xpbd_compliance();
+			if (ImGui::InputFloat("Compliance", &compliance, 0.0f, 0.0f, "%.1e")) {
+				m_cpu_solver.set_xpbd_compliance(std::max(compliance, 0.0f));
+			}
+			ImGui::Text("%u colors of segments", m_cpu_solver.get_num_colors());
+		}
+	}
+	uint32_t num_barriers, num_passes;
+	m_pass_graph.get_stats(&num_barriers, &num_passes);
+	ImGui::Text("Barriers %u / passes %u", num_barriers, num_passes);
+	ParticleLayout layout = m_layout;
+	if (ImGui::Combo("Layout", (int*)&layout, "Array of structs\0Struct of arrays\0")) {
+		set_layout(layout);
+	}
+	ForceAccumulation accumulation = m_force_accumulation;
+	if (ImGui::Combo("Forces", (int*)&accumulation, "Gather\0Colored scatter\0")) {
+		set_force_accumulation(accumulation);
+	}
+	if (m_force_accumulation == ForceAccumulation::eColoredScatter) {
+		ImGui::Text("%u colors of segments", (uint32_t)m_color_offsets.size() - 1);
+	}
 	bool update = false;
 	update |= ImGui::DragFloat("Gravity", &m_system_config.gravity, 0.01f);
 	//update |= ImGui::DragFloat("Particle size", &m_system_config.particle_size, 0.01f, 0.0f, 2.0f);
@@ -319,77 +365,194 @@ void SpringSystem::set_sphere(const glm::vec3& pos, float radius)
 {
 	m_sphere.pos = pos;
 	m_sphere.radius = radius;
+	m_cpu_solver.set_sphere(m_sphere);
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
+}
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Sphere), &m_sphere);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+void SpringSystem::set_backend(Backend backend)
+{
+	m_backend = backend;
+	initialize_system();
+}
+
+void SpringSystem::set_layout(ParticleLayout layout)
+{
+	m_layout = layout;
+	load_programs();
+	initialize_system();
+	update_intersection_sphere();
+	update_interaction_data();
+}
+
+void SpringSystem::set_force_accumulation(ForceAccumulation accumulation)
+{
+	m_force_accumulation = accumulation;
+	m_cpu_solver.set_force_accumulation(accumulation);
+	load_programs();
+	initialize_system();
+	update_intersection_sphere();
+	update_interaction_data();
+}
+
+void SpringSystem::load_programs()
+{
+	const std::filesystem::path shad_dir = std::filesystem::path(PROJECT_DIR) / "resources/shaders";
+	const std::vector<std::string> defines = get_particle_layout_defines(m_layout);
+	std::vector<std::string> force_defines = defines;
+	if (m_force_accumulation == ForceAccumulation::eColoredScatter) {
+		force_defines.push_back("SCATTER_FORCES");
+	}
+
+	std::array<Shader, 2> particle_shaders = {
+		Shader((shad_dir / "spring_point.vert"), Shader::Type::Vertex, defines),
+		Shader((shad_dir / "spring_point.frag"), Shader::Type::Fragment)
+	};
+
+	m_basic_draw_point = ShaderProgram(particle_shaders.data(), (uint32_t)particle_shaders.size());
+
+	m_advect_particle_program = ShaderProgram(
+		&Shader(shad_dir / "advect_particles_springs.comp", Shader::Type::Compute, force_defines), 1
+	);
+
+	m_spring_force_program = ShaderProgram(
+		&Shader(shad_dir / "spring_forces.comp", Shader::Type::Compute, force_defines), 1
+	);
+
+	std::array<Shader, 4> hair_shaders = {
+		Shader((shad_dir / "hair.vert"), Shader::Type::Vertex, defines),
+		Shader((shad_dir / "hair.frag"), Shader::Type::Fragment),
+		Shader((shad_dir / "hair.tesc"), Shader::Type::TessellationControl),
+		Shader((shad_dir / "hair.tese"), Shader::Type::TessellationEvaluation)
+	};
+	m_hair_draw_program = ShaderProgram(hair_shaders.data(), (uint32_t)hair_shaders.size());
 }
 
 void SpringSystem::reset_bindings() const
 {
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEM_CONFIG, m_system_config_bo);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_IN, m_vbo_particle_buffers[0]);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[1]);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SEGMENT_INDICES, m_spring_indices_bo);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_FORCES, m_forces_buffer);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SHAPE_SPHERE, m_sphere_ssb);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ORIGINAL_LENGTHS, m_original_lengths_buffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_FIXED_POINTS, m_fixed_points_buffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLE_TO_SEGMENTS_LIST, m_particle_2_segments_list);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SEGMENTS_MAPPING_LIST, m_segments_list_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COLOR_SEGMENTS, m_color_segments_buffer);
 }
 
 void SpringSystem::initialize_system()
 {
+	Tracer::Scope trace("SpringSystem::initialize_system");
+	// The buffers are reallocated and rewritten below
+	m_pass_graph.flush();
 	m_flipflop_state = false;
 
-
-	for (uint32_t i = 0; i < 2; ++i) {
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_vbo_particle_buffers[i]);
-		glBufferData(GL_SHADER_STORAGE_BUFFER,
-			m_system_config.num_particles * sizeof(Particle),
-			nullptr, GL_DYNAMIC_DRAW);
-	}
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
+	SpringSystemData& data = m_data;
 	switch (m_init_system)
 	{
 	case InitSystems::eRope:
-		init_system_rope();
+		init_system_rope(&data, &m_patch_indices);
 		break;
 	case InitSystems::eSphere:
-		init_system_sphere();
+		init_system_sphere(&data, &m_patch_indices);
 		break;
 	default:
 		assert(false);
 		break;
 	}
-	
-	// force buffers
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_forces_buffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(glm::vec4) * m_system_config.num_segments,
-		nullptr, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	m_num_elements_patches = 3 * (uint32_t)m_patch_indices.size();
+
+	// Colors of the segments for the scatter of the forces, which needs no segments per particle.
+	// The CPU solver colors its own copy if it needs them.
+	const bool scatter = m_backend == Backend::eGPU
+		&& m_force_accumulation == ForceAccumulation::eColoredScatter;
+	if (scatter) {
+		build_segment_colors(&data);
+		data.particle2segments.clear();
+		data.segment_mappings.clear();
+	}
+	else {
+		data.color_segments.clear();
+		data.color_offsets.clear();
+	}
+	m_color_offsets = data.color_offsets;
+
+	// Every buffer is reallocated and written through a single staging buffer
+	StagingUpload& upload = m_staging_upload;
+
+	// Both steps start from the same positions
+	if (m_layout == ParticleLayout::eSoA) {
+		positions_to_soa(data.particles, &m_soa_positions);
+	}
+	for (uint32_t i = 0; i < 2; ++i) {
+		if (m_layout == ParticleLayout::eAoS) {
+			upload.add(m_vbo_particle_buffers[i], data.particles.data(),
+				sizeof(Particle) * data.particles.size(), GL_DYNAMIC_DRAW);
+		}
+		else {
+			upload.add(m_vbo_particle_buffers[i], m_soa_positions.data(),
+				sizeof(float) * m_soa_positions.size(), GL_DYNAMIC_DRAW);
+		}
+	}
+
+	upload.add(m_spring_indices_bo, data.segments.data(),
+		sizeof(glm::ivec2) * data.segments.size(), GL_STATIC_DRAW);
+	upload.add(m_patches_indices_bo, m_patch_indices.data(),
+		sizeof(glm::ivec3) * m_patch_indices.size(), GL_STATIC_DRAW);
+	upload.add(m_original_lengths_buffer, data.original_lengths.data(),
+		sizeof(float) * data.original_lengths.size(), GL_STATIC_DRAW);
+	upload.add(m_particle_2_segments_list, data.particle2segments.data(),
+		sizeof(Particle2SegmentsList) * data.particle2segments.size(), GL_STATIC_DRAW);
+	upload.add(m_segments_list_buffer, data.segment_mappings.data(),
+		sizeof(SegmentMapping) * data.segment_mappings.size(), GL_STATIC_DRAW);
+	// Fixed particles, relative to the interaction sphere
+	upload.add(m_fixed_points_buffer, data.fixed_particles.data(),
+		sizeof(Particle) * data.fixed_particles.size(), GL_STATIC_DRAW);
+	upload.add(m_color_segments_buffer, data.color_segments.data(),
+		sizeof(uint32_t) * data.color_segments.size(), GL_STATIC_DRAW);
+
+	// force buffers, per segment or per particle
+	const uint32_t num_forces = m_force_accumulation == ForceAccumulation::eColoredScatter ?
+		m_system_config.num_particles : m_system_config.num_segments;
+	upload.add(m_forces_buffer, nullptr, sizeof(glm::vec4) * num_forces, GL_DYNAMIC_DRAW);
+	upload.flush(ThreadPool::global());
 	glClearNamedBufferSubData(m_forces_buffer, GL_R32F,
-		0, sizeof(glm::vec4) * m_system_config.num_segments, GL_RED, GL_FLOAT, nullptr);
+		0, sizeof(glm::vec4) * num_forces, GL_RED, GL_FLOAT, nullptr);
 
 	update_system_config();
+	if (m_backend == Backend::eCPU) {
+		m_cpu_solver.initialize(m_system_config, data, m_layout);
+	}
 	reset_bindings();
 }
 
 void SpringSystem::update_system_config()
 {
-	glNamedBufferSubData(
-		m_system_config_bo, // buffer name
-		0, // offset
-		sizeof(SpringSystemConfig),	// size
-		&m_system_config	// data
-	);
+	Tracer::Scope trace("SpringSystem::update_system_config");
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
+	m_cpu_solver.set_config(m_system_config);
+}
+
+void SpringSystem::upload_frame_data()
+{
+	assert(m_upload_ring != nullptr);
+	if (m_frame_data_generation != m_upload_ring->get_generation()) {
+		// The scene sphere, then the head
+		const std::array<Sphere, 2> spheres = { m_sphere, m_sphere_head };
+		m_config_range = m_upload_ring->upload(&m_system_config, sizeof(SpringSystemConfig));
+		m_sphere_range = m_upload_ring->upload(spheres.data(), sizeof(spheres));
+		m_frame_data_generation = m_upload_ring->get_generation();
+	}
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEM_CONFIG,
+		m_config_range.buffer, m_config_range.offset, m_config_range.size);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING_SHAPE_SPHERE,
+		m_sphere_range.buffer, m_sphere_range.offset, m_sphere_range.size);
 }
 
 void SpringSystem::update_intersection_sphere()
 {
+	m_cpu_solver.set_intersect_sphere(m_intersect_sphere);
+
 	m_advect_particle_program.use_program();
 	if (m_intersect_sphere) {
 		glUniform1ui(1, 1);
@@ -400,282 +563,106 @@ void SpringSystem::update_intersection_sphere()
 	glUseProgram(0);
 }
 
-void SpringSystem::init_system_rope()
+void SpringSystem::init_system_rope(SpringSystemData* data, std::vector<glm::ivec3>* patch_indices_)
 {
-	const uint32_t num_particles = m_system_config.num_particles = m_rope_init_num_particles;
-	m_system_config.num_segments = num_particles - 1;
-	m_system_config.num_fixed_particles = m_rope_init_num_fixed_particles;
-	m_system_config.num_particles_per_strand = num_particles;
-
-	std::vector<Particle> p(num_particles);
-	const glm::vec3 dir = glm::normalize(m_rope_init_dir);
-	float delta_x = m_rope_init_length / (float)m_rope_init_num_particles;
-	for (uint32_t i = 0; i < num_particles; ++i) {
-		p[i].pos = m_sphere_head.pos + dir * ((float)i * delta_x);
-	}
-	glNamedBufferData(
-		m_vbo_particle_buffers[0], // buffer name
-		num_particles * sizeof(Particle),	// size
-		p.data(),	// data
-		GL_DYNAMIC_DRAW
-	);
-	glNamedBufferData(
-		m_vbo_particle_buffers[1], // buffer name
-		num_particles * sizeof(Particle),	// size
-		p.data(),	// data
-		GL_DYNAMIC_DRAW
-	);
-
-	// Segment indices
-	std::vector<glm::ivec2> indices(m_system_config.num_segments);
-	for (uint32_t i = 0; i < m_system_config.num_segments; ++i) {
-		indices[i] = glm::ivec2(i, i + 1);
-	}
+	build_rope_data(m_sphere_head.pos, m_rope_init_dir, m_rope_init_length,
+		m_rope_init_num_particles, m_rope_init_num_fixed_particles, data);
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_spring_indices_bo);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(glm::ivec2) * indices.size(),
-		indices.data(), GL_STATIC_DRAW);
+	m_system_config.num_particles = m_rope_init_num_particles;
+	m_system_config.num_segments = (uint32_t)data->segments.size();
+	m_system_config.num_fixed_particles = m_rope_init_num_fixed_particles;
+	m_system_config.num_particles_per_strand = m_rope_init_num_particles;
 
 	// Patch indices
-	std::vector<glm::ivec3> patch_indices; patch_indices.reserve(m_system_config.num_particles);
+	std::vector<glm::ivec3>& patch_indices = *patch_indices_;
+	patch_indices.clear();
 	patch_indices.push_back({0, 0, 1 });
 	for (uint32_t i = 0; i < m_system_config.num_particles - 2; i += 1) {
 		patch_indices.push_back({ i, i + 1, i + 2 });
 	}
 	patch_indices.push_back({ m_system_config.num_particles - 2, m_system_config.num_particles - 1 , m_system_config.num_particles - 1 });
-
-	m_num_elements_patches =  3 * (uint32_t)patch_indices.size();
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patches_indices_bo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		sizeof(patch_indices[0]) * patch_indices.size(),
-		patch_indices.data(), GL_STATIC_DRAW);
-
-	// Segment lengths
-	std::vector<float> original_lengths(m_system_config.num_segments);
-	for (uint32_t i = 0; i < m_system_config.num_segments; ++i) {
-		original_lengths[i] = glm::length(p[indices[i].x].pos - p[indices[i].y].pos);
-	}
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_original_lengths_buffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(float) * original_lengths.size(),
-		original_lengths.data(), GL_STATIC_DRAW);
-
-	// Point 2 segment
-	std::vector<SegmentMapping> mappings;
-	mappings.reserve(num_particles * 2 - 2);
-	std::vector<Particle2SegmentsList> particle2segments_map(num_particles);
-	for (uint32_t i = 0; i < num_particles; ++i) {
-		uint32_t num = 0;
-		uint32_t idx = (uint32_t)mappings.size();
-
-		if (i != 0) {
-			mappings.push_back({ i - 1, 1 });
-			num += 1;
-		}
-		if (i != num_particles - 1) {
-			mappings.push_back({ i, 0 });
-			num += 1;
-		}
-		
-		particle2segments_map[i].segment_mapping_idx = idx;
-		particle2segments_map[i].num_segments = num;
-	}
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_particle_2_segments_list);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(Particle2SegmentsList) * particle2segments_map.size(),
-		particle2segments_map.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_segments_list_buffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(SegmentMapping) * mappings.size(),
-		mappings.data(), GL_STATIC_DRAW);
-	// Upload also fixed particles, modify original points
-	for (uint32_t i = 0; i < m_rope_init_num_fixed_particles; ++i) {
-		p[i].pos -= m_sphere_head.pos;
-	}
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_fixed_points_buffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(Particle) * m_rope_init_num_fixed_particles,
-		p.data(),
-		GL_STATIC_DRAW);
-
 }
 
-// Generation of points at the same distance on the unit sphere
-// extracted from https://bduvenhage.me/geometry/2019/07/31/generating-equidistant-vectors.html
-void fibonacci_spiral_sphere(std::vector<Particle>* vectors_, const int32_t num_points) {
-	std::vector<Particle>& vectors = *vectors_;
-	vectors.reserve(num_points);
-
-	const double gr = (std::sqrt(5.0) + 1.0) / 2.0;  // golden ratio = 1.6180339887498948482
-	const double ga = (2.0 - gr) * (2.0 * glm::pi<double>());  // golden angle = 2.39996322972865332
-
-	for (size_t i = 1; i <= num_points; ++i) {
-		const double lat = std::asin(-1.0 + 2.0 * double(i) / (num_points + 1));
-		const double lon = ga * i;
-
-		const float x = static_cast<float>(std::cos(lon) * std::cos(lat));
-		const float y = static_cast<float>(std::sin(lon) * std::cos(lat));
-		const float z = static_cast<float>(std::sin(lat));
-
-		vectors.emplace_back(Particle{ glm::vec3{ x, y, z }, 0.0f });
-		//float len = std::sqrt(x*x + y*y + z*z);
-		//std::cout << len << std::endl;
-
-		//std::cout<< "("<<x<<","<<y<<","<<z<<"),";
-	}
-	//std::cout << std::endl;
-}
-
-void SpringSystem::init_system_sphere()
+void SpringSystem::init_system_sphere(SpringSystemData* data, std::vector<glm::ivec3>* patch_indices_)
 {
 	m_rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
 
-	const uint32_t num_particles = m_system_config.num_particles = m_sphere_init_num_hairs * m_sphere_init_particles_per_strand;
-	m_system_config.num_segments = m_sphere_init_num_hairs * (m_sphere_init_particles_per_strand - 1);
-	m_system_config.num_particles_per_strand = m_sphere_init_particles_per_strand;
-
-	std::vector<Particle> particles;
-	particles.reserve(num_particles);
-	std::vector<glm::ivec2> indices; indices.reserve(m_system_config.num_segments);
+	build_hair_data(m_sphere_head, m_sphere_init_num_hairs, m_sphere_init_particles_per_strand,
+		m_hair_length, data);
 
-	// fill starting points
-	fibonacci_spiral_sphere(&particles, m_sphere_init_num_hairs);
-	// Upload fixed particles
+	m_system_config.num_particles = (uint32_t)data->particles.size();
+	m_system_config.num_segments = (uint32_t)data->segments.size();
+	m_system_config.num_particles_per_strand = m_sphere_init_particles_per_strand;
 	m_system_config.num_fixed_particles = m_sphere_init_num_hairs;
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_fixed_points_buffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(Particle) * m_sphere_init_num_hairs,
-		particles.data(),
-		GL_STATIC_DRAW);
-
-	std::vector<SegmentMapping> mappings;
-	mappings.reserve(m_sphere_init_num_hairs * (m_sphere_init_particles_per_strand * 2 - 2));
-	std::vector<Particle2SegmentsList> particle2segments_map(num_particles);
-
-	std::vector<glm::ivec3> patch_indices; patch_indices.reserve(m_system_config.num_particles);
-
-	// Create strands
-	float delta_x = m_hair_length / (m_sphere_head.radius * (float)m_sphere_init_particles_per_strand);
-	for (uint32_t root = 0; root < m_sphere_init_num_hairs; ++root) {
-		// mappings of root (maybe are not needed...)
-		mappings.push_back({ (uint32_t)indices.size(), 0 });
-		particle2segments_map[root].segment_mapping_idx =  (uint32_t)mappings.size() - 1;
-		particle2segments_map[root].num_segments = 1;
-
-		// Add patch
-		if(m_sphere_init_particles_per_strand > 1){
-			// Add first segment
-			const uint32_t start = (int32_t)particles.size();
-			patch_indices.push_back({ root, root, start });
-			for (uint32_t i = 0; i < m_sphere_init_particles_per_strand - 2; ++i) {
+
+	// Patches of each strand, starting at its root. Every strand has the same number,
+	// so they are filled in parallel.
+	const uint32_t particles_per_strand = m_sphere_init_particles_per_strand;
+	const uint32_t num_hairs = m_sphere_init_num_hairs;
+	uint32_t patches_per_strand = 0;
+	if (particles_per_strand > 1) {
+		patches_per_strand = particles_per_strand == 2 ? 1 : particles_per_strand;
+	}
+	std::vector<glm::ivec3>& patch_indices = *patch_indices_;
+	patch_indices.resize(num_hairs * patches_per_strand);
+	if (patches_per_strand == 0) {
+		return;
+	}
+	ThreadPool::global().parallel_for(num_hairs, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t root = begin; root < end; ++root) {
+			glm::ivec3* patch = patch_indices.data() + root * patches_per_strand;
+			const uint32_t start = num_hairs + root * (particles_per_strand - 1);
+			*patch++ = { root, root, start };
+			for (uint32_t i = 0; i + 2 < particles_per_strand; ++i) {
 				const uint32_t idx = start + i;
 				if (i == 0) {
-					patch_indices.push_back({ root, idx, idx + 1});
+					*patch++ = { root, idx, idx + 1 };
 				}
 				else {
-					patch_indices.push_back({ idx -1, idx, idx + 1 });
+					*patch++ = { idx - 1, idx, idx + 1 };
 				}
 
-				if (i == m_sphere_init_particles_per_strand - 3) {
-					patch_indices.push_back({ idx, idx + 1, idx + 1 });
+				if (i == particles_per_strand - 3) {
+					*patch++ = { idx, idx + 1, idx + 1 };
 				}
 			}
 		}
-
-
-		const glm::vec3 dir = particles[root].pos; // it is already normalized
-		for (uint32_t i = 1; i < m_sphere_init_particles_per_strand; ++i) {
-
-			const uint32_t particle_idx = (uint32_t)particles.size();
-			particles.push_back(
-				{
-					dir + dir * delta_x * (float)i,
-					0.0f
-				}
-			);
-
-			if (i == 1) {
-				indices.push_back(glm::ivec2(root, particle_idx));
-			}
-			else {
-				indices.push_back(glm::ivec2(particle_idx - 1, particle_idx));
-			}
-
-			// Always add previous segment
-			uint32_t num = 1;
-			uint32_t idx = (uint32_t)mappings.size();
-			mappings.push_back({ (uint32_t)indices.size() - 1, 1 });
-
-			if (i != m_sphere_init_particles_per_strand - 1) {
-				mappings.push_back({ (uint32_t)indices.size(), 0 });
-				num += 1;
-			}
-
-			particle2segments_map[particle_idx].segment_mapping_idx = idx;
-			particle2segments_map[particle_idx].num_segments = num;
-		}
-	}
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_particle_2_segments_list);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(Particle2SegmentsList) * particle2segments_map.size(),
-		particle2segments_map.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_segments_list_buffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(SegmentMapping) * mappings.size(),
-		mappings.data(), GL_STATIC_DRAW);
-
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_spring_indices_bo);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(glm::ivec2) * indices.size(),
-		indices.data(), GL_STATIC_DRAW);
-
-	m_num_elements_patches = 3 * (uint32_t)patch_indices.size();
-
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patches_indices_bo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		sizeof(patch_indices[0]) * patch_indices.size(),
-		patch_indices.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	// Segment lengths
-	std::vector<float> original_lengths(m_system_config.num_segments);
-	for (uint32_t i = 0; i < m_system_config.num_segments; ++i) {
-		original_lengths[i] = delta_x;
-	}
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_original_lengths_buffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER,
-		sizeof(float) * original_lengths.size(),
-		original_lengths.data(), GL_STATIC_DRAW);
-
-
-	// Update all particle positions before upload
-	for (uint32_t i = 0; i < num_particles; ++i) {
-		particles[i].pos = particles[i].pos * m_sphere_head.radius + m_sphere_head.pos;
-	}
-	glNamedBufferData(
-		m_vbo_particle_buffers[0], // buffer name
-		num_particles * sizeof(Particle),	// size
-		particles.data(),	// data
-		GL_DYNAMIC_DRAW
-	);
-	glNamedBufferData(
-		m_vbo_particle_buffers[1], // buffer name
-		num_particles * sizeof(Particle),	// size
-		particles.data(),	// data
-		GL_DYNAMIC_DRAW
-	);
-
+	}, 1024);
 }
 
 void SpringSystem::update_interaction_data()
 {
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphere_ssb);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Sphere), sizeof(Sphere), &m_sphere_head);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	m_frame_data_generation = UploadRing::INVALID_GENERATION;
 
 	m_advect_particle_program.use_program();
 	glUniform1ui(2, m_head_sphere_enabled ? 1 : 0);
+
+	m_cpu_solver.set_sphere_head(m_sphere_head);
+	m_cpu_solver.set_intersect_sphere_head(m_head_sphere_enabled);
+}
+
+void SpringSystem::update_cpu(float dt)
+{
+	Tracer::Scope trace("SpringSystem::update_cpu");
+	const auto start = std::chrono::steady_clock::now();
+	m_cpu_solver.step(dt, m_rotation);
+	m_cpu_step_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Upload the result where the GPU path would have written it
+	const uint32_t out = 1 - (uint32_t)m_flipflop_state;
+	m_pass_graph.pass({ PassGraph::update(m_vbo_particle_buffers[out]) });
+	if (m_layout == ParticleLayout::eAoS) {
+		glNamedBufferSubData(m_vbo_particle_buffers[out],
+			0, sizeof(Particle) * m_cpu_solver.get_particles().size(),
+			m_cpu_solver.get_particles().data());
+	}
+	else {
+		glNamedBufferSubData(m_vbo_particle_buffers[out],
+			0, sizeof(float) * m_cpu_solver.get_positions().size(),
+			m_cpu_solver.get_positions().data());
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PARTICLES_OUT, m_vbo_particle_buffers[out]);
+
+	// flip state
+	m_flipflop_state = !m_flipflop_state;
 }
\ No newline at end of file
@@ -1,9 +1,16 @@
 #pragma once
 
 #include "graphics/ShaderProgram.hpp"
+#include "graphics/GpuProfiler.hpp"
+#include "graphics/PassGraph.hpp"
+#include "graphics/UploadRing.hpp"
+#include "graphics/StagingUpload.hpp"
 #include "spring_types.in"
 #include "intersections.comp.in"
 #include "graphics/TriangleMesh.hpp"
+#include "SpringSystemData.hpp"
+#include "ParticleLayout.hpp"
+#include "cpu/CpuSpringSolver.hpp"
 #include <glm/gtc/quaternion.hpp>
 
 class SpringSystem {
@@ -25,11 +32,31 @@ public:
 
 	void reset_bindings() const;
 
+	enum class Backend {
+		eGPU = 0,
+		eCPU = 1,
+	};
+
+	// Changing the backend resets the simulation
+	void set_backend(Backend backend);
+	Backend get_backend() const { return m_backend; }
+
+	// Changing the layout rebuilds the programs and resets the simulation
+	void set_layout(ParticleLayout layout);
+	ParticleLayout get_layout() const { return m_layout; }
+
+	// Same for the accumulation of the spring forces
+	void set_force_accumulation(ForceAccumulation accumulation);
+	ForceAccumulation get_force_accumulation() const { return m_force_accumulation; }
+
+	// Times the GPU passes of update(). Can be null.
+	void set_gpu_profiler(GpuProfiler* profiler) { m_gpu_profiler = profiler; }
+	// Where the config and the interaction shapes are uploaded. Needed before updating or rendering.
+	void set_upload_ring(UploadRing* upload_ring) { m_upload_ring = upload_ring; }
+
 private:
 
 	spring::SpringSystemConfig m_system_config;
-	uint32_t m_system_config_bo;
-
 	bool m_flipflop_state = false;
 	uint32_t m_vbo_particle_buffers[2];
 	uint32_t m_spring_indices_bo;
@@ -39,6 +66,10 @@ private:
 	uint32_t m_fixed_points_buffer;
 	uint32_t m_particle_2_segments_list;
 	uint32_t m_segments_list_buffer;
+	// Segments sorted by color, and where each color starts
+	uint32_t m_color_segments_buffer;
+	std::vector<uint32_t> m_color_offsets;
+	ForceAccumulation m_force_accumulation = ForceAccumulation::eGather;
 
 
 	ShaderProgram m_basic_draw_point;
@@ -51,7 +82,6 @@ private:
 
 	uint32_t m_num_elements_patches = 0;
 
-	uint32_t m_sphere_ssb;
 	//bool m_intersect_sphere_enabled = true;
 	Sphere m_sphere;
 	Sphere m_sphere_head = { glm::vec3(2.0f, 5.0f, 5.0f), 1.0f};
@@ -95,12 +125,39 @@ private:
 	glm::vec3 m_hair_specular = glm::vec3(0.2196f, 0.1686f, 0.149f);
 	glm::vec3 m_hair_diffuse = glm::vec3(0.1176f, 0.0235f, 0.012f);
 
+	Backend m_backend = Backend::eGPU;
+	CpuSpringSolver m_cpu_solver;
+
+	GpuProfiler* m_gpu_profiler = nullptr;
+	PassGraph m_pass_graph;
+
+	UploadRing* m_upload_ring = nullptr;
+	// Generation of the ring of the config and shapes bound, or invalid if they changed after
+	uint64_t m_frame_data_generation = UploadRing::INVALID_GENERATION;
+	UploadRing::Range m_config_range = {};
+	UploadRing::Range m_sphere_range = {};
+	float m_cpu_step_ms = 0.0f;
+
+	ParticleLayout m_layout = ParticleLayout::eAoS;
+
+	// Host data of the last reset. Kept, so resetting a system of the same size does not allocate.
+	SpringSystemData m_data;
+	std::vector<float> m_soa_positions;
+	std::vector<glm::ivec3> m_patch_indices;
+	StagingUpload m_staging_upload;
+
+	void load_programs();
+	// Upload the config and the shapes if needed, and bind them
+	void upload_frame_data();
 	void initialize_system();
 	void update_system_config();
 	void update_intersection_sphere();
 
-	void init_system_rope();
-	void init_system_sphere();
+	// Fill the data and the patches of the initial system, uploaded by initialize_system()
+	void init_system_rope(SpringSystemData* data, std::vector<glm::ivec3>* patch_indices_);
+	void init_system_sphere(SpringSystemData* data, std::vector<glm::ivec3>* patch_indices_);
 	void update_interaction_data();
 
+	void update_cpu(float dt);
+
 };
\ No newline at end of file
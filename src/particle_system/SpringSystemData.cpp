@@ -0,0 +1,494 @@
+#include "SpringSystemData.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <glm/gtc/constants.hpp>
+#include "morton.in"
+#include "utils/ThreadPool.hpp"
+
+using namespace spring;
+
+namespace {
+// Minimum amount of work items that a thread processes in the parallel fills
+constexpr uint32_t MIN_ELEMENTS_PER_THREAD = 16384;
+constexpr uint32_t MIN_ROWS_PER_THREAD = 16;
+
+void set_fixed_particles(const glm::vec3& origin, uint32_t num_fixed, SpringSystemData* data)
+{
+	const std::vector<Particle>& p = data->particles;
+	data->fixed_particles.assign(p.begin(), p.begin() + std::min<size_t>(num_fixed, p.size()));
+	for (Particle& f : data->fixed_particles) {
+		f.pos -= origin;
+	}
+}
+
+// Generation of points at the same distance on the unit sphere
+// extracted from https://bduvenhage.me/geometry/2019/07/31/generating-equidistant-vectors.html
+// Written to the first num_points elements of vectors
+void fibonacci_spiral_sphere(Particle* vectors, const int32_t num_points) {
+	const double gr = (std::sqrt(5.0) + 1.0) / 2.0;  // golden ratio = 1.6180339887498948482
+	const double ga = (2.0 - gr) * (2.0 * glm::pi<double>());  // golden angle = 2.39996322972865332
+
+	ThreadPool::global().parallel_for((uint32_t)num_points, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (int32_t i = (int32_t)begin + 1; i <= (int32_t)end; ++i) {
+			const double lat = std::asin(-1.0 + 2.0 * double(i) / (num_points + 1));
+			const double lon = ga * i;
+
+			const float x = static_cast<float>(std::cos(lon) * std::cos(lat));
+			const float y = static_cast<float>(std::sin(lon) * std::cos(lat));
+			const float z = static_cast<float>(std::sin(lat));
+
+			vectors[i - 1] = Particle{ glm::vec3{ x, y, z }, 0.0f };
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+}
+
+// Stable sort of order by keys[order[k]], for keys below 2^30. Two passes of 15 bits.
+void radix_sort_by_key(const std::vector<uint32_t>& keys, uint32_t* order, uint32_t count)
+{
+	constexpr uint32_t BITS = 15;
+	constexpr uint32_t NUM_DIGITS = 1 << BITS;
+	std::vector<uint32_t> tmp(count);
+	std::vector<uint32_t> starts(NUM_DIGITS);
+	uint32_t* src = order;
+	uint32_t* dst = tmp.data();
+	for (uint32_t shift = 0; shift < 2 * BITS; shift += BITS) {
+		std::fill(starts.begin(), starts.end(), 0);
+		for (uint32_t k = 0; k < count; ++k) {
+			starts[(keys[src[k]] >> shift) & (NUM_DIGITS - 1)] += 1;
+		}
+		uint32_t sum = 0;
+		for (uint32_t& start : starts) {
+			const uint32_t digit_count = start;
+			start = sum;
+			sum += digit_count;
+		}
+		for (uint32_t k = 0; k < count; ++k) {
+			dst[starts[(keys[src[k]] >> shift) & (NUM_DIGITS - 1)]++] = src[k];
+		}
+		std::swap(src, dst);
+	}
+	// An even number of passes leaves the result in order
+}
+
+// Stable counting sort of the keys of items [0, num_items), which have keys_per_item keys
+// below num_keys each, given by get_key(item, k). Calls place(item, k, position) with the
+// position of each key, and fills key_starts[key] with where the positions of key start,
+// plus the total at key_starts[num_keys]. entries is scratch.
+// With several threads, the keys are first split in one range of keys per thread, with a
+// histogram of ranges per chunk of items, into entries (item * keys_per_item + k). Then each
+// thread counts, scans and places the keys of its range alone. Every key is read four times,
+// and the scratch is one uint32_t per key plus num_keys, however many threads there are.
+template<typename KeyFunc, typename PlaceFunc>
+void parallel_counting_sort(uint32_t num_items, uint32_t keys_per_item, uint32_t num_keys,
+	const KeyFunc& get_key, const PlaceFunc& place,
+	std::vector<uint32_t>* entries_, std::vector<uint32_t>* key_starts_)
+{
+	ThreadPool& pool = ThreadPool::global();
+	const uint32_t num_ranges = std::max(std::min(pool.get_num_threads(), num_keys), 1u);
+	const auto range_of = [&](uint32_t key) { return (uint32_t)((uint64_t)key * num_ranges / num_keys); };
+	const auto range_first_key = [&](uint32_t range) {
+		return (uint32_t)(((uint64_t)range * num_keys + num_ranges - 1) / num_ranges);
+	};
+
+	std::vector<uint32_t> range_starts = { 0, num_items * keys_per_item };
+	std::vector<uint32_t>& entries = *entries_;
+	if (num_ranges > 1) {
+		// Keys of each chunk in each range. Chunks always run on the same thread.
+		std::vector<uint32_t> range_counts((size_t)pool.get_num_threads() * num_ranges, 0);
+		pool.parallel_for(num_items, [&](uint32_t begin, uint32_t end, uint32_t thread_idx) {
+			uint32_t* row = range_counts.data() + (size_t)thread_idx * num_ranges;
+			for (uint32_t item = begin; item < end; ++item) {
+				for (uint32_t k = 0; k < keys_per_item; ++k) {
+					row[range_of(get_key(item, k))] += 1;
+				}
+			}
+		}, MIN_ELEMENTS_PER_THREAD);
+
+		// Ranges one after the other, and the chunks in order within each range
+		range_starts.resize(num_ranges + 1);
+		uint32_t sum = 0;
+		for (uint32_t r = 0; r < num_ranges; ++r) {
+			range_starts[r] = sum;
+			for (uint32_t t = 0; t < pool.get_num_threads(); ++t) {
+				uint32_t& count = range_counts[(size_t)t * num_ranges + r];
+				const uint32_t chunk_count = count;
+				count = sum;
+				sum += chunk_count;
+			}
+		}
+		range_starts[num_ranges] = sum;
+
+		// Same split of the items as the count, so every chunk finds its own row
+		entries.resize((size_t)num_items * keys_per_item);
+		pool.parallel_for(num_items, [&](uint32_t begin, uint32_t end, uint32_t thread_idx) {
+			uint32_t* row = range_counts.data() + (size_t)thread_idx * num_ranges;
+			for (uint32_t item = begin; item < end; ++item) {
+				for (uint32_t k = 0; k < keys_per_item; ++k) {
+					entries[row[range_of(get_key(item, k))]++] = item * keys_per_item + k;
+				}
+			}
+		}, MIN_ELEMENTS_PER_THREAD);
+	}
+
+	// The keys of range r, in the order of the items. A single range takes them all.
+	const auto for_each_key = [&](uint32_t r, const auto& func) {
+		for (uint32_t e = range_starts[r]; e < range_starts[r + 1]; ++e) {
+			const uint32_t entry = num_ranges > 1 ? entries[e] : e;
+			const uint32_t item = entry / keys_per_item;
+			const uint32_t k = entry % keys_per_item;
+			func(item, k, get_key(item, k));
+		}
+	};
+
+	// The placement leaves the start of the next key in each key, so they are shifted back
+	std::vector<uint32_t>& key_starts = *key_starts_;
+	key_starts.resize(num_keys + 1);
+	pool.parallel_for(num_ranges, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t r = begin; r < end; ++r) {
+			const uint32_t first_key = range_first_key(r);
+			const uint32_t last_key = range_first_key(r + 1);
+			std::fill(key_starts.begin() + first_key, key_starts.begin() + last_key, 0);
+			for_each_key(r, [&](uint32_t, uint32_t, uint32_t key) { key_starts[key] += 1; });
+			uint32_t offset = range_starts[r];
+			for (uint32_t key = first_key; key < last_key; ++key) {
+				const uint32_t count = key_starts[key];
+				key_starts[key] = offset;
+				offset += count;
+			}
+			for_each_key(r, [&](uint32_t item, uint32_t k, uint32_t key) { place(item, k, key_starts[key]++); });
+			for (uint32_t key = last_key; key > first_key + 1; --key) {
+				key_starts[key - 1] = key_starts[key - 2];
+			}
+			if (first_key < last_key) {
+				key_starts[first_key] = range_starts[r];
+			}
+		}
+	});
+	key_starts[num_keys] = range_starts[num_ranges];
+}
+
+// Segments of the row j of a cloth, in the order build_cloth_data() adds them
+uint32_t cloth_row_segments(uint32_t j, const glm::uvec2& resolution, bool use_provots)
+{
+	const uint32_t x = resolution.x;
+	const bool has_next_row = j + 1 < resolution.y;
+	uint32_t count = (x > 0 ? x - 1 : 0) + (has_next_row ? x : 0);
+	if (use_provots) {
+		count += (x > 1 ? x - 2 : 0) + (j + 2 < resolution.y ? x : 0);
+		count += (has_next_row && x > 0 ? x - 1 : 0) + (j > 0 && x > 0 ? x - 1 : 0);
+	}
+	return count;
+}
+} // namespace
+
+void build_rope_data(const glm::vec3& origin, const glm::vec3& dir, float length,
+	uint32_t num_particles, uint32_t num_fixed, SpringSystemData* data)
+{
+	std::vector<Particle>& p = data->particles;
+	p.resize(num_particles);
+	const glm::vec3 n_dir = glm::normalize(dir);
+	const float delta_x = length / (float)num_particles;
+	for (uint32_t i = 0; i < num_particles; ++i) {
+		p[i].pos = origin + n_dir * ((float)i * delta_x);
+	}
+
+	std::vector<glm::ivec2>& indices = data->segments;
+	indices.resize(num_particles > 0 ? num_particles - 1 : 0);
+	for (uint32_t i = 0; i < (uint32_t)indices.size(); ++i) {
+		indices[i] = glm::ivec2(i, i + 1);
+	}
+
+	build_segment_data(data);
+	set_fixed_particles(origin, num_fixed, data);
+}
+
+void build_cloth_data(const glm::vec3& origin, const glm::uvec2& resolution, const glm::vec2& size,
+	bool use_provots, uint32_t num_fixed, SpringSystemData* data)
+{
+	// The sizes are known beforehand, so the rows are filled in parallel, each one at its offset.
+	// resize() keeps the capacity, so rebuilding a cloth of the same size does not allocate.
+	std::vector<Particle>& p = data->particles;
+	p.resize(resolution.x * resolution.y);
+	const float delta_x = size.x / (float)resolution.x;
+	const float delta_y = size.y / (float)resolution.y;
+
+	std::vector<uint32_t> row_offsets(resolution.y + 1);
+	row_offsets[0] = 0;
+	for (uint32_t j = 0; j < resolution.y; ++j) {
+		row_offsets[j + 1] = row_offsets[j] + cloth_row_segments(j, resolution, use_provots);
+	}
+
+	std::vector<glm::ivec2>& indices = data->segments;
+	indices.resize(row_offsets[resolution.y]);
+
+	ThreadPool::global().parallel_for(resolution.y, [&](uint32_t row_begin, uint32_t row_end, uint32_t) {
+		for (uint32_t j = row_begin; j < row_end; ++j) {
+			glm::ivec2* segment = indices.data() + row_offsets[j];
+			for (uint32_t i = 0; i < resolution.x; ++i) {
+				const uint32_t base = j * resolution.x + i;
+				p[base] = {};
+				p[base].pos = origin + glm::vec3((float)i * delta_x, 0.0f, (float)j * delta_y);
+
+				if (i != resolution.x - 1) {
+					*segment++ = glm::ivec2(base, base + 1);
+				}
+				if (j != resolution.y - 1) {
+					*segment++ = glm::ivec2(base, base + resolution.x);
+				}
+
+				// Provot's
+				if (use_provots) {
+					// Bend
+					if (i + 2 < resolution.x) {
+						*segment++ = glm::ivec2(base, base + 2);
+					}
+					if (j + 2 < resolution.y) {
+						*segment++ = glm::ivec2(base, base + 2 * resolution.x);
+					}
+
+					// Shear
+					if (j != resolution.y - 1 && i != resolution.x - 1) {
+						*segment++ = glm::ivec2(base, base + resolution.x + 1);
+					}
+					if (j > 0 && i != resolution.x - 1) {
+						*segment++ = glm::ivec2(base, base - resolution.x + 1);
+					}
+				}
+			}
+		}
+	}, MIN_ROWS_PER_THREAD);
+
+	// Left to build_segment_data() and build_segment_colors(), the data may be reused
+	data->original_lengths.clear();
+	data->particle2segments.clear();
+	data->segment_mappings.clear();
+	data->color_segments.clear();
+	data->color_offsets.clear();
+
+	set_fixed_particles(origin, num_fixed, data);
+}
+
+void build_hair_data(const Sphere& head, uint32_t num_hairs, uint32_t particles_per_strand,
+	float hair_length, SpringSystemData* data)
+{
+	// The roots come first, then the rest of each strand, one strand after the other.
+	// Every strand has the same layout, so they are filled in parallel at their offsets.
+	const uint32_t segments_per_strand = particles_per_strand > 0 ? particles_per_strand - 1 : 0;
+	const uint32_t num_segments = num_hairs * segments_per_strand;
+	// The root maps its segment, the last particle its previous one, the rest both
+	const uint32_t mappings_per_strand = segments_per_strand > 0 ? 2 * segments_per_strand : 1;
+
+	std::vector<Particle>& particles = data->particles;
+	particles.resize(num_hairs + num_segments);
+	data->segments.resize(num_segments);
+	data->segment_mappings.resize(num_hairs * mappings_per_strand);
+	data->particle2segments.resize(particles.size());
+
+	// fill starting points
+	fibonacci_spiral_sphere(particles.data(), num_hairs);
+	data->fixed_particles.assign(particles.begin(), particles.begin() + num_hairs);
+
+	// Create strands
+	const float delta_x = hair_length / (head.radius * (float)particles_per_strand);
+	ThreadPool::global().parallel_for(num_hairs, [&](uint32_t begin, uint32_t end, uint32_t) {
+		glm::ivec2* indices = data->segments.data();
+		SegmentMapping* mappings = data->segment_mappings.data();
+		Particle2SegmentsList* particle2segments_map = data->particle2segments.data();
+		for (uint32_t root = begin; root < end; ++root) {
+			const uint32_t first_segment = root * segments_per_strand;
+			const uint32_t first_mapping = root * mappings_per_strand;
+
+			// mappings of root (maybe are not needed...)
+			mappings[first_mapping] = { first_segment, 0 };
+			particle2segments_map[root] = { first_mapping, 1 };
+
+			const glm::vec3 dir = particles[root].pos; // it is already normalized
+			for (uint32_t i = 1; i < particles_per_strand; ++i) {
+				const uint32_t segment_idx = first_segment + i - 1;
+				const uint32_t particle_idx = num_hairs + segment_idx;
+				particles[particle_idx] = { (dir + dir * delta_x * (float)i) * head.radius + head.pos, 0.0f };
+				indices[segment_idx] = glm::ivec2(i == 1 ? root : particle_idx - 1, particle_idx);
+
+				// Always add previous segment
+				uint32_t num = 1;
+				const uint32_t idx = first_mapping + 1 + 2 * (i - 1);
+				mappings[idx] = { segment_idx, 1 };
+
+				if (i != particles_per_strand - 1) {
+					mappings[idx + 1] = { segment_idx + 1, 0 };
+					num += 1;
+				}
+
+				particle2segments_map[particle_idx] = { idx, num };
+			}
+			particles[root].pos = particles[root].pos * head.radius + head.pos;
+		}
+	}, MIN_ELEMENTS_PER_THREAD / std::max(particles_per_strand, 1u));
+
+	// Lengths on the unit sphere, as the solvers see them
+	data->original_lengths.assign(num_segments, delta_x);
+}
+
+void build_segment_data(SpringSystemData* data)
+{
+	const std::vector<Particle>& p = data->particles;
+	const std::vector<glm::ivec2>& indices = data->segments;
+	const uint32_t num_segments = (uint32_t)indices.size();
+
+	data->original_lengths.resize(num_segments);
+	ThreadPool::global().parallel_for(num_segments, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			data->original_lengths[i] = glm::length(p[indices[i].x].pos - p[indices[i].y].pos);
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+
+	// Mappings sorted by particle, in increasing segment order within each particle
+	const uint32_t num_particles = (uint32_t)p.size();
+	std::vector<SegmentMapping>& mappings = data->segment_mappings;
+	mappings.resize(2 * (size_t)num_segments);
+	std::vector<uint32_t>& starts = data->sort_key_starts;
+	parallel_counting_sort(num_segments, 2, num_particles,
+		[&indices](uint32_t idx, uint32_t k) { return (uint32_t)indices[idx][k]; },
+		[&mappings](uint32_t idx, uint32_t k, uint32_t position) { mappings[position] = { idx, k }; },
+		&data->sort_entries, &starts);
+
+	std::vector<Particle2SegmentsList>& particle2segments = data->particle2segments;
+	particle2segments.resize(num_particles);
+	ThreadPool::global().parallel_for(num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			particle2segments[i] = { starts[i], starts[i + 1] - starts[i] };
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+	data->sort_entries.clear();
+	data->sort_key_starts.clear();
+}
+
+void build_segment_colors(SpringSystemData* data)
+{
+	const std::vector<glm::ivec2>& indices = data->segments;
+	const uint32_t num_segments = (uint32_t)indices.size();
+	constexpr uint32_t NO_COLOR = UINT32_MAX;
+
+	// Lowest color not used by the other segments of both particles.
+	// Tried 64 colors at a time, with a mask per particle, until every segment has one.
+	std::vector<uint32_t> colors(num_segments, NO_COLOR);
+	std::vector<uint64_t> used_colors(data->particles.size());
+	uint32_t num_colors = 0;
+	for (uint32_t first_color = 0, remaining = num_segments; remaining > 0; first_color += 64) {
+		std::fill(used_colors.begin(), used_colors.end(), 0);
+		for (uint32_t idx = 0; idx < num_segments; ++idx) {
+			if (colors[idx] != NO_COLOR) {
+				continue;
+			}
+			uint64_t& used_0 = used_colors[indices[idx].x];
+			uint64_t& used_1 = used_colors[indices[idx].y];
+			const uint64_t used = used_0 | used_1;
+			if (used == UINT64_MAX) {
+				continue;
+			}
+			uint32_t bit = 0;
+			while ((used >> bit) & 1) {
+				bit += 1;
+			}
+			used_0 |= uint64_t(1) << bit;
+			used_1 |= uint64_t(1) << bit;
+			colors[idx] = first_color + bit;
+			num_colors = std::max(num_colors, first_color + bit + 1);
+			remaining -= 1;
+		}
+	}
+
+	// Counting sort by color
+	std::vector<uint32_t>& offsets = data->color_offsets;
+	offsets.assign(num_colors + 1, 0);
+	for (uint32_t c : colors) {
+		offsets[c + 1] += 1;
+	}
+	for (uint32_t c = 0; c < num_colors; ++c) {
+		offsets[c + 1] += offsets[c];
+	}
+	std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	data->color_segments.resize(num_segments);
+	for (uint32_t idx = 0; idx < num_segments; ++idx) {
+		data->color_segments[next[colors[idx]]++] = idx;
+	}
+}
+
+void reorder_spring_data(SpringSystemData* data, std::vector<uint32_t>* new_index_)
+{
+	std::vector<Particle>& particles = data->particles;
+	const uint32_t num_particles = (uint32_t)particles.size();
+	const uint32_t num_fixed = std::min((uint32_t)data->fixed_particles.size(), num_particles);
+
+	// Cells of the same size in every axis, over the bounds of the particles
+	glm::vec3 min_pos(0.0f), max_pos(0.0f);
+	if (num_particles != 0) {
+		min_pos = max_pos = particles[0].pos;
+	}
+	for (const Particle& p : particles) {
+		min_pos = glm::min(min_pos, p.pos);
+		max_pos = glm::max(max_pos, p.pos);
+	}
+	const glm::vec3 extent = max_pos - min_pos;
+	const float max_extent = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+	const float scale = (float)(MORTON_GRID_SIZE - 1) / max_extent;
+
+	std::vector<uint32_t> keys(num_particles);
+	ThreadPool::global().parallel_for(num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			const glm::vec3 cell = (particles[i].pos - min_pos) * scale;
+			keys[i] = morton::morton_encode((uint32_t)cell.x, (uint32_t)cell.y, (uint32_t)cell.z);
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+	// old_index[k] is the particle that goes to k. The solvers find the fixed ones by index.
+	// The keys have 30 bits, so a radix sort is stable and linear, unlike a comparison sort.
+	std::vector<uint32_t> old_index(num_particles);
+	std::iota(old_index.begin(), old_index.end(), 0);
+	radix_sort_by_key(keys, old_index.data() + num_fixed, num_particles - num_fixed);
+
+	std::vector<uint32_t>& new_index = *new_index_;
+	new_index.resize(num_particles);
+	std::vector<Particle> sorted_particles(num_particles);
+	ThreadPool::global().parallel_for(num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t k = begin; k < end; ++k) {
+			new_index[old_index[k]] = k;
+			sorted_particles[k] = particles[old_index[k]];
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+	particles.swap(sorted_particles);
+
+	// Segments, with their lengths if they have them, in order of their first particle
+	// Stable counting sort, as the first particles are below num_particles
+	std::vector<glm::ivec2>& segments = data->segments;
+	const uint32_t num_segments = (uint32_t)segments.size();
+	ThreadPool::global().parallel_for(num_segments, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t idx = begin; idx < end; ++idx) {
+			segments[idx] = glm::ivec2(new_index[segments[idx].x], new_index[segments[idx].y]);
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+	std::vector<glm::ivec2> sorted_segments(num_segments);
+	const bool has_lengths = data->original_lengths.size() == num_segments;
+	std::vector<float> sorted_lengths(has_lengths ? num_segments : 0);
+	parallel_counting_sort(num_segments, 1, num_particles,
+		[&segments](uint32_t idx, uint32_t) { return (uint32_t)std::min(segments[idx].x, segments[idx].y); },
+		[&](uint32_t idx, uint32_t, uint32_t position) {
+			sorted_segments[position] = segments[idx];
+			if (has_lengths) {
+				sorted_lengths[position] = data->original_lengths[idx];
+			}
+		},
+		&data->sort_entries, &data->sort_key_starts);
+	data->sort_entries.clear();
+	data->sort_key_starts.clear();
+	segments.swap(sorted_segments);
+	if (has_lengths) {
+		data->original_lengths.swap(sorted_lengths);
+	}
+
+	data->particle2segments.clear();
+	data->segment_mappings.clear();
+	data->color_segments.clear();
+	data->color_offsets.clear();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "spring_types.in"
+#include "intersections.comp.in"
+
+// Host copy of the buffers that describe a spring system, as filled by the
+// init functions of SpringSystem and ClothSystem before uploading them.
+struct SpringSystemData {
+	std::vector<spring::Particle> particles;
+	std::vector<glm::ivec2> segments;
+	std::vector<float> original_lengths;
+	std::vector<spring::Particle2SegmentsList> particle2segments;
+	std::vector<spring::SegmentMapping> segment_mappings;
+	// Positions relative to the interaction sphere
+	std::vector<spring::Particle> fixed_particles;
+	// Segments grouped by color, where the segments of a color share no particle.
+	// Color c holds color_segments[color_offsets[c], color_offsets[c + 1]).
+	std::vector<uint32_t> color_segments;
+	std::vector<uint32_t> color_offsets;
+
+	// Scratch of the builders. Cleared after each use but keeps its capacity, so building
+	// a system of the same size again does not allocate it, and copies of the data skip it.
+	std::vector<uint32_t> sort_entries;
+	std::vector<uint32_t> sort_key_starts;
+};
+
+// How the force of each spring reaches its two particles
+enum class ForceAccumulation {
+	// One force per segment, gathered by each particle through its segment mappings
+	eGather = 0,
+	// Added to a force per particle, one color of segments at a time. Does not read the mappings.
+	eColoredScatter = 1,
+};
+
+// Builders of the topologies of SpringSystem and ClothSystem. They do not touch OpenGL.
+
+// Straight rope of num_particles from origin along dir.
+// The first num_fixed particles are fixed, relative to origin.
+void build_rope_data(const glm::vec3& origin, const glm::vec3& dir, float length,
+	uint32_t num_particles, uint32_t num_fixed, SpringSystemData* data);
+
+// num_hairs strands of particles_per_strand particles, growing from the head sphere.
+// The roots are fixed, relative to the head on the unit sphere.
+void build_hair_data(const Sphere& head, uint32_t num_hairs, uint32_t particles_per_strand,
+	float hair_length, SpringSystemData* data);
+
+// Grid of resolution.x * resolution.y particles on the XZ plane, starting at origin.
+// Structural springs, plus bend and shear ones with Provot's model.
+// The first num_fixed particles are fixed, relative to origin.
+void build_cloth_data(const glm::vec3& origin, const glm::uvec2& resolution, const glm::vec2& size,
+	bool use_provots, uint32_t num_fixed, SpringSystemData* data);
+
+// Fill the original lengths and the segments of each particle (in increasing segment order)
+// from the particles and segments
+void build_segment_data(SpringSystemData* data);
+
+// Renumber the particles in Morton order of their positions, keeping the fixed particles
+// first, and sort the segments by their first particle, so the particles that interact
+// are close in memory. new_index[i] is the new index of the old particle i, to remap
+// indices built for the old order. The segment lists of the particles and the colors
+// must be built after.
+void reorder_spring_data(SpringSystemData* data, std::vector<uint32_t>* new_index_);
+
+// Greedy coloring of the segments, so the segments of each color can be processed in parallel
+// without two of them touching the same particle. Keeps the order of the segments.
+void build_segment_colors(SpringSystemData* data);
@@ -0,0 +1,143 @@
+#include "CpuMeshCollider.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace {
+constexpr float DET_EPSILON = 1.0e-12f;
+// Paths that cross a shared edge must hit at least one of the triangles
+constexpr float BARY_EPSILON = 1.0e-4f;
+} // namespace
+
+void CpuMeshCollider::build(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces)
+{
+	m_bvh.build(vertices, faces);
+
+	const std::vector<uint32_t>& tri_indices = m_bvh.get_triangle_indices();
+	m_triangles.resize(tri_indices.size());
+	for (size_t i = 0; i < tri_indices.size(); ++i) {
+		const glm::uvec3 f = faces[tri_indices[i]];
+		PackedTriangle& tri = m_triangles[i];
+		tri.v0 = vertices[f.x];
+		tri.e1 = vertices[f.y] - tri.v0;
+		tri.e2 = vertices[f.z] - tri.v0;
+		const glm::vec3 c = glm::cross(tri.e1, tri.e2);
+		const float len = glm::length(c);
+		// Degenerate triangles never pass the determinant test
+		tri.n = len > 0.0f ? c / len : glm::vec3(0.0f);
+		tri.d = glm::dot(tri.n, tri.v0);
+	}
+}
+
+void CpuMeshCollider::collide(uint32_t count, float bounce, glm::vec3* prev_pos_world, glm::vec3* pos_world) const
+{
+	if (m_bvh.empty() || count == 0) {
+		return;
+	}
+
+	// Lanes in SoA form. Unused lanes get an empty box and never hit.
+	alignas(32) float ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+	alignas(32) float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+	alignas(32) float min_x[PACKET_SIZE], min_y[PACKET_SIZE], min_z[PACKET_SIZE];
+	alignas(32) float max_x[PACKET_SIZE], max_y[PACKET_SIZE], max_z[PACKET_SIZE];
+
+	const auto load_lane = [&](uint32_t l) {
+		const glm::vec3 o = prev_pos_world[l];
+		const glm::vec3 d = pos_world[l] - o;
+		ox[l] = o.x; oy[l] = o.y; oz[l] = o.z;
+		dx[l] = d.x; dy[l] = d.y; dz[l] = d.z;
+		const glm::vec3 lo = glm::min(o, pos_world[l]);
+		const glm::vec3 hi = glm::max(o, pos_world[l]);
+		min_x[l] = lo.x; min_y[l] = lo.y; min_z[l] = lo.z;
+		max_x[l] = hi.x; max_y[l] = hi.y; max_z[l] = hi.z;
+	};
+	for (uint32_t l = 0; l < PACKET_SIZE; ++l) {
+		if (l < count) {
+			load_lane(l);
+		}
+		else {
+			ox[l] = oy[l] = oz[l] = 0.0f;
+			dx[l] = dy[l] = dz[l] = 0.0f;
+			min_x[l] = min_y[l] = min_z[l] = FLT_MAX;
+			max_x[l] = max_y[l] = max_z[l] = -FLT_MAX;
+		}
+	}
+
+	const std::vector<BVHNode>& nodes = m_bvh.get_nodes();
+	uint32_t stack[BVH_MAX_DEPTH];
+	uint32_t stack_size = 0;
+	uint32_t node_idx = 0;
+	while (true) {
+		const BVHNode& node = nodes[node_idx];
+
+		// Lanes whose path overlaps the node
+		uint32_t overlap[PACKET_SIZE];
+		uint32_t any_overlap = 0;
+		for (uint32_t l = 0; l < PACKET_SIZE; ++l) {
+			overlap[l] = (min_x[l] <= node.aabb_max.x) & (max_x[l] >= node.aabb_min.x)
+				& (min_y[l] <= node.aabb_max.y) & (max_y[l] >= node.aabb_min.y)
+				& (min_z[l] <= node.aabb_max.z) & (max_z[l] >= node.aabb_min.z);
+			any_overlap |= overlap[l];
+		}
+
+		if (any_overlap != 0) {
+			if (node.num_triangles == 0) {
+				// Visit the first child and leave the second one for later
+				stack[stack_size++] = node.left_or_first;
+				node_idx = node_idx + 1;
+				continue;
+			}
+
+			for (uint32_t t = node.left_or_first; t < node.left_or_first + node.num_triangles; ++t) {
+				const PackedTriangle& tri = m_triangles[t];
+
+				// Moller-Trumbore over all the lanes, the path is o + t * d with t in [0, 1]
+				uint32_t hit[PACKET_SIZE];
+				uint32_t any_hit = 0;
+				for (uint32_t l = 0; l < PACKET_SIZE; ++l) {
+					const float px = dy[l] * tri.e2.z - dz[l] * tri.e2.y;
+					const float py = dz[l] * tri.e2.x - dx[l] * tri.e2.z;
+					const float pz = dx[l] * tri.e2.y - dy[l] * tri.e2.x;
+					const float det = tri.e1.x * px + tri.e1.y * py + tri.e1.z * pz;
+					const float inv_det = 1.0f / (std::abs(det) > DET_EPSILON ? det : 1.0f);
+
+					const float tx = ox[l] - tri.v0.x;
+					const float ty = oy[l] - tri.v0.y;
+					const float tz = oz[l] - tri.v0.z;
+					const float u = (tx * px + ty * py + tz * pz) * inv_det;
+
+					const float qx = ty * tri.e1.z - tz * tri.e1.y;
+					const float qy = tz * tri.e1.x - tx * tri.e1.z;
+					const float qz = tx * tri.e1.y - ty * tri.e1.x;
+					const float v = (dx[l] * qx + dy[l] * qy + dz[l] * qz) * inv_det;
+					const float s = (tri.e2.x * qx + tri.e2.y * qy + tri.e2.z * qz) * inv_det;
+
+					hit[l] = overlap[l] & (std::abs(det) > DET_EPSILON)
+						& (u >= -BARY_EPSILON) & (v >= -BARY_EPSILON) & (u + v <= 1.0f + BARY_EPSILON)
+						& (s >= 0.0f) & (s <= 1.0f);
+					any_hit |= hit[l];
+				}
+
+				if (any_hit == 0) {
+					continue;
+				}
+				// Hits are rare, resolve them one lane at a time
+				for (uint32_t l = 0; l < count; ++l) {
+					if (hit[l] == 0) {
+						continue;
+					}
+					const glm::vec3 delta = pos_world[l] - prev_pos_world[l];
+					pos_world[l] = pos_world[l] - (1.0f + bounce) * tri.n * (glm::dot(tri.n, pos_world[l]) - tri.d);
+					prev_pos_world[l] = pos_world[l] - delta + (1.0f + bounce) * tri.n * glm::dot(tri.n, delta);
+					load_lane(l);
+				}
+			}
+		}
+
+		if (stack_size == 0) {
+			break;
+		}
+		node_idx = stack[--stack_size];
+	}
+}
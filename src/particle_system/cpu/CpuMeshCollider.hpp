@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "particle_system/MeshBVH.hpp"
+
+// CPU version of the mesh collision of advect_particles.comp.
+// Particle paths (prev -> new position) are tested in packets of PACKET_SIZE
+// against a MeshBVH. Each packet walks the tree once, and the segment-triangle test
+// is a Moller-Trumbore test written over plain lane arrays so that the compiler
+// can vectorize it.
+class CpuMeshCollider {
+public:
+	static constexpr uint32_t PACKET_SIZE = 8;
+
+	CpuMeshCollider() = default;
+
+	// Vertices must already be in world space
+	void build(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces);
+
+	bool empty() const { return m_bvh.empty(); }
+
+	// Collide count <= PACKET_SIZE particle paths against the mesh, with the same
+	// response as intersect_tri of intersections.comp.in
+	void collide(uint32_t count, float bounce, glm::vec3* prev_pos_world, glm::vec3* pos_world) const;
+
+private:
+	// Triangles in the order of the leaves of the BVH
+	struct PackedTriangle {
+		glm::vec3 v0, e1, e2;
+		glm::vec3 n;
+		float d;
+	};
+
+	MeshBVH m_bvh;
+	std::vector<PackedTriangle> m_triangles;
+};
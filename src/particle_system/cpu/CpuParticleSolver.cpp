@@ -0,0 +1,277 @@
+#include "CpuParticleSolver.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#include "emitters.hpp"
+#include "intersections.hpp"
+#include "ParticleViews.hpp"
+#include "utils/ThreadPool.hpp"
+#include "random.in"
+
+using namespace particle;
+
+namespace {
+// Minimum amount of particles that a thread processes in a parallel loop
+constexpr uint32_t MIN_PARTICLES_PER_THREAD = 4096;
+} // namespace
+
+CpuParticleSolver::CpuParticleSolver() : m_pool(&ThreadPool::global())
+{
+	m_config = {};
+}
+
+void CpuParticleSolver::initialize(const ParticleSystemConfig& config, ParticleLayout layout)
+{
+	m_config = config;
+	m_layout = layout;
+	m_emitter_states.assign(m_emitters.size(), EmitterState{});
+
+	m_flipflop_state = false;
+	m_step_idx = 0;
+	const uint32_t max_particles = m_config.max_particles;
+	for (uint32_t i = 0; i < 2; ++i) {
+		if (m_layout == ParticleLayout::eAoS) {
+			m_particles[i].assign(max_particles, Particle{ glm::vec3(0.0f), 0.0f });
+			m_positions[i].clear();
+		}
+		else {
+			m_particles[i].clear();
+			m_positions[i].assign(3 * max_particles, 0.0f);
+		}
+		m_alive_indices[i].resize(max_particles);
+		m_num_alive[i] = 0;
+	}
+	if (m_layout == ParticleLayout::eAoS) {
+		m_lifetimes.clear();
+	}
+	else {
+		m_lifetimes.assign(max_particles, 0.0f);
+	}
+
+	// Initialize dead particles (all), in the same order as the GPU version
+	m_dead_indices.resize(max_particles);
+	std::iota(m_dead_indices.rbegin(), m_dead_indices.rend(), 0);
+	m_num_dead = max_particles;
+}
+
+void CpuParticleSolver::set_config(const ParticleSystemConfig& config)
+{
+	// The storage only changes on initialize
+	const uint32_t max_particles = m_config.max_particles;
+	m_config = config;
+	m_config.max_particles = max_particles;
+}
+
+void CpuParticleSolver::set_emitters(const std::vector<Emitter>& emitters)
+{
+	if (emitters.size() != m_emitters.size()) {
+		m_emitter_states.assign(emitters.size(), EmitterState{});
+	}
+	m_emitters = emitters;
+}
+
+void CpuParticleSolver::set_mesh(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces)
+{
+	m_mesh_collider.build(vertices, faces);
+	m_mesh_vertices = vertices;
+	m_mesh_faces = faces;
+	cpu::build_area_cdf(vertices, faces, &m_mesh_area_cdf);
+}
+
+void CpuParticleSolver::step(float dt)
+{
+	const uint32_t num_particles_to_instantiate = count_emitter_particles(dt);
+	if (num_particles_to_instantiate != 0) {
+		spawn(dt, num_particles_to_instantiate);
+	}
+	advect(dt);
+
+	// flip state
+	m_flipflop_state = !m_flipflop_state;
+	m_step_idx += 1;
+}
+
+uint32_t CpuParticleSolver::count_emitter_particles(float dt)
+{
+	uint32_t num_particles = 0;
+	for (size_t e = 0; e < m_emitters.size(); ++e) {
+		EmitterState& state = m_emitter_states[e];
+		const float accum = state.accum + m_emitters[e].particles_per_second * dt;
+		const float floor_part = std::floor(accum);
+		state.accum = accum - floor_part;
+		state.num_particles = static_cast<uint32_t>(floor_part);
+		state.first_particle = num_particles;
+		num_particles += state.num_particles;
+	}
+	return num_particles;
+}
+
+void CpuParticleSolver::spawn(float dt, uint32_t num_particles_to_instantiate)
+{
+	if (m_layout == ParticleLayout::eAoS) {
+		Particle* now = m_particles[m_flipflop_state].data();
+		Particle* pre = m_particles[!m_flipflop_state].data();
+		spawn_impl(cpu::AosPositions<Particle>{ now }, cpu::AosPositions<Particle>{ pre },
+			cpu::AosLifetimes<Particle>{ now, pre }, dt, num_particles_to_instantiate);
+	}
+	else {
+		const uint32_t stride = m_config.max_particles;
+		spawn_impl(cpu::SoaPositions(m_positions[m_flipflop_state].data(), stride),
+			cpu::SoaPositions(m_positions[!m_flipflop_state].data(), stride),
+			cpu::SoaLifetimes{ m_lifetimes.data() }, dt, num_particles_to_instantiate);
+	}
+}
+
+void CpuParticleSolver::advect(float dt)
+{
+	if (m_layout == ParticleLayout::eAoS) {
+		Particle* in = m_particles[m_flipflop_state].data();
+		Particle* out = m_particles[!m_flipflop_state].data();
+		advect_impl(cpu::AosPositions<Particle>{ in }, cpu::AosPositions<Particle>{ out },
+			cpu::AosLifetimes<Particle>{ in, out }, dt);
+	}
+	else {
+		const uint32_t stride = m_config.max_particles;
+		advect_impl(cpu::SoaPositions(m_positions[m_flipflop_state].data(), stride),
+			cpu::SoaPositions(m_positions[!m_flipflop_state].data(), stride),
+			cpu::SoaLifetimes{ m_lifetimes.data() }, dt);
+	}
+}
+
+template<typename Positions, typename Lifetimes>
+void CpuParticleSolver::spawn_impl(const Positions& now, const Positions& pre, const Lifetimes& lifetimes,
+	float dt, uint32_t num_particles_to_instantiate)
+{
+	std::vector<uint32_t>& alive_indices = m_alive_indices[m_flipflop_state];
+	const uint32_t num_alive = m_num_alive[m_flipflop_state];
+
+	// Do not overcreate particles
+	const uint32_t free_slots = m_config.max_particles - std::min(num_alive, m_config.max_particles);
+	const uint32_t num_new = std::min({ num_particles_to_instantiate, free_slots, m_num_dead });
+	const uint32_t num_dead = m_num_dead;
+	const uint32_t seed = m_step_idx;
+	const cpu::EmitterMesh mesh = { &m_mesh_vertices, &m_mesh_faces, &m_mesh_area_cdf };
+
+	m_pool->parallel_for(num_new, [&](uint32_t begin, uint32_t end, uint32_t) {
+		// Last emitter whose first particle is at or before the first of the chunk.
+		// Emitters without particles share their first particle with the next one.
+		size_t e = std::upper_bound(m_emitter_states.begin(), m_emitter_states.end(), begin,
+			[](uint32_t n, const EmitterState& state) { return n < state.first_particle; })
+			- m_emitter_states.begin() - 1;
+		for (uint32_t thread_id = begin; thread_id < end; ++thread_id) {
+			const uint32_t new_part_idx = m_dead_indices[num_dead - 1 - thread_id];
+			while (thread_id >= m_emitter_states[e].first_particle + m_emitter_states[e].num_particles) {
+				e += 1;
+			}
+			const Emitter& emitter = m_emitters[e];
+
+			glm::vec3 pos, vel;
+			cpu::sample_emitter(emitter, mesh, m_config.particle_size, seed, thread_id, &pos, &vel);
+
+			float lifetime = emitter.mean_lifetime;
+			if (emitter.var_lifetime != 0.0f) {
+				lifetime += emitter.var_lifetime *
+					(2.0f * rng::random_uniform(seed, thread_id, 2) - 1.0f);
+			}
+			now.store(new_part_idx, pos);
+			lifetimes.store_in(new_part_idx, lifetime);
+			// Only need to update the previous position
+			pre.store(new_part_idx, pos - dt * vel);
+
+			alive_indices[num_alive + thread_id] = new_part_idx;
+		}
+	}, MIN_PARTICLES_PER_THREAD);
+
+	m_num_dead -= num_new;
+	m_num_alive[m_flipflop_state] += num_new;
+}
+
+template<typename Positions, typename Lifetimes>
+void CpuParticleSolver::advect_impl(const Positions& in, const Positions& out, const Lifetimes& lifetimes, float dt)
+{
+	const std::vector<uint32_t>& alive_in = m_alive_indices[m_flipflop_state];
+	std::vector<uint32_t>& alive_out = m_alive_indices[!m_flipflop_state];
+	const uint32_t num_alive_in = m_num_alive[m_flipflop_state];
+
+	// First pass: count the particles that die in each chunk, so that every thread
+	// knows where to write in the alive and dead lists without atomics.
+	// The static partition of the pool makes both passes see the same chunks.
+	m_thread_alive_offsets.assign(m_pool->get_num_threads() + 1, 0);
+	m_thread_dead_offsets.assign(m_pool->get_num_threads() + 1, 0);
+	m_pool->parallel_for(num_alive_in, [&](uint32_t begin, uint32_t end, uint32_t thread_idx) {
+		uint32_t num_dead = 0;
+		for (uint32_t i = begin; i < end; ++i) {
+			num_dead += lifetimes.load_in(alive_in[i]) <= 0.0f ? 1 : 0;
+		}
+		m_thread_dead_offsets[thread_idx + 1] = num_dead;
+		m_thread_alive_offsets[thread_idx + 1] = (end - begin) - num_dead;
+	}, MIN_PARTICLES_PER_THREAD);
+
+	std::partial_sum(m_thread_alive_offsets.begin(), m_thread_alive_offsets.end(), m_thread_alive_offsets.begin());
+	std::partial_sum(m_thread_dead_offsets.begin(), m_thread_dead_offsets.end(), m_thread_dead_offsets.begin());
+
+	// Second pass: verlet step and collisions.
+	// Alive particles are gathered in packets, so the mesh is traversed once per packet.
+	constexpr uint32_t PACKET_SIZE = CpuMeshCollider::PACKET_SIZE;
+	const bool intersect_mesh = m_intersect_mesh && !m_mesh_collider.empty();
+	const uint32_t num_dead_before = m_num_dead;
+	m_pool->parallel_for(num_alive_in, [&](uint32_t begin, uint32_t end, uint32_t thread_idx) {
+		uint32_t alive_cursor = m_thread_alive_offsets[thread_idx];
+		uint32_t dead_cursor = num_dead_before + m_thread_dead_offsets[thread_idx];
+
+		uint32_t packet_idx[PACKET_SIZE];
+		glm::vec3 packet_actual[PACKET_SIZE];
+		glm::vec3 packet_new[PACKET_SIZE];
+
+		uint32_t i = begin;
+		while (i < end) {
+			uint32_t packet_count = 0;
+			for (; i < end && packet_count < PACKET_SIZE; ++i) {
+				const uint32_t idx = alive_in[i];
+
+				if (lifetimes.load_in(idx) <= 0.0f) {
+					m_dead_indices[dead_cursor++] = idx;
+					continue;
+				}
+
+				// verlet solver
+				const glm::vec3 old_pos = out.load(idx);
+				glm::vec3 actual_pos = in.load(idx);
+				glm::vec3 new_pos = actual_pos + m_config.k_v * (actual_pos - old_pos)
+					- glm::vec3(0.0f, dt * dt * m_config.gravity, 0.0f);
+
+				cpu::intersect_walls(m_config.simulation_space_size, m_config.bounce, &actual_pos, &new_pos);
+
+				// Sphere intersection
+				if (m_intersect_sphere) {
+					cpu::intersect(m_sphere, m_config.bounce, m_config.friction, &actual_pos, &new_pos);
+				}
+
+				packet_idx[packet_count] = idx;
+				packet_actual[packet_count] = actual_pos;
+				packet_new[packet_count] = new_pos;
+				packet_count += 1;
+			}
+
+			// Triangles intersection
+			if (intersect_mesh) {
+				m_mesh_collider.collide(packet_count, m_config.bounce, packet_actual, packet_new);
+			}
+
+			for (uint32_t p = 0; p < packet_count; ++p) {
+				const uint32_t idx = packet_idx[p];
+				in.store(idx, packet_actual[p]);
+				out.store(idx, packet_new[p]);
+				lifetimes.store_out(idx, lifetimes.load_in(idx) - dt);
+
+				// update alive
+				alive_out[alive_cursor++] = idx;
+			}
+		}
+	}, MIN_PARTICLES_PER_THREAD);
+
+	m_num_alive[!m_flipflop_state] = m_thread_alive_offsets.back();
+	m_num_dead += m_thread_dead_offsets.back();
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "particle_types.in"
+#include "intersections.comp.in"
+#include "CpuMeshCollider.hpp"
+#include "particle_system/ParticleLayout.hpp"
+
+class ThreadPool;
+
+// CPU implementation of emitter_counts.comp + batch_spawner.comp + advect_particles.comp.
+// It does not touch OpenGL, so it can run without a context.
+// The state mirrors the GPU one: two particle buffers that swap roles each step,
+// two alive index lists and a dead index stack.
+class CpuParticleSolver {
+public:
+	CpuParticleSolver();
+
+	CpuParticleSolver(const CpuParticleSolver&) = delete;
+	CpuParticleSolver& operator=(const CpuParticleSolver&) = delete;
+
+	// Resize the storage to config.max_particles and kill all particles
+	void initialize(const particle::ParticleSystemConfig& config,
+		ParticleLayout layout = ParticleLayout::eAoS);
+
+	// Update parameters that do not need to reset the simulation
+	void set_config(const particle::ParticleSystemConfig& config);
+
+	// The emitters keep the fraction of particle they carry, unless their number changes
+	void set_emitters(const std::vector<particle::Emitter>& emitters);
+
+	void set_sphere(const Sphere& sphere) { m_sphere = sphere; }
+	void set_intersect_sphere(bool enabled) { m_intersect_sphere = enabled; }
+
+	// Vertices must already be in world space
+	void set_mesh(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces);
+	void set_intersect_mesh(bool enabled) { m_intersect_mesh = enabled; }
+
+	// Spawn the particles of the emitters and advect all the alive ones
+	void step(float dt);
+
+	ParticleLayout get_layout() const { return m_layout; }
+
+	// Particles with the positions of the last step. Only the ones in the alive list are meaningful.
+	// Empty unless the layout is ParticleLayout::eAoS.
+	const std::vector<particle::Particle>& get_particles() const { return m_particles[m_flipflop_state]; }
+	// Same for ParticleLayout::eSoA: x, y and z arrays with a stride of max_particles, and the lifetimes
+	const std::vector<float>& get_positions() const { return m_positions[m_flipflop_state]; }
+	const std::vector<float>& get_lifetimes() const { return m_lifetimes; }
+	const std::vector<uint32_t>& get_alive_indices() const { return m_alive_indices[m_flipflop_state]; }
+	uint32_t get_num_alive() const { return m_num_alive[m_flipflop_state]; }
+
+	void set_thread_pool(ThreadPool* pool) { m_pool = pool; }
+
+private:
+	particle::ParticleSystemConfig m_config;
+	std::vector<particle::Emitter> m_emitters;
+	// Same as the emitter states of the GPU
+	std::vector<particle::EmitterState> m_emitter_states;
+
+	ThreadPool* m_pool;
+
+	ParticleLayout m_layout = ParticleLayout::eAoS;
+	bool m_flipflop_state = false;
+	std::vector<particle::Particle> m_particles[2];
+	std::vector<float> m_positions[2];
+	std::vector<float> m_lifetimes;
+	std::vector<uint32_t> m_alive_indices[2];
+	uint32_t m_num_alive[2] = { 0, 0 };
+	std::vector<uint32_t> m_dead_indices;
+	uint32_t m_num_dead = 0;
+	// Seed of the spawner
+	uint32_t m_step_idx = 0;
+
+	// Per thread counters of the advect pass
+	std::vector<uint32_t> m_thread_alive_offsets;
+	std::vector<uint32_t> m_thread_dead_offsets;
+
+	bool m_intersect_sphere = true;
+	Sphere m_sphere = { glm::vec3(0.0f), 0.0f };
+
+	bool m_intersect_mesh = true;
+	CpuMeshCollider m_mesh_collider;
+	// For the mesh emitters
+	std::vector<glm::vec3> m_mesh_vertices;
+	std::vector<glm::uvec3> m_mesh_faces;
+	std::vector<float> m_mesh_area_cdf;
+
+	// Particles of each emitter this step, like emitter_counts.comp. Returns the total.
+	uint32_t count_emitter_particles(float dt);
+	void spawn(float dt, uint32_t num_particles_to_instantiate);
+	void advect(float dt);
+
+	// Kernels over the cpu:: views of ParticleViews.hpp
+	template<typename Positions, typename Lifetimes>
+	void spawn_impl(const Positions& now, const Positions& pre, const Lifetimes& lifetimes,
+		float dt, uint32_t num_particles_to_instantiate);
+	template<typename Positions, typename Lifetimes>
+	void advect_impl(const Positions& in, const Positions& out, const Lifetimes& lifetimes, float dt);
+};
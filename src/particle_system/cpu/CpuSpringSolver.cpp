@@ -0,0 +1,454 @@
+#include "CpuSpringSolver.hpp"
+
+#include "intersections.hpp"
+#include "ParticleViews.hpp"
+#include "utils/ThreadPool.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+using namespace spring;
+
+namespace {
+// Minimum amount of work items that a thread processes in a parallel loop
+constexpr uint32_t MIN_STRANDS_PER_THREAD = 64;
+constexpr uint32_t MIN_ELEMENTS_PER_THREAD = 4096;
+
+// Same as qtransform in advect_particles_springs.comp
+glm::vec3 qtransform(const glm::quat& q, const glm::vec3& v) {
+	const glm::vec3 q_xyz(q.x, q.y, q.z);
+	return v + 2.0f * glm::cross(glm::cross(v, q_xyz) + q.w * v, q_xyz);
+}
+} // namespace
+
+CpuSpringSolver::CpuSpringSolver() : m_pool(&ThreadPool::global())
+{
+	m_config = {};
+}
+
+void CpuSpringSolver::initialize(const SpringSystemConfig& config, SpringSystemData data,
+	ParticleLayout layout)
+{
+	m_config = config;
+	m_data = std::move(data);
+	m_layout = layout;
+
+	m_flipflop_state = false;
+	for (uint32_t i = 0; i < 2; ++i) {
+		if (m_layout == ParticleLayout::eAoS) {
+			m_particles[i] = m_data.particles;
+			m_positions[i].clear();
+		}
+		else {
+			m_particles[i].clear();
+			positions_to_soa(m_data.particles, &m_positions[i]);
+		}
+	}
+	m_forces.assign(config.num_segments, glm::vec3(0.0f));
+	update_segment_colors();
+
+	// Strands are laid out as consecutive runs of num_particles_per_strand - 1 segments
+	m_num_strands = 0;
+	m_segments_per_strand = 0;
+	const uint32_t particles_per_strand = config.num_particles_per_strand;
+	if (particles_per_strand > 1) {
+		const uint32_t num_strands = config.num_particles / particles_per_strand;
+		if (num_strands * (particles_per_strand - 1) == config.num_segments) {
+			m_num_strands = num_strands;
+			m_segments_per_strand = particles_per_strand - 1;
+		}
+	}
+}
+
+void CpuSpringSolver::set_force_accumulation(ForceAccumulation accumulation)
+{
+	m_force_accumulation = accumulation;
+	update_segment_colors();
+}
+
+void CpuSpringSolver::set_integrator(Integrator integrator)
+{
+	m_integrator = integrator;
+	update_segment_colors();
+}
+
+void CpuSpringSolver::update_segment_colors()
+{
+	const bool needs_colors = m_integrator == Integrator::eXPBD
+		|| m_force_accumulation == ForceAccumulation::eColoredScatter;
+	if (needs_colors && m_data.color_offsets.empty() && !m_data.segments.empty()) {
+		build_segment_colors(&m_data);
+	}
+}
+
+void CpuSpringSolver::set_config(const SpringSystemConfig& config)
+{
+	// Keep the sizes of the current system
+	const SpringSystemConfig old = m_config;
+	m_config = config;
+	m_config.num_particles = old.num_particles;
+	m_config.num_segments = old.num_segments;
+	m_config.num_fixed_particles = old.num_fixed_particles;
+	m_config.num_particles_per_strand = old.num_particles_per_strand;
+}
+
+void CpuSpringSolver::step(float dt, const glm::quat& base_rotation)
+{
+	if (m_layout == ParticleLayout::eAoS) {
+		const cpu::AosPositions<Particle> in{ m_particles[m_flipflop_state].data() };
+		const cpu::AosPositions<Particle> out{ m_particles[!m_flipflop_state].data() };
+		if (m_integrator == Integrator::eImplicit) {
+			step_implicit(in, out, dt, base_rotation);
+		}
+		else if (m_integrator == Integrator::eXPBD) {
+			step_xpbd(in, out, dt, base_rotation);
+		}
+		else {
+			step_impl(in, out, dt, base_rotation);
+		}
+	}
+	else {
+		const uint32_t stride = m_config.num_particles;
+		const cpu::SoaPositions in(m_positions[m_flipflop_state].data(), stride);
+		const cpu::SoaPositions out(m_positions[!m_flipflop_state].data(), stride);
+		if (m_integrator == Integrator::eImplicit) {
+			step_implicit(in, out, dt, base_rotation);
+		}
+		else if (m_integrator == Integrator::eXPBD) {
+			step_xpbd(in, out, dt, base_rotation);
+		}
+		else {
+			step_impl(in, out, dt, base_rotation);
+		}
+	}
+
+	// flip state
+	m_flipflop_state = !m_flipflop_state;
+}
+
+template<typename Positions>
+void CpuSpringSolver::step_impl(const Positions& in, const Positions& out, float dt, const glm::quat& base_rotation)
+{
+	if (m_force_accumulation == ForceAccumulation::eColoredScatter) {
+		m_particle_forces.assign(m_config.num_particles, glm::vec3(0.0f));
+		// The segments of a color share no particle, so they can add their forces in parallel
+		for (uint32_t color = 0; color < get_num_colors(); ++color) {
+			const uint32_t first = m_data.color_offsets[color];
+			m_pool->parallel_for(m_data.color_offsets[color + 1] - first, [&](uint32_t begin, uint32_t end, uint32_t) {
+				for (uint32_t k = first + begin; k < first + end; ++k) {
+					const uint32_t s = m_data.color_segments[k];
+					compute_force(in, out, s, dt);
+					m_particle_forces[m_data.segments[s].x] += m_forces[s];
+					m_particle_forces[m_data.segments[s].y] -= m_forces[s];
+				}
+			}, MIN_ELEMENTS_PER_THREAD);
+		}
+
+		m_pool->parallel_for(m_config.num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t i = begin; i < end; ++i) {
+				advect_particle(in, out, i, dt, base_rotation);
+			}
+		}, MIN_ELEMENTS_PER_THREAD);
+	}
+	else if (m_num_strands != 0) {
+		// Every segment of a strand only touches particles of the same strand,
+		// so both passes can run back to back inside each worker
+		m_pool->parallel_for(m_num_strands, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t strand = begin; strand < end; ++strand) {
+				const uint32_t first_segment = strand * m_segments_per_strand;
+				const uint32_t end_segment = first_segment + m_segments_per_strand;
+				for (uint32_t s = first_segment; s < end_segment; ++s) {
+					compute_force(in, out, s, dt);
+				}
+
+				advect_particle(in, out, m_data.segments[first_segment].x, dt, base_rotation);
+				for (uint32_t s = first_segment; s < end_segment; ++s) {
+					advect_particle(in, out, m_data.segments[s].y, dt, base_rotation);
+				}
+			}
+		}, MIN_STRANDS_PER_THREAD);
+	}
+	else {
+		m_pool->parallel_for(m_config.num_segments, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t s = begin; s < end; ++s) {
+				compute_force(in, out, s, dt);
+			}
+		}, MIN_ELEMENTS_PER_THREAD);
+
+		m_pool->parallel_for(m_config.num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t i = begin; i < end; ++i) {
+				advect_particle(in, out, i, dt, base_rotation);
+			}
+		}, MIN_ELEMENTS_PER_THREAD);
+	}
+}
+
+template<typename Positions>
+void CpuSpringSolver::compute_force(const Positions& in, const Positions& out, uint32_t idx, float dt)
+{
+	const uint32_t i0 = m_data.segments[idx].x;
+	const uint32_t i1 = m_data.segments[idx].y;
+
+	const glm::vec3 p0 = in.load(i0);
+	const glm::vec3 p1 = in.load(i1);
+	const glm::vec3 p0_pre = out.load(i0);
+	const glm::vec3 p1_pre = out.load(i1);
+
+	const glm::vec3 dir_m = p1 - p0;
+	const float dist = glm::length(dir_m);
+	const glm::vec3 dir = dir_m / dist;
+	const glm::vec3 delta_v = p1 - p1_pre - p0 + p0_pre;
+
+	m_forces[idx] = dir * (
+		m_config.k_e * (dist - m_data.original_lengths[idx]) +
+		m_config.k_d / dt * glm::dot(dir, delta_v)
+		);
+}
+
+template<typename Positions>
+void CpuSpringSolver::advect_particle(const Positions& in, const Positions& out, uint32_t idx, float dt, const glm::quat& base_rotation)
+{
+	if (idx < m_config.num_fixed_particles) {
+		out.store(idx, qtransform(base_rotation, m_data.fixed_particles[idx].pos) + m_sphere_head.pos);
+		return;
+	}
+
+	// get forces
+	const glm::vec3 force = m_force_accumulation == ForceAccumulation::eColoredScatter ?
+		m_particle_forces[idx] : gather_segments(m_forces, idx);
+
+	// verlet solver
+	const glm::vec3 old_pos = out.load(idx);
+	const glm::vec3 actual_pos = in.load(idx);
+	const glm::vec3 new_pos = actual_pos
+		+ m_config.k_v * (actual_pos - old_pos)
+		+ dt * dt * (
+			glm::vec3(0.0f, -m_config.gravity, 0.0f)
+			+ force / m_config.particle_mass // forces to acceleration
+			);
+
+	store_particle(in, out, idx, actual_pos, new_pos);
+}
+
+template<typename Positions>
+void CpuSpringSolver::store_particle(const Positions& in, const Positions& out, uint32_t idx,
+	glm::vec3 actual_pos, glm::vec3 new_pos)
+{
+	cpu::intersect_walls(m_config.simulation_space_size, m_config.bounce, &actual_pos, &new_pos);
+
+	// Sphere intersection
+	if (m_intersect_sphere) {
+		cpu::intersect(m_sphere, m_config.bounce, m_config.friction, &actual_pos, &new_pos);
+	}
+	if (m_intersect_sphere_head) {
+		cpu::intersect(m_sphere_head, m_config.bounce, m_config.friction, &actual_pos, &new_pos);
+	}
+
+	in.store(idx, actual_pos);
+	out.store(idx, new_pos);
+}
+
+glm::vec3 CpuSpringSolver::gather_segments(const std::vector<glm::vec3>& values, uint32_t idx) const
+{
+	glm::vec3 sum(0.0f);
+	const Particle2SegmentsList p2s = m_data.particle2segments[idx];
+	for (uint32_t i = 0; i < p2s.num_segments; ++i) {
+		const SegmentMapping map = m_data.segment_mappings[i + p2s.segment_mapping_idx];
+		const glm::vec3 value = values[map.segment_idx];
+		sum += (map.invert_force == 0) ? value : -value;
+	}
+	return sum;
+}
+
+template<typename Func>
+double CpuSpringSolver::parallel_sum(const Func& func)
+{
+	std::fill(m_partial_sums.begin(), m_partial_sums.end(), 0.0);
+	m_pool->parallel_for(m_config.num_particles, [&](uint32_t begin, uint32_t end, uint32_t thread_idx) {
+		double sum = 0.0;
+		for (uint32_t i = begin; i < end; ++i) {
+			sum += func(i);
+		}
+		m_partial_sums[thread_idx] = sum;
+	}, MIN_ELEMENTS_PER_THREAD);
+	return std::accumulate(m_partial_sums.begin(), m_partial_sums.end(), 0.0);
+}
+
+void CpuSpringSolver::multiply_system(const std::vector<glm::vec3>& x, std::vector<glm::vec3>* y_)
+{
+	std::vector<glm::vec3>& y = *y_;
+	// Each spring pulls its ends towards the same change of velocity
+	m_pool->parallel_for(m_config.num_segments, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t s = begin; s < end; ++s) {
+			m_segment_products[s] = m_system_blocks[s] * (x[m_data.segments[s].y] - x[m_data.segments[s].x]);
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+
+	m_pool->parallel_for(m_config.num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			y[i] = i < m_config.num_fixed_particles ? glm::vec3(0.0f)
+				: m_config.particle_mass * x[i] - gather_segments(m_segment_products, i);
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+}
+
+template<typename Positions>
+void CpuSpringSolver::step_implicit(const Positions& in, const Positions& out, float dt, const glm::quat& base_rotation)
+{
+	const uint32_t num_particles = m_config.num_particles;
+	const uint32_t num_fixed = m_config.num_fixed_particles;
+	const float mass = m_config.particle_mass;
+	m_system_blocks.resize(m_config.num_segments);
+	m_segment_products.resize(m_config.num_segments);
+	for (std::vector<glm::vec3>* v : { &m_velocities, &m_dv, &m_residual, &m_direction, &m_product, &m_inv_diagonal }) {
+		v->resize(num_particles);
+	}
+	m_partial_sums.resize(m_pool->get_num_threads());
+
+	// Velocities of the last step, with the damping of the Verlet step
+	m_pool->parallel_for(num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			m_velocities[i] = m_config.k_v * (in.load(i) - out.load(i)) / dt;
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+
+	// Forces of the springs plus dt df/dx v, and the blocks of the system
+	m_pool->parallel_for(m_config.num_segments, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t s = begin; s < end; ++s) {
+			const uint32_t i0 = m_data.segments[s].x;
+			const uint32_t i1 = m_data.segments[s].y;
+			const glm::vec3 dir_m = in.load(i1) - in.load(i0);
+			const float dist = glm::length(dir_m);
+			const glm::vec3 dir = dist > 0.0f ? dir_m / dist : glm::vec3(0.0f);
+			const glm::mat3 dd = glm::outerProduct(dir, dir);
+			// Without the compressed part, so that the blocks stay positive semidefinite
+			const float stretch = dist > 0.0f ? std::max(1.0f - m_data.original_lengths[s] / dist, 0.0f) : 0.0f;
+			const glm::mat3 stiffness = m_config.k_e * (dd + stretch * (glm::mat3(1.0f) - dd));
+			const glm::vec3 delta_v = m_velocities[i1] - m_velocities[i0];
+
+			m_forces[s] = dir * (
+				m_config.k_e * (dist - m_data.original_lengths[s]) +
+				m_config.k_d * glm::dot(dir, delta_v)
+				) + dt * (stiffness * delta_v);
+			m_system_blocks[s] = dt * dt * stiffness + dt * m_config.k_d * dd;
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+
+	// Right hand side and Jacobi preconditioner. The fixed particles keep a zero residual.
+	const glm::vec3 gravity(0.0f, -m_config.gravity, 0.0f);
+	double rz = parallel_sum([&](uint32_t i) {
+		m_dv[i] = glm::vec3(0.0f);
+		if (i < num_fixed) {
+			m_residual[i] = m_direction[i] = m_inv_diagonal[i] = glm::vec3(0.0f);
+			return 0.0;
+		}
+		glm::vec3 diagonal(mass);
+		const Particle2SegmentsList p2s = m_data.particle2segments[i];
+		for (uint32_t k = 0; k < p2s.num_segments; ++k) {
+			const glm::mat3& block = m_system_blocks[m_data.segment_mappings[k + p2s.segment_mapping_idx].segment_idx];
+			diagonal += glm::vec3(block[0][0], block[1][1], block[2][2]);
+		}
+		m_inv_diagonal[i] = 1.0f / diagonal;
+		m_residual[i] = dt * (mass * gravity + gather_segments(m_forces, i));
+		m_direction[i] = m_inv_diagonal[i] * m_residual[i];
+		return (double)glm::dot(m_residual[i], m_direction[i]);
+	});
+
+	const double threshold = rz * (double)m_cg_tolerance * (double)m_cg_tolerance;
+	m_cg_iterations = 0;
+	while (m_cg_iterations < m_cg_max_iterations && rz > threshold) {
+		multiply_system(m_direction, &m_product);
+		const double curvature = parallel_sum([&](uint32_t i) {
+			return (double)glm::dot(m_direction[i], m_product[i]);
+		});
+		if (curvature <= 0.0) {
+			break;
+		}
+		const float alpha = (float)(rz / curvature);
+		const double rz_new = parallel_sum([&](uint32_t i) {
+			m_dv[i] += alpha * m_direction[i];
+			m_residual[i] -= alpha * m_product[i];
+			return (double)glm::dot(m_residual[i], m_inv_diagonal[i] * m_residual[i]);
+		});
+		const float beta = (float)(rz_new / rz);
+		rz = rz_new;
+		m_pool->parallel_for(num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t i = begin; i < end; ++i) {
+				m_direction[i] = m_inv_diagonal[i] * m_residual[i] + beta * m_direction[i];
+			}
+		}, MIN_ELEMENTS_PER_THREAD);
+		m_cg_iterations += 1;
+	}
+
+	m_pool->parallel_for(num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			if (i < num_fixed) {
+				out.store(i, qtransform(base_rotation, m_data.fixed_particles[i].pos) + m_sphere_head.pos);
+				continue;
+			}
+			const glm::vec3 actual_pos = in.load(i);
+			store_particle(in, out, i, actual_pos, actual_pos + dt * (m_velocities[i] + m_dv[i]));
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+}
+
+template<typename Positions>
+void CpuSpringSolver::step_xpbd(const Positions& in, const Positions& out, float dt, const glm::quat& base_rotation)
+{
+	const uint32_t num_fixed = m_config.num_fixed_particles;
+	const glm::vec3 gravity(0.0f, -m_config.gravity, 0.0f);
+
+	// Predicted positions, written over the old ones in out
+	m_pool->parallel_for(m_config.num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			if (i < num_fixed) {
+				out.store(i, qtransform(base_rotation, m_data.fixed_particles[i].pos) + m_sphere_head.pos);
+				continue;
+			}
+			const glm::vec3 actual_pos = in.load(i);
+			out.store(i, actual_pos + m_config.k_v * (actual_pos - out.load(i)) + dt * dt * gravity);
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+
+	// Same mass for every particle, the fixed ones do not move
+	const float inv_mass = 1.0f / m_config.particle_mass;
+	const float alpha = m_xpbd_compliance / (dt * dt);
+	m_lambdas.assign(m_config.num_segments, 0.0f);
+	const uint32_t num_colors = get_num_colors();
+	for (uint32_t iteration = 0; iteration < m_xpbd_iterations; ++iteration) {
+		for (uint32_t color = 0; color < num_colors; ++color) {
+			const uint32_t first = m_data.color_offsets[color];
+			m_pool->parallel_for(m_data.color_offsets[color + 1] - first, [&](uint32_t begin, uint32_t end, uint32_t) {
+				for (uint32_t k = first + begin; k < first + end; ++k) {
+					const uint32_t s = m_data.color_segments[k];
+					const uint32_t i0 = m_data.segments[s].x;
+					const uint32_t i1 = m_data.segments[s].y;
+					const float w0 = i0 < num_fixed ? 0.0f : inv_mass;
+					const float w1 = i1 < num_fixed ? 0.0f : inv_mass;
+					const float w = w0 + w1 + alpha;
+					const glm::vec3 p0 = out.load(i0);
+					const glm::vec3 p1 = out.load(i1);
+					const glm::vec3 dir_m = p1 - p0;
+					const float dist = glm::length(dir_m);
+					if (w == 0.0f || dist == 0.0f) {
+						continue;
+					}
+
+					const float c = dist - m_data.original_lengths[s];
+					const float delta_lambda = (-c - alpha * m_lambdas[s]) / w;
+					m_lambdas[s] += delta_lambda;
+					const glm::vec3 correction = (delta_lambda / dist) * dir_m;
+					out.store(i0, p0 - w0 * correction);
+					out.store(i1, p1 + w1 * correction);
+				}
+			}, MIN_ELEMENTS_PER_THREAD);
+		}
+	}
+
+	m_pool->parallel_for(m_config.num_particles, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = std::max(begin, num_fixed); i < end; ++i) {
+			store_particle(in, out, i, in.load(i), out.load(i));
+		}
+	}, MIN_ELEMENTS_PER_THREAD);
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include "spring_types.in"
+#include "intersections.comp.in"
+#include "particle_system/SpringSystemData.hpp"
+#include "particle_system/ParticleLayout.hpp"
+
+class ThreadPool;
+
+// CPU implementation of spring_forces.comp + advect_particles_springs.comp.
+// When the system is made of strands (num_particles_per_strand > 1) each worker
+// takes whole strands and runs both passes on them, so a step needs no
+// synchronization between threads. Otherwise the two passes run one after the other.
+// With ForceAccumulation::eColoredScatter the forces are instead added to the particles
+// one color of segments at a time, and the strands are not processed on their own.
+//
+// The implicit integrator instead solves a backward Euler step of the whole system,
+// (M - dt^2 df/dx - dt df/dv) dv = dt (f + dt df/dx v), with a matrix-free conjugate gradient.
+// The springs only keep their 3x3 blocks of the Jacobian, so each iteration is a pass
+// over the segments and a gather per particle, like the forces of the explicit step.
+// It stays stable with stiff springs and large steps, at the cost of some damping.
+//
+// The XPBD integrator treats the segments as distance constraints instead of springs.
+// It projects them with Gauss-Seidel, one color of segments at a time, so the
+// segments of each parallel loop share no particle. See build_segment_colors().
+class CpuSpringSolver {
+public:
+	enum class Integrator {
+		// Same as advect_particles_springs.comp
+		eVerlet = 0,
+		eImplicit = 1,
+		eXPBD = 2,
+	};
+
+	CpuSpringSolver();
+
+	CpuSpringSolver(const CpuSpringSolver&) = delete;
+	CpuSpringSolver& operator=(const CpuSpringSolver&) = delete;
+
+	// The data is kept by the solver. Move it in when the caller does not need it after.
+	void initialize(const spring::SpringSystemConfig& config, SpringSystemData data,
+		ParticleLayout layout = ParticleLayout::eAoS);
+
+	// Update parameters that do not change the topology
+	void set_config(const spring::SpringSystemConfig& config);
+
+	void set_sphere(const Sphere& sphere) { m_sphere = sphere; }
+	void set_intersect_sphere(bool enabled) { m_intersect_sphere = enabled; }
+	void set_sphere_head(const Sphere& sphere) { m_sphere_head = sphere; }
+	void set_intersect_sphere_head(bool enabled) { m_intersect_sphere_head = enabled; }
+
+	void step(float dt, const glm::quat& base_rotation);
+
+	// Of the Verlet integrator
+	void set_force_accumulation(ForceAccumulation accumulation);
+	ForceAccumulation get_force_accumulation() const { return m_force_accumulation; }
+
+	void set_integrator(Integrator integrator);
+	Integrator get_integrator() const { return m_integrator; }
+	// Limits of the conjugate gradient of the implicit integrator.
+	// The tolerance is relative to the preconditioned residual of the first iteration.
+	void set_cg_max_iterations(uint32_t iterations) { m_cg_max_iterations = iterations; }
+	uint32_t get_cg_max_iterations() const { return m_cg_max_iterations; }
+	void set_cg_tolerance(float tolerance) { m_cg_tolerance = tolerance; }
+	float get_cg_tolerance() const { return m_cg_tolerance; }
+	// Iterations of the last implicit step
+	uint32_t get_cg_iterations() const { return m_cg_iterations; }
+	// Passes over all the constraints of the XPBD integrator
+	void set_xpbd_iterations(uint32_t iterations) { m_xpbd_iterations = iterations; }
+	uint32_t get_xpbd_iterations() const { return m_xpbd_iterations; }
+	// Inverse stiffness of the constraints. 0 makes the segments inextensible.
+	void set_xpbd_compliance(float compliance) { m_xpbd_compliance = compliance; }
+	float get_xpbd_compliance() const { return m_xpbd_compliance; }
+	// 0 until a mode that needs the colors is selected
+	uint32_t get_num_colors() const {
+		return m_data.color_offsets.empty() ? 0 : (uint32_t)m_data.color_offsets.size() - 1;
+	}
+
+	ParticleLayout get_layout() const { return m_layout; }
+
+	// Positions of the last step. Empty unless the layout is ParticleLayout::eAoS.
+	const std::vector<spring::Particle>& get_particles() const { return m_particles[m_flipflop_state]; }
+	// Same for ParticleLayout::eSoA: x, y and z arrays with a stride of num_particles
+	const std::vector<float>& get_positions() const { return m_positions[m_flipflop_state]; }
+
+	// Number of strands processed independently. 0 if the system is not made of strands.
+	uint32_t get_num_strands() const { return m_num_strands; }
+
+	void set_thread_pool(ThreadPool* pool) { m_pool = pool; }
+
+private:
+	spring::SpringSystemConfig m_config;
+	ThreadPool* m_pool;
+
+	ParticleLayout m_layout = ParticleLayout::eAoS;
+	bool m_flipflop_state = false;
+	std::vector<spring::Particle> m_particles[2];
+	std::vector<float> m_positions[2];
+	std::vector<glm::vec3> m_forces;
+	// Per particle, with ForceAccumulation::eColoredScatter
+	std::vector<glm::vec3> m_particle_forces;
+	ForceAccumulation m_force_accumulation = ForceAccumulation::eGather;
+	SpringSystemData m_data;
+
+	uint32_t m_num_strands = 0;
+	uint32_t m_segments_per_strand = 0;
+
+	bool m_intersect_sphere = true;
+	Sphere m_sphere = { glm::vec3(0.0f), 0.0f };
+	bool m_intersect_sphere_head = false;
+	Sphere m_sphere_head = { glm::vec3(0.0f), 0.0f };
+
+	Integrator m_integrator = Integrator::eVerlet;
+	uint32_t m_cg_max_iterations = 50;
+	float m_cg_tolerance = 1e-4f;
+	uint32_t m_cg_iterations = 0;
+	// Scratch of the implicit step. Per segment: the blocks dt^2 K + dt D of the system
+	// and their products. Per particle: the CG vectors.
+	std::vector<glm::mat3> m_system_blocks;
+	std::vector<glm::vec3> m_segment_products;
+	std::vector<glm::vec3> m_velocities, m_dv, m_residual, m_direction, m_product;
+	std::vector<glm::vec3> m_inv_diagonal;
+	// One per thread of the pool
+	std::vector<double> m_partial_sums;
+
+	uint32_t m_xpbd_iterations = 10;
+	float m_xpbd_compliance = 0.0f;
+	// Lagrange multiplier of each constraint during the step
+	std::vector<float> m_lambdas;
+
+	// Color the segments if the integrator or the accumulation of the forces need them.
+	// Done the first time they are selected, as coloring a big system is slow.
+	void update_segment_colors();
+
+	// Kernels over the cpu:: views of ParticleViews.hpp
+	template<typename Positions>
+	void step_impl(const Positions& in, const Positions& out, float dt, const glm::quat& base_rotation);
+	template<typename Positions>
+	void compute_force(const Positions& in, const Positions& out, uint32_t segment_idx, float dt);
+	template<typename Positions>
+	void advect_particle(const Positions& in, const Positions& out, uint32_t idx, float dt, const glm::quat& base_rotation);
+	template<typename Positions>
+	void step_implicit(const Positions& in, const Positions& out, float dt, const glm::quat& base_rotation);
+	template<typename Positions>
+	void step_xpbd(const Positions& in, const Positions& out, float dt, const glm::quat& base_rotation);
+	// Collide the move of a particle with the walls and the spheres, and store it
+	template<typename Positions>
+	void store_particle(const Positions& in, const Positions& out, uint32_t idx, glm::vec3 actual_pos, glm::vec3 new_pos);
+
+	// Sum of the segment values of a particle, with the sign of its end
+	glm::vec3 gather_segments(const std::vector<glm::vec3>& values, uint32_t idx) const;
+	// y = A x, the matrix of the implicit step, with the fixed particles filtered out
+	void multiply_system(const std::vector<glm::vec3>& x, std::vector<glm::vec3>* y_);
+	// Sum of func(i) over the particles, in parallel
+	template<typename Func>
+	double parallel_sum(const Func& func);
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// Accessors used by the CPU solvers to run the same kernels over both ParticleLayout.
+// They mirror the load_* / store_* functions of particle_storage.in.
+namespace cpu {
+
+// Positions inside an array of particle structs
+template<typename P>
+struct AosPositions {
+	P* particles;
+
+	glm::vec3 load(uint32_t i) const { return particles[i].pos; }
+	void store(uint32_t i, const glm::vec3& pos) const { particles[i].pos = pos; }
+};
+
+// Positions as x, y and z arrays
+struct SoaPositions {
+	float* x;
+	float* y;
+	float* z;
+
+	SoaPositions(float* data, uint32_t stride) : x(data), y(data + stride), z(data + 2 * stride) {}
+
+	glm::vec3 load(uint32_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+	void store(uint32_t i, const glm::vec3& pos) const {
+		x[i] = pos.x;
+		y[i] = pos.y;
+		z[i] = pos.z;
+	}
+};
+
+// Lifetimes stored next to the positions of the in and out buffers
+template<typename P>
+struct AosLifetimes {
+	P* particles_in;
+	P* particles_out;
+
+	float load_in(uint32_t i) const { return particles_in[i].lifetime; }
+	void store_in(uint32_t i, float lifetime) const { particles_in[i].lifetime = lifetime; }
+	void store_out(uint32_t i, float lifetime) const { particles_out[i].lifetime = lifetime; }
+};
+
+// Lifetimes in a single array shared by both steps
+struct SoaLifetimes {
+	float* lifetimes;
+
+	float load_in(uint32_t i) const { return lifetimes[i]; }
+	void store_in(uint32_t i, float lifetime) const { lifetimes[i] = lifetime; }
+	void store_out(uint32_t i, float lifetime) const { lifetimes[i] = lifetime; }
+};
+
+} // namespace cpu
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "particle_types.in"
+#include "random.in"
+
+// C++ versions of the emitter shapes of batch_spawner.comp. They must be kept in sync with the GLSL code.
+namespace cpu {
+
+// Cumulative area of the triangles, normalized so the last one is 1.
+// Empty if the mesh has no area.
+inline void build_area_cdf(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces,
+	std::vector<float>* cdf_) {
+	std::vector<float>& cdf = *cdf_;
+	cdf.resize(faces.size());
+	double total = 0.0;
+	for (size_t i = 0; i < faces.size(); ++i) {
+		const glm::uvec3& f = faces[i];
+		total += 0.5 * glm::length(glm::cross(vertices[f.y] - vertices[f.x], vertices[f.z] - vertices[f.x]));
+		cdf[i] = (float)total;
+	}
+	if (total <= 0.0) {
+		cdf.clear();
+		return;
+	}
+	for (float& c : cdf) {
+		c = (float)(c / total);
+	}
+	cdf.back() = 1.0f;
+}
+
+// Mesh of the EMITTER_MESH emitters, in world space
+struct EmitterMesh {
+	const std::vector<glm::vec3>* vertices;
+	const std::vector<glm::uvec3>* faces;
+	const std::vector<float>* area_cdf;
+};
+
+// Position and initial velocity of the particle n of the step. Same random dimensions as the shader.
+inline void sample_emitter(const particle::Emitter& e, const EmitterMesh& mesh, float particle_size,
+	uint32_t seed, uint32_t n, glm::vec3* pos_, glm::vec3* vel_) {
+	const float pi = glm::pi<float>();
+	const float alpha = 2.0f * pi * (rng::random_uniform(seed, n, 0) - 0.5f);
+	const float beta = 0.5f * pi * rng::random_uniform(seed, n, 1);
+	const glm::vec3 fountain_dir = glm::vec3(
+		std::cos(alpha) * std::cos(beta),
+		std::sin(beta),
+		std::sin(alpha) * std::cos(beta));
+	const glm::vec3 u = glm::vec3(rng::random_uniform(seed, n, 3),
+		rng::random_uniform(seed, n, 4), rng::random_uniform(seed, n, 5));
+
+	glm::vec3 dir = fountain_dir;
+	glm::vec3& pos = *pos_;
+	if (e.shape == EMITTER_SPHERE) {
+		const float z = 2.0f * u.x - 1.0f;
+		const float phi = 2.0f * pi * u.y;
+		const float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		dir = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+		pos = e.pos + e.size.x * dir;
+	}
+	else if (e.shape == EMITTER_BOX) {
+		pos = e.pos + e.size * (2.0f * u - 1.0f);
+	}
+	else if (e.shape == EMITTER_DISC) {
+		const float r = e.size.x * std::sqrt(u.x);
+		const float theta = 2.0f * pi * u.y;
+		pos = e.pos + glm::vec3(r * std::cos(theta), 0.0f, r * std::sin(theta));
+	}
+	else if (e.shape == EMITTER_MESH && !mesh.area_cdf->empty()) {
+		const std::vector<float>& cdf = *mesh.area_cdf;
+		const size_t t = std::min((size_t)(std::upper_bound(cdf.begin(), cdf.end(), u.x) - cdf.begin()),
+			cdf.size() - 1);
+		const glm::uvec3& f = (*mesh.faces)[t];
+		const glm::vec3& v0 = (*mesh.vertices)[f.x];
+		const glm::vec3& v1 = (*mesh.vertices)[f.y];
+		const glm::vec3& v2 = (*mesh.vertices)[f.z];
+		// Uniform on the triangle
+		const float su = std::sqrt(u.y);
+		dir = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+		// Off the surface, so the first step does not collide with the triangle
+		pos = (1.0f - su) * v0 + su * (1.0f - u.z) * v1 + su * u.z * v2 + particle_size * dir;
+	}
+	else {
+		// Point fountain
+		pos = e.pos + e.size.x * fountain_dir;
+	}
+	*vel_ = dir * e.particle_speed;
+}
+
+} // namespace cpu
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include <algorithm>
+#include "intersections.comp.in"
+
+// C++ versions of the collision routines of intersections.comp.in and of the
+// wall handling in the advect shaders. They must be kept in sync with the GLSL code.
+namespace cpu {
+
+inline bool quadratic_solve(float a, float b, float c, float* t0_, float* t1_) {
+	const float discriminant = b * b - 4.0f * a * c;
+	if (discriminant <= 0.0f) {
+		return false;
+	}
+
+	const float root_discriminant = std::sqrt(discriminant);
+
+	float q;
+	if (b < 0.0f) {
+		q = -0.5f * (b - root_discriminant);
+	}
+	else {
+		q = -0.5f * (b + root_discriminant);
+	}
+
+	const float t0 = q / a;
+	const float t1 = c / q;
+
+	*t0_ = std::min(t0, t1);
+	*t1_ = std::max(t0, t1);
+
+	return true;
+}
+
+inline void intersect(const Sphere& s, float bounce, float friction,
+	glm::vec3* prev_pos_world, glm::vec3* pos_world) {
+	// Move coordinate system and set center of sphere to origin
+	const glm::vec3 o = *prev_pos_world - s.pos;
+	const glm::vec3 d = *pos_world - *prev_pos_world;
+	// Build sphere coefficients
+	const float a = glm::dot(d, d);
+	const float b = 2.0f * glm::dot(d, o);
+	const float c = glm::dot(o, o) - s.radius * s.radius;
+
+	float t0, t1;
+	if (quadratic_solve(a, b, c, &t0, &t1) && t0 > 0.0f && t0 <= 1.0f) {
+		const glm::vec3 intersection = o + t0 * d;
+		const glm::vec3 n = glm::normalize(intersection);
+		// The d of the plane is -radius
+		*pos_world = *pos_world - (1.0f + bounce) * n * (glm::dot(n, *pos_world - s.pos) - s.radius);
+		const glm::vec3 d_proj = n * glm::dot(n, d);
+		const glm::vec3 v_bounce = d - (1.0f + bounce) * d_proj;
+		const glm::vec3 v_friction = v_bounce - friction * (d - d_proj);
+		*prev_pos_world = *pos_world - v_friction;
+	}
+}
+
+// Colide against the 5 walls of the simulation box (there is no ceiling)
+inline void intersect_walls(float simulation_space_size, float bounce,
+	glm::vec3* actual_pos, glm::vec3* new_pos) {
+	// Bottom
+	if (new_pos->y < 0.0f) {
+		const float delta_y = new_pos->y - actual_pos->y;
+		new_pos->y = -new_pos->y * bounce;
+		actual_pos->y = new_pos->y + delta_y * bounce;
+	}
+	// Back
+	if (new_pos->z < 0.0f) {
+		const float delta_z = new_pos->z - actual_pos->z;
+		new_pos->z = -new_pos->z * bounce;
+		actual_pos->z = new_pos->z + delta_z * bounce;
+	}
+	// Left
+	if (new_pos->x < 0.0f) {
+		const float delta_x = new_pos->x - actual_pos->x;
+		new_pos->x = -new_pos->x * bounce;
+		actual_pos->x = new_pos->x + delta_x * bounce;
+	}
+	// Front
+	if (new_pos->z > simulation_space_size) {
+		const float delta_z = new_pos->z - actual_pos->z;
+		new_pos->z = new_pos->z - (1.0f + bounce) * (new_pos->z - simulation_space_size);
+		actual_pos->z = new_pos->z + delta_z * bounce;
+	}
+	// Right
+	if (new_pos->x > simulation_space_size) {
+		const float delta_x = new_pos->x - actual_pos->x;
+		new_pos->x = new_pos->x - (1.0f + bounce) * (new_pos->x - simulation_space_size);
+		actual_pos->x = new_pos->x + delta_x * bounce;
+	}
+}
+
+} // namespace cpu
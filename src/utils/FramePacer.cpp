@@ -0,0 +1,108 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <ctime>
+#endif
+
+FramePacer::FramePacer(double target_fps)
+{
+	set_target_fps(target_fps);
+	m_prev_frame = Clock::now();
+	m_next_frame = m_prev_frame + m_period;
+}
+
+void FramePacer::set_enabled(bool enabled)
+{
+	m_enabled = enabled;
+	m_next_frame = Clock::now() + m_period;
+	m_num_samples = 0;
+	m_sample_idx = 0;
+}
+
+void FramePacer::set_target_fps(double fps)
+{
+	m_target_fps = fps;
+	m_period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+	m_next_frame = Clock::now() + m_period;
+}
+
+void FramePacer::wait_next_frame()
+{
+	Clock::time_point now = Clock::now();
+	float jitter_us = 0.0f;
+
+	if (m_enabled) {
+		// Coarse sleep, then spin
+		const Clock::time_point wake_up = m_next_frame - m_spin_time;
+		if (now < wake_up) {
+			sleep_until(wake_up);
+		}
+		now = Clock::now();
+		while (now < m_next_frame) {
+			std::this_thread::yield();
+			now = Clock::now();
+		}
+
+		jitter_us = std::chrono::duration<float, std::micro>(now - m_next_frame).count();
+
+		// Keep the frames evenly spaced, unless we are so late that catching up
+		// would mean running several frames without waiting
+		m_next_frame += m_period;
+		if (m_next_frame < now) {
+			m_next_frame = now + m_period;
+		}
+	}
+
+	add_sample(jitter_us, std::chrono::duration<float, std::milli>(now - m_prev_frame).count());
+	m_prev_frame = now;
+}
+
+FramePacer::Stats FramePacer::get_stats() const
+{
+	Stats stats = {};
+	stats.num_samples = m_num_samples;
+	if (m_num_samples == 0) {
+		return stats;
+	}
+
+	double sum_jitter = 0.0, sum_jitter_2 = 0.0, sum_frame = 0.0;
+	for (uint32_t i = 0; i < m_num_samples; ++i) {
+		sum_jitter += m_jitter_us[i];
+		sum_jitter_2 += (double)m_jitter_us[i] * m_jitter_us[i];
+		sum_frame += m_frame_ms[i];
+		stats.max_jitter_us = std::max(stats.max_jitter_us, (double)m_jitter_us[i]);
+	}
+	stats.mean_jitter_us = sum_jitter / m_num_samples;
+	stats.stddev_jitter_us = std::sqrt(std::max(0.0,
+		sum_jitter_2 / m_num_samples - stats.mean_jitter_us * stats.mean_jitter_us));
+	stats.mean_frame_ms = sum_frame / m_num_samples;
+	return stats;
+}
+
+void FramePacer::sleep_until(Clock::time_point t)
+{
+#ifdef __linux__
+	// steady_clock is CLOCK_MONOTONIC. An absolute deadline does not drift when interrupted.
+	const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+	timespec ts;
+	ts.tv_sec = (time_t)(ns / 1000000000);
+	ts.tv_nsec = (long)(ns % 1000000000);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+	}
+#else
+	std::this_thread::sleep_until(t);
+#endif
+}
+
+void FramePacer::add_sample(float jitter_us, float frame_ms)
+{
+	m_jitter_us[m_sample_idx] = jitter_us;
+	m_frame_ms[m_sample_idx] = frame_ms;
+	m_sample_idx = (m_sample_idx + 1) % NUM_SAMPLES;
+	m_num_samples = std::min(m_num_samples + 1, NUM_SAMPLES);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <array>
+
+// Limits the frame rate without keeping a core busy.
+// Waits sleep until shortly before the frame is due and only spin for the last
+// part, which is shorter than the wake up latency of the OS timers.
+// Disabled pacers do not wait, but keep measuring the frame times.
+class FramePacer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Stats {
+		// Delay between the time a frame was due and the time the wait returned
+		double mean_jitter_us;
+		double stddev_jitter_us;
+		double max_jitter_us;
+		double mean_frame_ms;
+		uint32_t num_samples;
+	};
+
+	explicit FramePacer(double target_fps = 120.0);
+
+	// Blocks until the next frame is due
+	void wait_next_frame();
+
+	void set_enabled(bool enabled);
+	bool is_enabled() const { return m_enabled; }
+
+	void set_target_fps(double fps);
+	double get_target_fps() const { return m_target_fps; }
+
+	// Time spinning before each frame, instead of sleeping
+	void set_spin_time(std::chrono::microseconds spin_time) { m_spin_time = spin_time; }
+	std::chrono::microseconds get_spin_time() const { return m_spin_time; }
+
+	// Statistics of the last NUM_SAMPLES frames
+	Stats get_stats() const;
+
+private:
+	static constexpr uint32_t NUM_SAMPLES = 256;
+
+	bool m_enabled = true;
+	double m_target_fps;
+	Clock::duration m_period;
+	std::chrono::microseconds m_spin_time = std::chrono::microseconds(250);
+
+	Clock::time_point m_next_frame;
+	Clock::time_point m_prev_frame;
+
+	std::array<float, NUM_SAMPLES> m_jitter_us = {};
+	std::array<float, NUM_SAMPLES> m_frame_ms = {};
+	uint32_t m_num_samples = 0;
+	uint32_t m_sample_idx = 0;
+
+	static void sleep_until(Clock::time_point t);
+	void add_sample(float jitter_us, float frame_ms);
+};
@@ -0,0 +1,104 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include "Tracer.hpp"
+
+ThreadPool::ThreadPool(uint32_t num_threads)
+{
+	if (num_threads == 0) {
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	m_workers.reserve(num_threads - 1);
+	for (uint32_t i = 1; i < num_threads; ++i) {
+		m_workers.emplace_back(&ThreadPool::worker_loop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_work_cv.notify_all();
+	for (std::thread& t : m_workers) {
+		t.join();
+	}
+}
+
+void ThreadPool::parallel_for(uint32_t count, const RangeFunc& func, uint32_t min_chunk)
+{
+	if (count == 0) {
+		return;
+	}
+
+	const uint32_t num_threads = get_num_threads();
+	uint32_t chunk = count / num_threads + (count % num_threads == 0 ? 0 : 1);
+	chunk = std::max(chunk, std::max(min_chunk, 1u));
+
+	// Not worth waking up anybody
+	if (chunk >= count || m_workers.empty()) {
+		func(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_func = &func;
+		m_count = count;
+		m_chunk_size = chunk;
+		m_pending = (uint32_t)m_workers.size();
+		m_generation += 1;
+	}
+	m_work_cv.notify_all();
+
+	// The calling thread takes the first chunk
+	run_chunk(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cv.wait(lock, [this] { return m_pending == 0; });
+	m_func = nullptr;
+}
+
+ThreadPool& ThreadPool::global()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::worker_loop(uint32_t thread_idx)
+{
+	Tracer::global().set_thread_name("worker " + std::to_string(thread_idx));
+
+	uint64_t seen_generation = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_cv.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+			if (m_stop) {
+				return;
+			}
+			seen_generation = m_generation;
+		}
+
+		run_chunk(thread_idx);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending -= 1;
+		}
+		m_done_cv.notify_one();
+	}
+}
+
+void ThreadPool::run_chunk(uint32_t thread_idx) const
+{
+	const uint64_t begin = (uint64_t)thread_idx * m_chunk_size;
+	if (begin >= m_count) {
+		return;
+	}
+	const uint32_t end = (uint32_t)std::min<uint64_t>(begin + m_chunk_size, m_count);
+	Tracer::Scope trace("parallel_for");
+	(*m_func)((uint32_t)begin, end, thread_idx);
+}
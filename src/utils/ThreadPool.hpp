@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// Fixed set of worker threads used by the CPU simulation paths.
+// Work is split statically: chunk i of a parallel_for always runs on thread i,
+// so callers can keep per-thread scratch arrays indexed by the thread id.
+class ThreadPool {
+public:
+	// Range function. Receives [begin, end) and the index of the executing thread
+	using RangeFunc = std::function<void(uint32_t begin, uint32_t end, uint32_t thread_idx)>;
+
+	// num_threads == 0 uses all the hardware threads. The calling thread counts as one.
+	explicit ThreadPool(uint32_t num_threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Split [0, count) in one contiguous chunk per thread and block until all are done.
+	// Chunks are not made smaller than min_chunk elements, so small ranges use fewer threads.
+	void parallel_for(uint32_t count, const RangeFunc& func, uint32_t min_chunk = 1);
+
+	uint32_t get_num_threads() const { return (uint32_t)m_workers.size() + 1; }
+
+	// Pool shared by all the systems
+	static ThreadPool& global();
+
+private:
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_work_cv;
+	std::condition_variable m_done_cv;
+
+	const RangeFunc* m_func = nullptr;
+	uint32_t m_count = 0;
+	uint32_t m_chunk_size = 0;
+	uint64_t m_generation = 0;
+	uint32_t m_pending = 0;
+	bool m_stop = false;
+
+	void worker_loop(uint32_t thread_idx);
+	void run_chunk(uint32_t thread_idx) const;
+};
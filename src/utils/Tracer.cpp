@@ -0,0 +1,141 @@
+#include "Tracer.hpp"
+
+#include <chrono>
+#include <fstream>
+
+namespace {
+const std::chrono::steady_clock::time_point g_start = std::chrono::steady_clock::now();
+
+void write_escaped(std::ostream& out, const std::string& s)
+{
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out << '\\';
+		}
+		out << c;
+	}
+}
+} // namespace
+
+Tracer::Scope::Scope(const char* name) : m_name(nullptr)
+{
+	if (Tracer::global().is_enabled()) {
+		m_name = name;
+		m_begin_ns = now_ns();
+	}
+}
+
+Tracer::Scope::~Scope()
+{
+	if (m_name != nullptr) {
+		Tracer::global().record(m_name, m_begin_ns, now_ns());
+	}
+}
+
+Tracer::Tracer()
+{
+	m_gpu_buffer.tid = 0;
+	m_gpu_buffer.name = "GPU";
+}
+
+Tracer& Tracer::global()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+int64_t Tracer::now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_start).count();
+}
+
+void Tracer::set_enabled(bool enabled)
+{
+	if (enabled && !is_enabled()) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (std::unique_ptr<ThreadBuffer>& buffer : m_buffers) {
+			buffer->num_written.store(0, std::memory_order_relaxed);
+		}
+		m_gpu_buffer.num_written.store(0, std::memory_order_relaxed);
+	}
+	m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::ThreadBuffer::push(const Event& e)
+{
+	const uint64_t idx = num_written.load(std::memory_order_relaxed);
+	events[idx % RING_SIZE] = e;
+	num_written.store(idx + 1, std::memory_order_release);
+}
+
+Tracer::ThreadBuffer& Tracer::get_thread_buffer()
+{
+	thread_local ThreadBuffer* buffer = nullptr;
+	if (buffer == nullptr) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_buffers.push_back(std::make_unique<ThreadBuffer>());
+		buffer = m_buffers.back().get();
+		buffer->tid = (uint32_t)m_buffers.size();
+		buffer->name = "thread " + std::to_string(buffer->tid);
+	}
+	return *buffer;
+}
+
+void Tracer::set_thread_name(const std::string& name)
+{
+	ThreadBuffer& buffer = get_thread_buffer();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	buffer.name = name;
+}
+
+void Tracer::record(const char* name, int64_t begin_ns, int64_t end_ns)
+{
+	get_thread_buffer().push({ name, begin_ns, end_ns });
+}
+
+void Tracer::record_gpu(const char* name, int64_t begin_ns, int64_t end_ns)
+{
+	if (is_enabled()) {
+		m_gpu_buffer.push({ name, begin_ns, end_ns });
+	}
+}
+
+bool Tracer::write_json(const std::filesystem::path& path) const
+{
+	std::ofstream file(path);
+	if (!file) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	bool first = true;
+	// CPU threads in process 0, the GPU in process 1
+	const auto write_buffer = [&](const ThreadBuffer& buffer, uint32_t pid) {
+		file << (first ? "\n" : ",\n");
+		first = false;
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buffer.tid
+			<< ",\"args\":{\"name\":\"";
+		write_escaped(file, buffer.name);
+		file << "\"}}";
+
+		const uint64_t num_written = buffer.num_written.load(std::memory_order_acquire);
+		const uint64_t first_idx = num_written > RING_SIZE ? num_written - RING_SIZE : 0;
+		for (uint64_t i = first_idx; i < num_written; ++i) {
+			const Event& e = buffer.events[i % RING_SIZE];
+			file << ",\n{\"name\":\"";
+			write_escaped(file, e.name);
+			file << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buffer.tid
+				<< ",\"ts\":" << (double)e.begin_ns * 1.0e-3
+				<< ",\"dur\":" << (double)(e.end_ns - e.begin_ns) * 1.0e-3 << "}";
+		}
+	};
+
+	file.precision(15);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (const std::unique_ptr<ThreadBuffer>& buffer : m_buffers) {
+		write_buffer(*buffer, 0);
+	}
+	write_buffer(m_gpu_buffer, 1);
+	file << "\n]}\n";
+	return (bool)file;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+// Timeline of named scopes of every thread, written as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev).
+// Each thread records into its own ring of the last RING_SIZE events, without locks.
+// The GPU passes of GpuProfiler go to a track of their own.
+//
+// Scope names are not copied, they must be string literals or live as long as the tracer.
+class Tracer {
+public:
+	class Scope {
+	public:
+		explicit Scope(const char* name);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		const char* m_name;
+		int64_t m_begin_ns;
+	};
+
+	// Enabling clears the events recorded so far
+	void set_enabled(bool enabled);
+	bool is_enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+	// Name of the calling thread in the trace
+	void set_thread_name(const std::string& name);
+
+	// Complete event of the calling thread, in the time base of now_ns()
+	void record(const char* name, int64_t begin_ns, int64_t end_ns);
+	// Complete event of the GPU track. Only called from the thread that owns the GL context.
+	void record_gpu(const char* name, int64_t begin_ns, int64_t end_ns);
+
+	// Only call when the rest of threads are not recording, e.g. between frames.
+	// Events recorded meanwhile could be torn.
+	bool write_json(const std::filesystem::path& path) const;
+
+	// Nanoseconds of the steady clock since the start of the program
+	static int64_t now_ns();
+
+	static Tracer& global();
+
+private:
+	static constexpr uint32_t RING_SIZE = 1 << 16;
+
+	struct Event {
+		const char* name;
+		int64_t begin_ns;
+		int64_t end_ns;
+	};
+
+	// Written by a single thread, read by write_json
+	struct ThreadBuffer {
+		std::array<Event, RING_SIZE> events;
+		std::atomic<uint64_t> num_written = 0;
+		uint32_t tid;
+		std::string name;
+
+		void push(const Event& e);
+	};
+
+	std::atomic<bool> m_enabled = false;
+
+	// Only locked to register threads and to write
+	mutable std::mutex m_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+	ThreadBuffer m_gpu_buffer;
+
+	Tracer();
+	ThreadBuffer& get_thread_buffer();
+};